@@ -0,0 +1,582 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "cipher_io.h"
+#include "workers.h"
+#include "cpu.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+static char *prog_name = "analyze";
+static char *prog_version = "1.0";
+static char *invoc_name = NULL;
+static char *author = "a-chap";
+
+/* Pieces of the input shared out between the workers. */
+#define CHUNK_SIZE (1 << 22)
+
+/* Input that can't be mapped is read this much at a time. */
+#define READ_SIZE (1 << 26)
+
+/*
+ * The counters are spread over BANKS copies, the nth letter of a
+ * chunk going in bank n % BANKS, so a run of the same letter or pair
+ * doesn't have each increment wait on the store of the one before.
+ * NONE stands for the letter before the first of a chunk, so the
+ * n-grams running into its start need no test: they land in rows of
+ * their own that are dropped when the counts are merged, and the
+ * letters either side of each chunk are joined up afterwards.
+ */
+#define BANKS 4
+#define NONE 26
+
+struct histogram {
+    uint64_t unigrams[BANKS][26];
+    uint64_t bigrams[BANKS][27 * 26];
+    uint64_t trigrams[27 * 27 * 26];
+};
+
+/*
+ * A chunk, and what the worker that counted it found out about its
+ * ends: the first and last two letters, NONE where it has fewer, and
+ * the pairs of the same letter starting at even and odd letters.
+ */
+struct chunk {
+    const unsigned char *data;
+    size_t len;
+    uint64_t letters;
+    int first[2];
+    int last[2];
+    uint64_t doubled[2];
+};
+
+/* Where a worker is in the chunk it is counting. */
+struct counting {
+    int p1, p2;         /* the last letter and the one before */
+    uint64_t k;         /* letters so far */
+    uint64_t doubled[2];
+};
+
+struct analysis {
+    struct workers *workers;
+    struct histogram *histograms;   /* one for each worker */
+    struct chunk *chunks;
+    int nchunks;
+    int next;
+};
+
+/* Everything counted, across all of the input. */
+struct totals {
+    unsigned long long bytes;
+    unsigned long long letters;
+    uint64_t unigrams[26];
+    uint64_t bigrams[26 * 26];
+    uint64_t trigrams[26 * 26 * 26];
+    unsigned long long doubled;     /* at the start of a digraph */
+    int files;
+    int odd_files;
+};
+
+/* Each file's letters are one stream, joined up across its chunks. */
+struct stream {
+    int p1, p2;
+    unsigned long long letters;
+};
+
+static struct totals totals;
+static void (*count)(struct histogram *h, struct counting *s,
+                     const unsigned char *in, size_t len);
+
+static struct option options[] = {
+    { "jobs", required_argument, NULL, 'j'},
+    { "top", required_argument, NULL, 'n'},
+    { "json", no_argument, NULL, 'J'},
+    { "help", no_argument, NULL, 'h'},
+    { "version", no_argument, NULL, 'v'},
+    { NULL, 0, NULL, 0 }
+};
+
+static void print_version();
+static void print_help();
+
+static void analyze_file(struct analysis *a, int fd);
+static void analyze_buffer(struct analysis *a, struct stream *st,
+                           const unsigned char *data, size_t len);
+static void merge(struct analysis *a);
+static void print_text(int top);
+static void print_json(int top);
+
+int main(int argc, char **argv) {
+    static struct analysis a;
+    int jobs = 0;
+    int top = -1;
+    int json = 0;
+    invoc_name = argv[0];
+
+    int c;
+    while ((c = getopt_long(argc, argv, "j:n:hv", options, NULL)) != -1) {
+        switch(c) {
+            case 'j':
+                jobs = atoi(optarg);
+                if ( jobs < 1 ) {
+                    fprintf(stderr, "%s: The number of jobs needs to be at "
+                                    "least 1.\n"
+                                    "Try '%s --help' for more information.\n"
+                                    , invoc_name, invoc_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'n':
+                top = atoi(optarg);
+                if ( top < 0 ) {
+                    fprintf(stderr, "%s: --top needs a number of n-grams.\n"
+                                    "Try '%s --help' for more information.\n"
+                                    , invoc_name, invoc_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'J':
+                json = 1;
+                break;
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+            case 'v':
+                print_version();
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                fprintf(stderr, "Try '%s --help' for more information.\n", invoc_name);
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+
+    if ( jobs == 0 )
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( top == -1 )
+        top = json? 0 : 20;
+
+    if ( ( a.workers = workers_start(jobs) ) == NULL
+      || ( a.histograms = calloc(workers_count(a.workers),
+                                 sizeof(*a.histograms)) ) == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( optind == argc ) {
+        analyze_file(&a, STDIN_FILENO);
+    } else {
+        for (int i = optind; i < argc; i++) {
+            int fd = io_open(argv[i], 0);
+            if ( fd == -1 ) {
+                fprintf(stderr, "%s: ", invoc_name);
+                perror(argv[i]);
+                continue;
+            }
+
+            analyze_file(&a, fd);
+
+            close(fd);
+        }
+    }
+
+    merge(&a);
+    if ( json )
+        print_json(top);
+    else
+        print_text(top);
+
+    workers_stop(a.workers);
+    return 0;
+}
+
+__attribute__((always_inline))
+static inline void count_letter(struct histogram *h, struct counting *s, int x) {
+    int bank = s->k & (BANKS - 1);
+
+    h->unigrams[bank][x]++;
+    h->bigrams[bank][s->p1 * 26 + x]++;
+    h->trigrams[(s->p2 * 27 + s->p1) * 26 + x]++;
+
+    /* The pair ending here starts at letter k - 1. */
+    s->doubled[~s->k & 1] += s->p1 == x;
+
+    s->p2 = s->p1;
+    s->p1 = x;
+    s->k++;
+}
+
+static void count_scalar(struct histogram *h, struct counting *s,
+                         const unsigned char *in, size_t len) {
+    for (size_t j = 0; j < len; j++) {
+        unsigned x = (in[j] | 0x20) - 'a';
+        if ( x < 26 )
+            count_letter(h, s, x);
+    }
+}
+
+#ifdef CPU_X86
+/*
+ * Classifies 32 bytes at a time, skipping straight past any without
+ * letters, and counts the letters of the rest from the set bits of
+ * the mask.
+ */
+__attribute__((target("avx2")))
+static void count_avx2(struct histogram *h, struct counting *s,
+                       const unsigned char *in, size_t len) {
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i lower_a = _mm256_set1_epi8('a');
+    const __m256i n25 = _mm256_set1_epi8(25);
+    unsigned char x[32] __attribute__((aligned(32)));
+
+    for (; len >= 32; in += 32, len -= 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *) in);
+        __m256i v = _mm256_sub_epi8(_mm256_or_si256(c, case_bit), lower_a);
+        unsigned mask = _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_min_epu8(v, n25), v));
+        if ( mask == 0 )
+            continue;
+
+        _mm256_store_si256((__m256i *) x, v);
+        do {
+            count_letter(h, s, x[__builtin_ctz(mask)]);
+            mask &= mask - 1;
+        } while ( mask != 0 );
+    }
+
+    count_scalar(h, s, in, len);
+}
+#endif
+
+static void count_chunk(struct histogram *h, struct chunk *c) {
+    struct counting s = { NONE, NONE, 0, { 0, 0 } };
+
+    count(h, &s, c->data, c->len);
+
+    c->letters = s.k;
+    c->last[0] = s.p2;
+    c->last[1] = s.p1;
+    c->doubled[0] = s.doubled[0];
+    c->doubled[1] = s.doubled[1];
+
+    c->first[0] = c->first[1] = NONE;
+    for (size_t j = 0, n = 0; j < c->len && n < 2 && n < s.k; j++) {
+        unsigned x = (c->data[j] | 0x20) - 'a';
+        if ( x < 26 )
+            c->first[n++] = x;
+    }
+}
+
+/* Each worker counts chunks into its own histogram until none are left. */
+static void count_job(void *arg, int worker) {
+    struct analysis *a = arg;
+    int c;
+
+    while ( ( c = __atomic_fetch_add(&a->next, 1, __ATOMIC_RELAXED) ) < a->nchunks )
+        count_chunk(&a->histograms[worker], &a->chunks[c]);
+}
+
+/*
+ * Adds what crosses into chunk c from the letters before it in the
+ * stream, which the worker couldn't see: the pair and the two triples
+ * running over its start.
+ */
+static void join(struct stream *st, const struct chunk *c) {
+    int f0 = c->first[0], f1 = c->first[1];
+
+    if ( c->letters == 0 )
+        return;
+
+    if ( st->p1 != NONE ) {
+        totals.bigrams[st->p1 * 26 + f0]++;
+        if ( st->p2 != NONE )
+            totals.trigrams[(st->p2 * 26 + st->p1) * 26 + f0]++;
+        if ( f1 != NONE )
+            totals.trigrams[(st->p1 * 26 + f0) * 26 + f1]++;
+        /* The pair over the join is a digraph if p1 is an even letter. */
+        if ( ( st->letters & 1 ) && st->p1 == f0 )
+            totals.doubled++;
+    }
+    totals.doubled += c->doubled[st->letters & 1];
+
+    if ( c->letters >= 2 ) {
+        st->p2 = c->last[0];
+        st->p1 = c->last[1];
+    } else {
+        st->p2 = st->p1;
+        st->p1 = f0;
+    }
+    st->letters += c->letters;
+}
+
+/*
+ * Regular files are mapped and counted straight from the mapping as
+ * a whole, anything else is read a large buffer at a time.
+ */
+static void analyze_file(struct analysis *a, int fd) {
+    static unsigned char *buf = NULL;
+    struct stream st = { NONE, NONE, 0 };
+    struct io_map map;
+    ssize_t n;
+
+    if ( io_map(fd, 0, &map) == 0 ) {
+        analyze_buffer(a, &st, map.data, map.len);
+        io_unmap(&map);
+    } else {
+        if ( buf == NULL && ( buf = malloc(READ_SIZE) ) == NULL ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        /*
+         * Pipes give what they have, and the threads are worth
+         * starting only for a full buffer.
+         */
+        do {
+            size_t got = 0;
+            while ( got < READ_SIZE
+                 && ( n = io_read(fd, buf + got, READ_SIZE - got) ) > 0 )
+                got += n;
+            if ( got > 0 )
+                analyze_buffer(a, &st, buf, got);
+        } while ( n > 0 );
+        if ( n == -1 )
+            perror(invoc_name);
+    }
+
+    totals.files++;
+    totals.odd_files += st.letters & 1;
+    totals.letters += st.letters;
+}
+
+static void analyze_buffer(struct analysis *a, struct stream *st,
+                           const unsigned char *data, size_t len) {
+    static int size = 0;
+    int nchunks = (len + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    if ( count == NULL ) {
+        count = count_scalar;
+#ifdef CPU_X86
+        if ( cpu_features() & CPU_AVX2 )
+            count = count_avx2;
+#endif
+    }
+
+    if ( nchunks > size ) {
+        size = nchunks;
+        if ( ( a->chunks = realloc(a->chunks, size * sizeof(*a->chunks)) ) == NULL ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int c = 0; c < nchunks; c++) {
+        a->chunks[c].data = data + (size_t) c * CHUNK_SIZE;
+        a->chunks[c].len = len - (size_t) c * CHUNK_SIZE < CHUNK_SIZE?
+                           len - (size_t) c * CHUNK_SIZE : CHUNK_SIZE;
+    }
+    a->nchunks = nchunks;
+    a->next = 0;
+    workers_run(a->workers, workers_count(a->workers), count_job, a);
+
+    for (int c = 0; c < nchunks; c++)
+        join(st, &a->chunks[c]);
+    totals.bytes += len;
+}
+
+/* Adds up the workers' histograms, leaving out the NONE rows. */
+static void merge(struct analysis *a) {
+    for (int w = 0; w < workers_count(a->workers); w++) {
+        const struct histogram *h = &a->histograms[w];
+
+        for (int b = 0; b < BANKS; b++) {
+            for (int x = 0; x < 26; x++)
+                totals.unigrams[x] += h->unigrams[b][x];
+            for (int x = 0; x < 26 * 26; x++)
+                totals.bigrams[x] += h->bigrams[b][x];
+        }
+        for (int p2 = 0; p2 < 26; p2++)
+            for (int p1 = 0; p1 < 26; p1++)
+                for (int x = 0; x < 26; x++)
+                    totals.trigrams[(p2 * 26 + p1) * 26 + x]
+                        += h->trigrams[(p2 * 27 + p1) * 26 + x];
+    }
+}
+
+static double index_of_coincidence(void) {
+    double sum = 0;
+    double n = totals.letters;
+
+    if ( n < 2 )
+        return 0;
+    for (int x = 0; x < 26; x++)
+        sum += (double) totals.unigrams[x] * (totals.unigrams[x] - 1);
+    return sum / (n * (n - 1));
+}
+
+/*
+ * Playfair only ever writes an even number of letters, never a J and
+ * never a digraph of the same letter twice.
+ */
+static int playfair_consistent(void) {
+    return totals.letters > 0 && totals.unigrams['J' - 'A'] == 0
+        && totals.doubled == 0 && totals.odd_files == 0;
+}
+
+static const uint64_t *sorting;
+
+static int by_count(const void *a, const void *b) {
+    int i = *(const int *) a, j = *(const int *) b;
+    if ( sorting[i] != sorting[j] )
+        return sorting[i] < sorting[j]? 1 : -1;
+    return i - j;
+}
+
+/*
+ * The n-grams in counts that turned up at all, most common first,
+ * with how many there are in *seen.
+ */
+static int *most_common(const uint64_t *counts, int n, int *seen) {
+    int *order = malloc(n * sizeof(int));
+    int found = 0;
+
+    if ( order == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++)
+        if ( counts[i] > 0 )
+            order[found++] = i;
+
+    sorting = counts;
+    qsort(order, found, sizeof(int), by_count);
+
+    *seen = found;
+    return order;
+}
+
+static void ngram_name(char *name, int i, int length) {
+    for (int k = length - 1; k >= 0; k--) {
+        name[k] = 'A' + i % 26;
+        i /= 26;
+    }
+    name[length] = '\0';
+}
+
+static uint64_t sum(const uint64_t *counts, int n) {
+    uint64_t total = 0;
+    for (int i = 0; i < n; i++)
+        total += counts[i];
+    return total;
+}
+
+static void print_ngrams(const char *title, const uint64_t *counts, int n,
+                         int length, int top) {
+    uint64_t total = sum(counts, n);
+    int seen;
+    int *order = most_common(counts, n, &seen);
+    int shown = top && top < seen? top : seen;
+    char name[4];
+
+    printf("\n%s, %d of %d seen:\n", title, shown, seen);
+    for (int i = 0; i < shown; i++) {
+        ngram_name(name, order[i], length);
+        printf("  %s %12llu %7.3f%%\n", name,
+               (unsigned long long) counts[order[i]],
+               100.0 * counts[order[i]] / total);
+    }
+
+    free(order);
+}
+
+static void print_text(int top) {
+    printf("%llu bytes, %llu letters in %d file%s\n", totals.bytes,
+           totals.letters, totals.files, totals.files == 1? "" : "s");
+    printf("Index of coincidence: %.5f (English is about 0.0667, "
+           "random 0.0385)\n", index_of_coincidence());
+
+    print_ngrams("Letters", totals.unigrams, 26, 1, 0);
+    print_ngrams("Bigrams", totals.bigrams, 26 * 26, 2, top);
+    print_ngrams("Trigrams", totals.trigrams, 26 * 26 * 26, 3, top);
+
+    printf("\nPlayfair:\n"
+           "  letter J          %llu\n"
+           "  doubled digraphs  %llu\n"
+           "  files with an odd number of letters  %d\n"
+           "  %s\n",
+           (unsigned long long) totals.unigrams['J' - 'A'], totals.doubled,
+           totals.odd_files, playfair_consistent()? "consistent with Playfair"
+                                                  : "not Playfair");
+}
+
+static void print_json_ngrams(const char *key, const uint64_t *counts, int n,
+                              int length, int top) {
+    int seen;
+    int *order = most_common(counts, n, &seen);
+    int shown = top && top < seen? top : seen;
+    char name[4];
+
+    printf("  \"%s\": {", key);
+    for (int i = 0; i < shown; i++) {
+        ngram_name(name, order[i], length);
+        printf("%s\"%s\": %llu", i? ", " : "", name,
+               (unsigned long long) counts[order[i]]);
+    }
+    printf("},\n");
+
+    free(order);
+}
+
+static void print_json(int top) {
+    printf("{\n"
+           "  \"bytes\": %llu,\n"
+           "  \"letters\": %llu,\n"
+           "  \"files\": %d,\n"
+           "  \"index_of_coincidence\": %.6f,\n",
+           totals.bytes, totals.letters, totals.files, index_of_coincidence());
+
+    print_json_ngrams("unigrams", totals.unigrams, 26, 1, 0);
+    print_json_ngrams("bigrams", totals.bigrams, 26 * 26, 2, top);
+    print_json_ngrams("trigrams", totals.trigrams, 26 * 26 * 26, 3, top);
+
+    printf("  \"playfair\": {\"j\": %llu, \"doubled_digraphs\": %llu, "
+           "\"odd_files\": %d, \"consistent\": %s}\n"
+           "}\n",
+           (unsigned long long) totals.unigrams['J' - 'A'], totals.doubled,
+           totals.odd_files, playfair_consistent()? "true" : "false");
+}
+
+static void print_version() {
+    printf("%s %s\n"
+           "\n"
+           "Written by %s\n",
+           prog_name, prog_version, author);
+}
+
+static void print_help() {
+    printf("Usage: %s [OPTION]... [FILE]...\n"
+           "\n"
+           "Counts the letters, bigrams and trigrams of stdin or FILEs,\n"
+           "ignoring case and anything that isn't a letter, and prints\n"
+           "them with the index of coincidence and whether the letters\n"
+           "could be Playfair cipher text: no J, an even number of them\n"
+           "in each file and no digraph of the same letter twice.\n"
+           "\n"
+           "    -j, --jobs N    count with N threads, by default one per\n"
+           "                    processor.\n"
+           "    -n, --top N     list the N most common bigrams and\n"
+           "                    trigrams, or all of them for 0. Defaults\n"
+           "                    to 20, or all of them with --json.\n"
+           "        --json      print the results as JSON.\n"
+           "    -h, --help      display this help and exit.\n"
+           "    -v, --version   display version information and exit.\n",
+           invoc_name);
+}
@@ -0,0 +1,536 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "cipher_io.h"
+#include "batch.h"
+
+/*
+ * Files bigger than a piece are split into pieces when the cipher can
+ * start part way through, and smaller ones grouped until a group has
+ * about a piece's worth, or GROUP_FILES of them.
+ */
+#define PIECE_SIZE (1 << 22)
+#define GROUP_FILES 256
+
+/* The output of each job is written a buffer of this at a time. */
+#define OUT_SIZE (1 << 20)
+
+struct batch_file {
+    char *path;
+    char *out_path;
+    unsigned long long size;
+    mode_t mode;
+
+    /*
+     * For a file split into pieces, shared by their jobs: the input
+     * mapped and the output created once, the count of the input
+     * before each piece, and how many pieces are still to finish, the
+     * last one to renaming the output into place.
+     */
+    int pieces;
+    struct io_map map;
+    int out_fd;
+    char *tmp_path;
+    unsigned long long *before;
+    int remaining;
+    int failed;
+};
+
+/* A piece of a split file, or a group of whole ones. */
+struct batch_job {
+    int file;
+    int piece;      /* -1 for a group */
+    int nfiles;
+};
+
+struct batch {
+    const struct batch_cipher *cipher;
+    const char *dir;
+    int recursive;
+    const char *name;
+
+    struct batch_file *files;
+    int nfiles, files_size;
+    struct batch_job *jobs;
+    int njobs;
+    int failures;
+};
+
+static void fail(struct batch *b, const char *path, int err) {
+    fprintf(stderr, "%s: %s: %s\n", b->name, path, strerror(err));
+    __atomic_fetch_add(&b->failures, 1, __ATOMIC_RELAXED);
+}
+
+static char *join(const char *dir, const char *name) {
+    size_t len = strlen(dir);
+    char *path = malloc(len + strlen(name) + 2);
+    if ( path == NULL ) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(path, dir);
+    if ( *name != '\0' ) {
+        if ( len > 0 && dir[len - 1] != '/' )
+            strcat(path, "/");
+        strcat(path, name);
+    }
+    return path;
+}
+
+/*
+ * The name a FILE on the command line goes by under DIR, its last
+ * component, like cp. Directories such as . and / that have no name
+ * of their own have their contents put straight into DIR.
+ */
+static char *output_name(const char *path) {
+    size_t end = strlen(path);
+    while ( end > 0 && path[end - 1] == '/' )
+        end--;
+    size_t start = end;
+    while ( start > 0 && path[start - 1] != '/' )
+        start--;
+
+    char *name = strndup(path + start, end - start);
+    if ( name == NULL ) {
+        perror("strndup");
+        exit(EXIT_FAILURE);
+    }
+    if ( strcmp(name, ".") == 0 || strcmp(name, "..") == 0 )
+        name[0] = '\0';
+    return name;
+}
+
+static void add_file(struct batch *b, char *path, char *out_path,
+                     const struct stat *st) {
+    if ( b->nfiles == b->files_size ) {
+        b->files_size = b->files_size? 2 * b->files_size : 64;
+        b->files = realloc(b->files, b->files_size * sizeof(*b->files));
+        if ( b->files == NULL ) {
+            perror(b->name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct batch_file *f = &b->files[b->nfiles++];
+    memset(f, 0, sizeof(*f));
+    f->path = path;
+    f->out_path = out_path;
+    f->size = S_ISREG(st->st_mode)? st->st_size : 0;
+    f->mode = st->st_mode & 0777;
+    f->out_fd = -1;
+}
+
+/*
+ * Adds path, to go to out_path, walking it if it's a directory.
+ * Within the walk, anything that is neither a file nor a directory,
+ * symbolic links included, is left alone.
+ */
+static void add_path(struct batch *b, char *path, char *out_path, int top) {
+    struct stat st;
+
+    if ( ( top? stat(path, &st) : lstat(path, &st) ) == -1 ) {
+        fail(b, path, errno);
+        goto skip;
+    }
+
+    if ( S_ISDIR(st.st_mode) ) {
+        DIR *d;
+        struct dirent *entry;
+
+        if ( !b->recursive ) {
+            fail(b, path, EISDIR);
+            goto skip;
+        }
+        if ( mkdir(out_path, 0777) == -1 && errno != EEXIST ) {
+            fail(b, out_path, errno);
+            goto skip;
+        }
+        if ( ( d = opendir(path) ) == NULL ) {
+            fail(b, path, errno);
+            goto skip;
+        }
+
+        while ( ( entry = readdir(d) ) != NULL ) {
+            if ( strcmp(entry->d_name, ".") == 0
+              || strcmp(entry->d_name, "..") == 0 )
+                continue;
+            add_path(b, join(path, entry->d_name),
+                     join(out_path, entry->d_name), 0);
+        }
+
+        closedir(d);
+        goto skip;
+    }
+
+    if ( !top && !S_ISREG(st.st_mode) )
+        goto skip;
+
+    add_file(b, path, out_path, &st);
+    return;
+
+skip:
+    free(path);
+    free(out_path);
+}
+
+/* Creates the temporary file path's output goes in until it's done. */
+static int create_output(struct batch *b, struct batch_file *f) {
+    char *slash = strrchr(f->out_path, '/');
+    size_t dir_len = slash != NULL? slash + 1 - f->out_path : 0;
+    const char *base = f->out_path + dir_len;
+
+    f->tmp_path = malloc(strlen(f->out_path) + 9);
+    if ( f->tmp_path == NULL )
+        return -1;
+    sprintf(f->tmp_path, "%.*s.%s.XXXXXX", (int) dir_len, f->out_path, base);
+
+    int fd = mkstemp(f->tmp_path);
+    if ( fd == -1 ) {
+        int err = errno;
+        free(f->tmp_path);
+        f->tmp_path = NULL;
+        errno = err;
+        return -1;
+    }
+    fchmod(fd, f->mode);
+    return fd;
+}
+
+/* Closes the output and renames it into place, or removes it. */
+static void finish_output(struct batch *b, struct batch_file *f, int fd,
+                          int failed) {
+    if ( close(fd) == -1 && !failed ) {
+        fail(b, f->out_path, errno);
+        failed = 1;
+    }
+    if ( !failed && rename(f->tmp_path, f->out_path) == -1 ) {
+        fail(b, f->out_path, errno);
+        failed = 1;
+    }
+    if ( failed )
+        unlink(f->tmp_path);
+
+    free(f->tmp_path);
+    f->tmp_path = NULL;
+}
+
+static int write_out(int fd, const unsigned char *data, size_t len,
+                     long long offset) {
+    __atomic_fetch_add(&io_stats.bytes_written, len, __ATOMIC_RELAXED);
+
+    while ( len > 0 ) {
+        ssize_t n = offset == -1? write(fd, data, len) : pwrite(fd, data, len, offset);
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+        if ( offset != -1 )
+            offset += n;
+    }
+    return 0;
+}
+
+/*
+ * Runs in through the cipher in pieces small enough that their output
+ * fits in out, writing it to fd from offset, or where fd is if -1.
+ */
+static int encrypt_into(const struct batch_cipher *c, void *state,
+                        unsigned char *out, const unsigned char *in,
+                        size_t len, int fd, long long offset) {
+    size_t piece = (OUT_SIZE - c->final_max) / c->growth;
+
+    for (size_t done = 0; done < len; done += piece) {
+        size_t n = len - done < piece? len - done : piece;
+        if ( io_stats.enabled )
+            io_stats_count(in + done, n);
+        n = c->update(state, out, in + done, n);
+        if ( write_out(fd, out, n, offset) == -1 )
+            return -1;
+        if ( offset != -1 )
+            offset += n;
+    }
+    return 0;
+}
+
+/*
+ * Reads all of fd, for the files given on the command line that
+ * can't be mapped. Returns NULL with errno set on error.
+ */
+static unsigned char *read_all(int fd, size_t *len) {
+    size_t size = OUT_SIZE;
+    unsigned char *data = malloc(size);
+    ssize_t n;
+
+    *len = 0;
+    while ( data != NULL ) {
+        if ( *len == size ) {
+            unsigned char *grown = realloc(data, size *= 2);
+            if ( grown == NULL )
+                break;
+            data = grown;
+        }
+
+        n = read(fd, data + *len, size - *len);
+        if ( n == 0 ) {
+            __atomic_fetch_add(&io_stats.bytes_read, *len, __ATOMIC_RELAXED);
+            return data;
+        }
+        if ( n == -1 && errno != EINTR )
+            break;
+        if ( n > 0 )
+            *len += n;
+    }
+
+    int err = errno;
+    free(data);
+    errno = err;
+    return NULL;
+}
+
+static void encrypt_file(struct batch *b, struct batch_file *f, void *state,
+                         unsigned char *out) {
+    const struct batch_cipher *c = b->cipher;
+    unsigned char *data = NULL;
+    struct io_map map;
+    size_t len;
+    int in_fd, out_fd;
+
+    if ( ( in_fd = io_open(f->path, 0) ) == -1 ) {
+        fail(b, f->path, errno);
+        return;
+    }
+
+    if ( io_map(in_fd, 0, &map) == 0 ) {
+        len = map.len;
+    } else if ( ( data = read_all(in_fd, &len) ) == NULL ) {
+        fail(b, f->path, errno);
+        close(in_fd);
+        return;
+    }
+
+    if ( ( out_fd = create_output(b, f) ) == -1 ) {
+        fail(b, f->out_path, errno);
+    } else if ( c->start(state) == -1 ) {
+        fail(b, f->path, errno);
+        finish_output(b, f, out_fd, 1);
+    } else {
+        int failed = encrypt_into(c, state, out, data? data : map.data, len,
+                                  out_fd, -1);
+        if ( !failed && c->final != NULL )
+            failed = write_out(out_fd, out, c->final(state, out), -1);
+        if ( failed )
+            fail(b, f->out_path, errno);
+        if ( c->end != NULL )
+            c->end(state);
+        finish_output(b, f, out_fd, failed);
+    }
+
+    if ( data != NULL )
+        free(data);
+    else
+        io_unmap(&map);
+    close(in_fd);
+}
+
+static void encrypt_piece(struct batch *b, struct batch_file *f, int piece,
+                          void *state, unsigned char *out) {
+    const struct batch_cipher *c = b->cipher;
+    unsigned long long start = (unsigned long long) piece * PIECE_SIZE;
+    size_t len = f->size - start < PIECE_SIZE? f->size - start : PIECE_SIZE;
+
+    if ( !__atomic_load_n(&f->failed, __ATOMIC_RELAXED) ) {
+        if ( c->start(state) == -1 ) {
+            __atomic_store_n(&f->failed, errno, __ATOMIC_RELAXED);
+        } else {
+            c->skip(state, f->before[piece]);
+            if ( encrypt_into(c, state, out, f->map.data + start, len,
+                              f->out_fd, start) == -1 )
+                __atomic_store_n(&f->failed, errno, __ATOMIC_RELAXED);
+            if ( c->end != NULL )
+                c->end(state);
+        }
+    }
+
+    if ( __atomic_sub_fetch(&f->remaining, 1, __ATOMIC_ACQ_REL) > 0 )
+        return;
+
+    if ( f->failed )
+        fail(b, f->out_path, f->failed);
+    finish_output(b, f, f->out_fd, f->failed);
+    io_unmap(&f->map);
+    free(f->before);
+}
+
+static void run_job(void *arg, int n) {
+    struct batch *b = arg;
+    struct batch_job *job = &b->jobs[n];
+    void *state = malloc(b->cipher->state_size);
+    unsigned char *out = malloc(OUT_SIZE);
+
+    if ( state == NULL || out == NULL ) {
+        perror(b->name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( job->piece != -1 )
+        encrypt_piece(b, &b->files[job->file], job->piece, state, out);
+    else
+        for (int i = 0; i < job->nfiles; i++)
+            encrypt_file(b, &b->files[job->file + i], state, out);
+
+    free(state);
+    free(out);
+}
+
+static void count_job(void *arg, int n) {
+    struct batch *b = arg;
+    struct batch_job *job = &b->jobs[n];
+    struct batch_file *f = &b->files[job->file];
+    unsigned long long start = (unsigned long long) job->piece * PIECE_SIZE;
+    size_t len = f->size - start < PIECE_SIZE? f->size - start : PIECE_SIZE;
+
+    /* Counted into the next piece's place, then summed up in order. */
+    if ( job->piece + 1 < f->pieces )
+        f->before[job->piece + 1] = b->cipher->count(f->map.data + start, len);
+}
+
+/*
+ * Maps a file to be split and creates its output at its full size,
+ * so the pieces can be written into it in any order.
+ */
+static int split_file(struct batch *b, struct batch_file *f) {
+    int fd = io_open(f->path, 0);
+    if ( fd == -1 )
+        return -1;
+
+    int mapped = io_map(fd, 0, &f->map);
+    int err = errno;
+    close(fd);
+    if ( mapped == -1 ) {
+        errno = err;
+        return -1;
+    }
+
+    f->size = f->map.len;
+    f->pieces = (f->size + PIECE_SIZE - 1) / PIECE_SIZE;
+    f->remaining = f->pieces;
+    f->before = calloc(f->pieces, sizeof(*f->before));
+
+    if ( f->before == NULL || ( f->out_fd = create_output(b, f) ) == -1
+      || ftruncate(f->out_fd, f->size) == -1 ) {
+        err = errno;
+        if ( f->out_fd != -1 )
+            finish_output(b, f, f->out_fd, 1);
+        io_unmap(&f->map);
+        free(f->before);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static void add_job(struct batch *b, int file, int piece, int nfiles) {
+    struct batch_job *job = &b->jobs[b->njobs++];
+    job->file = file;
+    job->piece = piece;
+    job->nfiles = nfiles;
+}
+
+int batch_run(const struct batch_cipher *cipher, char **paths, int npaths,
+              const char *dir, int recursive, struct workers *w,
+              const char *name) {
+    struct batch b;
+    int njobs = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.cipher = cipher;
+    b.dir = dir;
+    b.recursive = recursive;
+    b.name = name;
+
+    if ( mkdir(dir, 0777) == -1 && errno != EEXIST ) {
+        fail(&b, dir, errno);
+        return b.failures;
+    }
+
+    for (int i = 0; i < npaths; i++) {
+        char *base = output_name(paths[i]);
+        char *path = strdup(paths[i]);
+        if ( path == NULL ) {
+            perror(name);
+            exit(EXIT_FAILURE);
+        }
+        add_path(&b, path, join(dir, base), 1);
+        free(base);
+    }
+
+    /* At most a job for each piece of the split files and each file. */
+    for (int i = 0; i < b.nfiles; i++) {
+        struct batch_file *f = &b.files[i];
+        if ( cipher->skip != NULL && f->size > PIECE_SIZE ) {
+            if ( split_file(&b, f) == -1 ) {
+                fail(&b, f->path, errno);
+                f->pieces = -1;
+            } else
+                njobs += f->pieces;
+        } else
+            njobs++;
+    }
+    if ( ( b.jobs = malloc((njobs + 1) * sizeof(*b.jobs)) ) == NULL ) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+
+    /* The split files' pieces are counted up first, all at once. */
+    for (int i = 0; i < b.nfiles; i++)
+        for (int p = 0; p < b.files[i].pieces; p++)
+            add_job(&b, i, p, 1);
+    if ( cipher->count != NULL ) {
+        workers_run(w, b.njobs, count_job, &b);
+        for (int i = 0; i < b.nfiles; i++)
+            for (int p = 1; p < b.files[i].pieces; p++)
+                b.files[i].before[p] += b.files[i].before[p - 1];
+    } else {
+        for (int i = 0; i < b.nfiles; i++)
+            for (int p = 0; p < b.files[i].pieces; p++)
+                b.files[i].before[p] = (unsigned long long) p * PIECE_SIZE;
+    }
+
+    /*
+     * The pieces go first as the largest jobs, then the rest in
+     * groups, the pool handing each out to the next thread free.
+     */
+    for (int i = 0; i < b.nfiles; ) {
+        unsigned long long size = 0;
+        int first = i;
+
+        while ( i < b.nfiles && b.files[i].pieces == 0
+             && size < PIECE_SIZE && i - first < GROUP_FILES )
+            size += b.files[i++].size;
+        if ( i > first )
+            add_job(&b, first, -1, i - first);
+        else
+            i++;
+    }
+    workers_run(w, b.njobs, run_job, &b);
+
+    for (int i = 0; i < b.nfiles; i++) {
+        free(b.files[i].path);
+        free(b.files[i].out_path);
+    }
+    free(b.files);
+    free(b.jobs);
+    return b.failures;
+}
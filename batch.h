@@ -0,0 +1,50 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+#include "workers.h"
+
+/*
+ * Batch mode, -o DIR: each FILE is encrypted on its own, starting
+ * from the key as given, into a file of the same name in DIR, and
+ * with --recursive directories are walked and their tree recreated
+ * under DIR. Files are shared out between the workers, small ones a
+ * group at a time and, for ciphers that can start part way through,
+ * large ones a piece at a time. Each output is written to a temporary
+ * file beside it and renamed into place once complete, so nothing
+ * ever sees half of one.
+ *
+ * A cipher is given as the size of its state and functions on it:
+ * start() sets up the state for a new file, update() and final() are
+ * the cipher's own, with out room for growth times len and final_max
+ * bytes respectively, and end() frees anything start() allocated.
+ * final and end can be NULL.
+ *
+ * Ciphers whose output is as long as their input can set skip() to
+ * move a freshly started state on to where it would be after some
+ * count of the input, and count() to count it, letters for shift.
+ * Without count() it is bytes.
+ */
+struct batch_cipher {
+    size_t state_size;
+    int (*start)(void *state);
+    size_t (*update)(void *state, unsigned char *out, const unsigned char *in,
+                     size_t len);
+    size_t (*final)(void *state, unsigned char *out);
+    void (*end)(void *state);
+    size_t growth;
+    size_t final_max;
+    unsigned long long (*count)(const unsigned char *in, size_t len);
+    void (*skip)(void *state, unsigned long long count);
+};
+
+/*
+ * Encrypts paths into dir on w. Returns the number of files that
+ * couldn't be, each reported to stderr prefixed by name.
+ */
+int batch_run(const struct batch_cipher *cipher, char **paths, int npaths,
+              const char *dir, int recursive, struct workers *w,
+              const char *name);
+
+#endif
@@ -0,0 +1,387 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "cpu.h"
+#include "ciphers.h"
+
+#ifdef CPU_X86
+#include <x86intrin.h>
+#endif
+
+static char *prog_name = "benchmark";
+static char *prog_version = "1.0";
+static char *invoc_name = NULL;
+static char *author = "a-chap";
+
+/* The ciphers are fed the same size pieces as the tools read. */
+#define PIECE_SIZE (1 << 17)
+
+static struct option options[] = {
+    { "max-size", required_argument, NULL, 's'},
+    { "time", required_argument, NULL, 't'},
+    { "help", no_argument, NULL, 'h'},
+    { "version", no_argument, NULL, 'v'},
+    { NULL, 0, NULL, 0 }
+};
+
+/*
+ * A mode of one of the tools, set up from the same options the tool
+ * would be given. run() encrypts len bytes of in into out and
+ * returns how many bytes it wrote.
+ */
+struct mode {
+    const char *cipher;
+    const char *name;
+    const char *args;
+    size_t (*run)(const struct mode *m, unsigned char *out,
+                  const unsigned char *in, size_t len);
+    int multiplier;
+    int shift;
+    const char *keyword;
+    int options;
+};
+
+static size_t run_shift(const struct mode *m, unsigned char *out,
+                        const unsigned char *in, size_t len);
+static size_t run_xor(const struct mode *m, unsigned char *out,
+                      const unsigned char *in, size_t len);
+static size_t run_playfair(const struct mode *m, unsigned char *out,
+                           const unsigned char *in, size_t len);
+static size_t run_block(const struct mode *m, unsigned char *out,
+                        const unsigned char *in, size_t len);
+
+static const struct mode modes[] = {
+    { "shift", "caesar", "-c", run_shift, 1, 3, NULL, SHIFT_NONE },
+    { "shift", "rot13", "-r", run_shift, 1, 13, NULL, SHIFT_NONE },
+    { "shift", "atbash", "-b", run_shift, 25, 25, NULL, SHIFT_NONE },
+    { "shift", "multiplier", "-m 5 -s 3", run_shift, 5, 3, NULL, SHIFT_NONE },
+    { "shift", "keyword", "-k lemon", run_shift, 1, 0, "lemon", SHIFT_NONE },
+    { "shift", "alphabet", "-a", run_shift, 1, 0,
+      "abcdefghijklmnopqrstuvwxyz", SHIFT_NONE },
+    { "shift", "backwards-alphabet", "-z", run_shift, 1, 0,
+      "zyxwvutsrqponmlkjihgfedcba", SHIFT_NONE },
+    { "shift", "progress", "-k lemon -p", run_shift, 1, 0, "lemon",
+      SHIFT_PROGRESS },
+    { "shift", "decrypt", "-k lemon -d", run_shift, 1, 0, "lemon",
+      SHIFT_DECRYPT },
+    { "xor", "keyword", "lemon", run_xor, 0, 0, "lemon", 0 },
+    { "playfair", "keyword", "keyword", run_playfair, 0, 0, "keyword",
+      PLAYFAIR_NONE },
+    { "playfair", "progress", "-p keyword", run_playfair, 0, 0, "keyword",
+      PLAYFAIR_PROGRESS },
+    { "block", "default", "-b 5 -n 10", run_block, 0, 0, NULL, 0 },
+};
+
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+/* The kinds of input, each generated the same way every run. */
+enum { CORPUS_LETTERS, CORPUS_TEXT, CORPUS_BINARY, NCORPORA };
+
+static const char *corpus_names[NCORPORA] = { "letters", "text", "binary" };
+
+static const size_t sizes[] = {
+    (size_t) 1 << 10, (size_t) 1 << 16, (size_t) 1 << 20,
+    (size_t) 1 << 24, (size_t) 1 << 28, (size_t) 1 << 32,
+};
+
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static void print_version();
+static void print_help();
+
+static size_t parse_size(const char *s);
+static void make_corpus(int kind, unsigned char *buf, size_t len);
+static double now(void);
+static uint64_t cycles(void);
+
+int main(int argc, char **argv) {
+    size_t max_size = (size_t) 1 << 24;
+    double min_time = 0.5;
+
+    invoc_name = argv[0];
+
+    int c;
+    while ((c = getopt_long(argc, argv, "s:t:hv", options, NULL)) != -1) {
+        switch(c) {
+            case 's':
+                max_size = parse_size(optarg);
+                if ( max_size == 0 ) {
+                    fprintf(stderr, "%s: The size needs to be a number of "
+                                    "bytes, optionally followed by K, M or G.\n",
+                                    invoc_name);
+                    fprintf(stderr, "Try '%s --help' for more information.\n",
+                                    invoc_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                min_time = atof(optarg);
+                break;
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+            case 'v':
+                print_version();
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                fprintf(stderr, "Try '%s --help' for more information.\n",
+                                invoc_name);
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+
+    size_t largest = 0;
+    for (size_t s = 0; s < NSIZES && sizes[s] <= max_size; s++)
+        largest = sizes[s];
+    if ( largest == 0 ) {
+        fprintf(stderr, "%s: The smallest corpus is %zu bytes.\n",
+                        invoc_name, sizes[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Playfair and block can write up to twice as much as they read. */
+    unsigned char *in = malloc(largest);
+    unsigned char *out = malloc(2 * largest + PLAYFAIR_FINAL_MAX);
+    if ( in == NULL || out == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("{\n"
+           "  \"kernels\": { \"shift\": \"%s\", \"xor\": \"%s\" },\n"
+           "  \"results\": [",
+           shift_kernel_name(), xor_kernel_name());
+
+    int first = 1;
+    for (int kind = 0; kind < NCORPORA; kind++) {
+        make_corpus(kind, in, largest);
+
+        for (size_t s = 0; s < NSIZES && sizes[s] <= largest; s++) {
+            for (size_t m = 0; m < NMODES; m++) {
+                const struct mode *mode = &modes[m];
+                size_t len = sizes[s];
+                size_t written = 0;
+                long reps = 0;
+
+                /* Once untimed so the first run doesn't pay for page faults. */
+                mode->run(mode, out, in, len);
+
+                double start = now(), elapsed;
+                uint64_t start_cycles = cycles();
+                do {
+                    written = mode->run(mode, out, in, len);
+                    reps++;
+                    elapsed = now() - start;
+                } while ( elapsed < min_time );
+                uint64_t used_cycles = cycles() - start_cycles;
+
+                double bytes = (double) len * reps;
+                printf("%s\n    { \"cipher\": \"%s\", \"mode\": \"%s\", "
+                       "\"args\": \"%s\", \"corpus\": \"%s\", "
+                       "\"bytes\": %zu, \"output_bytes\": %zu, "
+                       "\"reps\": %ld, \"seconds\": %.6f, "
+                       "\"mb_per_s\": %.2f, ",
+                       first? "" : ",", mode->cipher, mode->name, mode->args,
+                       corpus_names[kind], len, written, reps, elapsed,
+                       bytes / elapsed / 1e6);
+                if ( used_cycles )
+                    printf("\"cycles_per_byte\": %.3f }", used_cycles / bytes);
+                else
+                    printf("\"cycles_per_byte\": null }");
+                fflush(stdout);
+                first = 0;
+            }
+        }
+    }
+
+    printf("\n  ]\n}\n");
+
+    free(in);
+    free(out);
+
+    return 0;
+}
+
+static size_t run_shift(const struct mode *m, unsigned char *out,
+                        const unsigned char *in, size_t len) {
+    struct shift_ctx ctx;
+    int keyword[27];
+    int length = 0;
+
+    if ( m->keyword == NULL ) {
+        keyword[length++] = m->shift;
+    } else {
+        for (; m->keyword[length] != '\0'; length++)
+            keyword[length] = m->keyword[length] - 'a';
+    }
+    keyword[length] = -1;
+
+    if ( shift_init(&ctx, keyword, m->multiplier, m->options) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t done = 0; done < len; done += PIECE_SIZE) {
+        size_t n = len - done < PIECE_SIZE? len - done : PIECE_SIZE;
+        if ( shift_update(&ctx, out + done, in + done, n) ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    shift_free(&ctx);
+
+    return len;
+}
+
+static size_t run_xor(const struct mode *m, unsigned char *out,
+                      const unsigned char *in, size_t len) {
+    struct xor_ctx ctx;
+
+    if ( xor_init(&ctx, m->keyword) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t done = 0; done < len; done += PIECE_SIZE) {
+        size_t n = len - done < PIECE_SIZE? len - done : PIECE_SIZE;
+        xor_update(&ctx, out + done, in + done, n);
+    }
+    xor_free(&ctx);
+
+    return len;
+}
+
+static size_t run_playfair(const struct mode *m, unsigned char *out,
+                           const unsigned char *in, size_t len) {
+    static struct playfair_ctx ctx;
+    size_t written = 0;
+
+    playfair_init(&ctx, m->keyword, m->options);
+    for (size_t done = 0; done < len; done += PIECE_SIZE) {
+        size_t n = len - done < PIECE_SIZE? len - done : PIECE_SIZE;
+        written += playfair_update(&ctx, out + written, in + done, n);
+    }
+    written += playfair_final(&ctx, out + written);
+
+    return written;
+}
+
+static size_t run_block(const struct mode *m, unsigned char *out,
+                        const unsigned char *in, size_t len) {
+    struct block_ctx ctx;
+    size_t written = 0;
+
+    block_init(&ctx, 5, 10);
+    for (size_t done = 0; done < len; done += PIECE_SIZE) {
+        size_t n = len - done < PIECE_SIZE? len - done : PIECE_SIZE;
+        written += block_update(&ctx, out + written, in + done, n);
+    }
+
+    return written;
+}
+
+/*
+ * The corpora come from a fixed seed xorshift generator so every run,
+ * on every machine, encrypts exactly the same bytes.
+ */
+static void make_corpus(int kind, unsigned char *buf, size_t len) {
+    static const char text[] = "abcdefghijklmnopqrstuvwxyz"
+                               "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                               "0123456789 .,;:'\"!?()-\n"
+                               "etaoinshrdlu     ";
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+
+    for (size_t i = 0; i < len; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        uint32_t r = state >> 32;
+        switch ( kind ) {
+            case CORPUS_LETTERS:
+                buf[i] = 'a' + r % 26;
+                break;
+            case CORPUS_TEXT:
+                buf[i] = text[r % (sizeof(text) - 1)];
+                break;
+            default:
+                buf[i] = r;
+                break;
+        }
+    }
+}
+
+static size_t parse_size(const char *s) {
+    char *end;
+    unsigned long long size = strtoull(s, &end, 10);
+
+    switch ( *end ) {
+        case 'k': case 'K':
+            size <<= 10;
+            end++;
+            break;
+        case 'm': case 'M':
+            size <<= 20;
+            end++;
+            break;
+        case 'g': case 'G':
+            size <<= 30;
+            end++;
+            break;
+    }
+
+    if ( *end != '\0' || size > SIZE_MAX )
+        return 0;
+    return size;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+ * The time stamp counter, which on current processors ticks at a
+ * fixed rate near the nominal clock speed. Elsewhere there is no
+ * counter and no cycles are reported.
+ */
+static uint64_t cycles(void) {
+#ifdef CPU_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void print_version() {
+    printf("%s %s\n"
+           "\n"
+           "Written by %s\n",
+           prog_name, prog_version, author);
+}
+
+static void print_help() {
+    printf("Usage: %s [OPTION]...\n"
+           "\n"
+           "Measures how fast each mode of the ciphers encrypts generated\n"
+           "letters, mixed text and random binary, from 1K up to the\n"
+           "largest size given, and writes the results as JSON.\n"
+           "\n"
+           "    -s, --max-size SIZE  largest input to encrypt, with an\n"
+           "                    optional K, M or G suffix. The sizes go\n"
+           "                    1K, 64K, 1M, 16M, 256M and 4G and the\n"
+           "                    default is 16M.\n"
+           "    -t, --time SECS minimum time to spend on each\n"
+           "                    measurement. The default is 0.5.\n"
+           "    -h, --help      display this help and exit.\n"
+           "    -v, --version   display version information and exit.\n",
+           invoc_name);
+}
@@ -1,16 +1,33 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <limits.h>
 #include <getopt.h>
 
+#include "cipher_io.h"
+#include "ciphers.h"
+#include "workers.h"
+#include "batch.h"
+
 static char *prog_name = "block";
 static char *prog_version = "1.0";
 static char *invoc_name = NULL;
 static char *author = "a-chap";
 
+static struct io_writer out;
+static struct io_ahead ahead;
+static int async_io = 0;
+static const char *out_dir = NULL;
+static int recursive = 0;
+static const struct block_ctx *batch_key = NULL;
+
 static struct option options[] = {
     { "block-size", required_argument, NULL, 'b'},
     { "newline", required_argument, NULL, 'n' },
+    { "jobs", required_argument, NULL, 'j'},
+    { "output", required_argument, NULL, 'o'},
+    { "recursive", no_argument, NULL, 'W'},
+    { "stats", no_argument, NULL, 'X'},
+    { "async-io", no_argument, NULL, 'A'},
     { "help", no_argument, NULL, 'h'},
     { "version", no_argument, NULL, 'v'},
     { NULL, 0, NULL, 0 }
@@ -19,16 +36,23 @@ static struct option options[] = {
 static void print_version();
 static void print_help();
 
-static void block_file(FILE *fp, int block_size, int nblocks);
+static void block_file(int fd, struct block_ctx *ctx);
+static void block_buffer(struct block_ctx *ctx, const unsigned char *buf,
+                         size_t len);
+static void block_batch(char **files, int nfiles, struct block_ctx *ctx,
+                        int jobs, int stats);
 
 int main(int argc, char **argv) {
+    struct block_ctx ctx;
     int block_size = 5;
     int nblock_line = 0;
+    int stats = 0;
+    int jobs = 0;
 
     invoc_name = argv[0];
 
     int c;
-    while ((c = getopt_long(argc, argv, "b:n:hv", options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "b:n:j:o:hv", options, NULL)) != -1) {
         switch(c) {
             case 'b':
                 block_size = atoi(optarg);
@@ -40,6 +64,28 @@ int main(int argc, char **argv) {
                 if ( nblock_line < 0 )
                     nblock_line = 0;
                 break;
+            case 'j':
+                jobs = atoi(optarg);
+                if ( jobs < 1 ) {
+                    fprintf(stderr, "%s: The number of jobs needs to be at "
+                                    "least 1.\n"
+                                    "Try '%s --help' for more information.\n"
+                                    , invoc_name, invoc_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'W':
+                recursive = 1;
+                break;
+            case 'X':
+                stats = 1;
+                break;
+            case 'A':
+                async_io = 1;
+                break;
             case 'h':
                 print_help();
                 exit(EXIT_SUCCESS);
@@ -55,48 +101,140 @@ int main(int argc, char **argv) {
         }
     }
 
+    block_init(&ctx, block_size, nblock_line);
+
+    if ( out_dir != NULL ) {
+        if ( optind == argc ) {
+            fprintf(stderr, "%s: -o needs FILEs.\n"
+                            "Try '%s --help' for more information.\n"
+                            , invoc_name, invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        block_batch(argv + optind, argc - optind, &ctx,
+                    jobs? jobs : sysconf(_SC_NPROCESSORS_ONLN), stats);
+    } else if ( recursive || jobs ) {
+        fprintf(stderr, "%s: --recursive and -j need -o.\n"
+                        "Try '%s --help' for more information.\n"
+                        , invoc_name, invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    if ( stats )
+        io_stats_start(IO_STATS_PRINTING);
+    io_writer_init(&out, STDOUT_FILENO, invoc_name);
+    io_read_flush(&out);
+    if ( async_io && ( io_writer_async(&out) || io_ahead_init(&ahead, IO_BUFSIZE) ) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
     if ( optind == argc ) {
-        block_file(stdin, block_size, nblock_line);
+        block_file(STDIN_FILENO, &ctx);
     } else {
         for (int i = optind; i < argc; i++) {
-            FILE *fp = fopen(argv[i], "r");
-            if ( fp == NULL ) {
+            int fd = io_open(argv[i], 0);
+            if ( fd == -1 ) {
                 fprintf(stderr, "%s: ", invoc_name);
                 perror(argv[i]);
                 continue;
             }
 
-            block_file(fp, block_size, nblock_line);
+            block_file(fd, &ctx);
 
-            fclose(fp);
+            close(fd);
         }
     }
 
+    io_flush(&out);
+    if ( stats )
+        io_stats_report(invoc_name);
+
     return 0;
 }
 
-static void block_file(FILE *fp, int block_size, int nblocks) {
-    static int char_pos = 0;
-    static int block_num = 0;
-    int c;
-    while ( ( c = fgetc(fp) ) != EOF ) {
-        if ( !isprint(c) || isspace(c) )
-            continue;
-        if ( char_pos && char_pos % block_size == 0 ) {
-            if ( nblocks )
-                block_num++;
-
-            if ( nblocks && block_num == nblocks ) {
-                printf("\n");
-                block_num = 0;
-            } else
-                printf(" ");
-
-            char_pos = 0;
-        }
-        printf("%c", c);
-        char_pos++;
+static void block_file(int fd, struct block_ctx *ctx) {
+    static unsigned char buf[IO_BUFSIZE];
+    unsigned char *data;
+    struct io_map map;
+    ssize_t n;
+
+    if ( async_io ) {
+        io_ahead_start(&ahead, fd, ULLONG_MAX);
+        while ( ( n = io_ahead_next(&ahead, &data) ) > 0 )
+            block_buffer(ctx, data, n);
+        io_ahead_stop(&ahead);
+
+        if ( n == -1 )
+            perror(invoc_name);
+        return;
+    }
+
+    /* Regular files are blocked straight from a mapping of them. */
+    if ( io_map(fd, 0, &map) == 0 ) {
+        block_buffer(ctx, map.data, map.len);
+        io_unmap(&map);
+        return;
+    }
+
+    while ( ( n = io_read(fd, buf, sizeof(buf)) ) > 0 )
+        block_buffer(ctx, buf, n);
+
+    if ( n == -1 )
+        perror(invoc_name);
+}
+
+/*
+ * Blocks buf straight into the output buffer, in pieces small
+ * enough that their output always fits in it.
+ */
+static void block_buffer(struct block_ctx *ctx, const unsigned char *buf,
+                         size_t len) {
+    const size_t piece = IO_BUFSIZE / 2;
+
+    if ( io_stats.enabled )
+        io_stats_count(buf, len);
+
+    for (size_t done = 0; done < len; done += piece) {
+        size_t n = len - done < piece? len - done : piece;
+        unsigned char *dest = io_reserve(&out, BLOCK_OUTPUT_MAX(n));
+        io_commit(&out, block_update(ctx, dest, buf + done, n));
+    }
+}
+
+/*
+ * With -o, each file is blocked on its own from the start of a line,
+ * and as the output isn't as long as the input, each file is one job.
+ */
+static int batch_start(void *state) {
+    *(struct block_ctx *) state = *batch_key;
+    return 0;
+}
+
+static size_t batch_update(void *state, unsigned char *out,
+                           const unsigned char *in, size_t len) {
+    return block_update(state, out, in, len);
+}
+
+static void block_batch(char **files, int nfiles, struct block_ctx *ctx,
+                        int jobs, int stats) {
+    static const struct batch_cipher cipher = {
+        sizeof(struct block_ctx), batch_start, batch_update, NULL, NULL,
+        2, 0, NULL, NULL,
+    };
+    struct workers *workers;
+
+    if ( ( workers = workers_start(jobs) ) == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
     }
+
+    batch_key = ctx;
+    if ( stats )
+        io_stats_start(IO_STATS_PRINTING);
+    int failures = batch_run(&cipher, files, nfiles, out_dir, recursive,
+                             workers, invoc_name);
+    if ( stats )
+        io_stats_report(invoc_name);
+    exit(failures > 0? EXIT_FAILURE : EXIT_SUCCESS);
 }
 
 static void print_version() {
@@ -115,6 +253,17 @@ static void print_help() {
            "\n"
            "    -b, --block-size SIZE   set the size of the blocks.\n"
            "    -n, --newline N         start a new line after every Nth block.\n"
+           "    -o, --output DIR  block each FILE on its own into a file of\n"
+           "                      the same name in DIR, all at once using\n"
+           "                      -j threads, by default one per processor.\n"
+           "        --recursive  with -o, block the files in any directories\n"
+           "                     given too, recreating them under DIR.\n"
+           "    -j, --jobs N    with -o, use N threads.\n"
+           "        --stats     report what was read, written and transformed\n"
+           "                    and how long it took to standard error.\n"
+           "        --async-io  read ahead and write behind in the background,\n"
+           "                    using io_uring where the kernel has it, so\n"
+           "                    reading, blocking and writing all overlap.\n"
            "    -h, --help      display this help and exit.\n"
            "    -v, --version   display version information and exit.\n",
            invoc_name);
@@ -0,0 +1,70 @@
+#include <string.h>
+
+#include "ciphers.h"
+
+/*
+ * Which bytes are kept: the printable characters other than space, as
+ * isprint() and isspace() give them in the C locale.
+ */
+static const unsigned char kept[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,
+};
+
+void block_init(struct block_ctx *ctx, int block_size, int nblocks) {
+    ctx->block_size = block_size > 0? block_size : 5;
+    ctx->nblocks = nblocks > 0? nblocks : 0;
+    ctx->char_pos = 0;
+    ctx->block_num = 0;
+}
+
+/*
+ * Done in two passes rather than a character at a time: the kept
+ * characters are first packed together, without branching, into the
+ * back half of out, then copied to the front a block at a time with
+ * the separator written between blocks. With at most one separator
+ * to each character the copies never catch up with what is still to
+ * be copied.
+ */
+size_t block_update(struct block_ctx *ctx, unsigned char *out,
+                    const unsigned char *in, size_t len) {
+    unsigned char *packed = out + len;
+    size_t block_size = ctx->block_size;
+    size_t char_pos = ctx->char_pos;
+    int block_num = ctx->block_num;
+    unsigned char *dest = out;
+    size_t n = 0;
+
+    for (size_t j = 0; j < len; j++) {
+        packed[n] = in[j];
+        n += kept[in[j]];
+    }
+
+    for (size_t done = 0; done < n; ) {
+        if ( char_pos == block_size ) {
+            if ( ctx->nblocks && ++block_num == ctx->nblocks ) {
+                *dest++ = '\n';
+                block_num = 0;
+            } else
+                *dest++ = ' ';
+            char_pos = 0;
+        }
+
+        size_t run = n - done < block_size - char_pos?
+            n - done : block_size - char_pos;
+        memmove(dest, packed + done, run);
+        dest += run;
+        done += run;
+        char_pos += run;
+    }
+
+    ctx->char_pos = char_pos;
+    ctx->block_num = block_num;
+    return dest - out;
+}
@@ -0,0 +1,551 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cipher_io.h"
+
+struct io_stats io_stats;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void io_stats_start(int counting) {
+    io_stats.enabled = 1;
+    io_stats.counting = counting;
+    io_stats.start = now();
+}
+
+void io_stats_count(const unsigned char *buf, size_t len) {
+    size_t n = 0;
+
+    switch ( io_stats.counting ) {
+        case IO_STATS_LETTERS:
+            for (size_t i = 0; i < len; i++)
+                n += isalpha(buf[i]) != 0;
+            break;
+        case IO_STATS_PRINTING:
+            for (size_t i = 0; i < len; i++)
+                n += isgraph(buf[i]) != 0;
+            break;
+        case IO_STATS_MEMBERS:
+            for (size_t i = 0; i < len; i++)
+                n += io_stats.member[buf[i]];
+            break;
+        default:
+            n = len;
+            break;
+    }
+
+    /* Batch mode counts from every worker at once. */
+    __atomic_fetch_add(&io_stats.transformed, n, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io_stats.others, len - n, __ATOMIC_RELAXED);
+}
+
+void io_stats_report(const char *name) {
+    static const char *transformed[] = {
+        "letters transformed", "bytes transformed", "characters kept",
+        "characters transformed",
+    };
+    double seconds = now() - io_stats.start;
+    double transforming = seconds - io_stats.read_seconds
+                                  - io_stats.write_seconds;
+
+    fprintf(stderr, "%s: %llu bytes read, %llu bytes written\n", name,
+            io_stats.bytes_read, io_stats.bytes_written);
+    fprintf(stderr, "%s: %llu %s, %llu other bytes\n", name,
+            io_stats.transformed, transformed[io_stats.counting],
+            io_stats.others);
+    fprintf(stderr, "%s: %.4fs: %.4fs reading, %.4fs transforming, "
+                    "%.4fs writing\n", name, seconds, io_stats.read_seconds,
+            transforming > 0? transforming : 0, io_stats.write_seconds);
+    fprintf(stderr, "%s: %.1f MB/s\n", name,
+            seconds > 0? io_stats.bytes_read / seconds / 1e6 : 0);
+    if ( strcmp(io_async_backend(), "none") != 0 )
+        fprintf(stderr, "%s: reading and writing in the background with %s\n",
+                name, io_async_backend());
+}
+
+int io_open(const char *path, int writable) {
+    int fd;
+    do {
+        fd = open(path, writable? O_RDWR : O_RDONLY);
+    } while ( fd == -1 && errno == EINTR );
+    return fd;
+}
+
+static struct io_writer *read_flush = NULL;
+
+/*
+ * Has io_read() flush w before it waits on a terminal, pipe or
+ * socket, as io_records does, so what came of the last of its input
+ * is written out before more is asked for.
+ */
+void io_read_flush(struct io_writer *w) {
+    read_flush = w;
+}
+
+/*
+ * Reads up to len bytes. Regular files are read until len or their
+ * end so the ciphers get to work on full chunks, but a terminal, pipe
+ * or socket returns what its first read gave, so that each line typed
+ * or passed along comes out without waiting for the ones after it.
+ * Returns -1 on error with errno set.
+ */
+ssize_t io_read(int fd, void *buf, size_t len) {
+    struct stat st;
+    int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if ( !regular && read_flush != NULL )
+        io_flush(read_flush);
+
+    double start = io_stats.enabled? now() : 0;
+    size_t total = 0;
+    while ( total < len ) {
+        ssize_t n = read(fd, (char *) buf + total, len - total);
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            io_stats.bytes_read += total;
+            return total? (ssize_t) total : -1;
+        }
+        if ( n == 0 )
+            break;
+        total += n;
+        if ( !regular )
+            break;
+    }
+    io_stats.bytes_read += total;
+    if ( io_stats.enabled )
+        io_stats.read_seconds += now() - start;
+    return total;
+}
+
+/*
+ * Moves len bytes on in fd, seeking if it can and reading past them
+ * if not, stopping early at the end. Returns -1 with errno set on
+ * error.
+ */
+int io_skip(int fd, unsigned long long len) {
+    static unsigned char discard[IO_BUFSIZE];
+
+    if ( lseek(fd, len, SEEK_CUR) != -1 )
+        return 0;
+
+    while ( len > 0 ) {
+        ssize_t n = io_read(fd, discard, len < sizeof(discard)?
+                                             len : sizeof(discard));
+        if ( n <= 0 )
+            return n;
+        len -= n;
+    }
+    return 0;
+}
+
+int io_ahead_init(struct io_ahead *ra, size_t size) {
+    if ( io_async_start() == -1 )
+        return -1;
+
+    ra->size = size;
+    for (int i = 0; i < IO_AHEAD_BUFFERS; i++) {
+        if ( ( ra->bufs[i] = malloc(size) ) == NULL )
+            return -1;
+        ra->ops[i].state = IO_OP_IDLE;
+    }
+    return 0;
+}
+
+/* Starts the read for the ith buffer, if there is anything left. */
+static void ahead_submit(struct io_ahead *ra, int i) {
+    struct io_op *op = &ra->ops[i];
+    size_t len = ra->left < ra->size? ra->left : ra->size;
+
+    if ( len == 0 ) {
+        op->state = IO_OP_IDLE;
+        return;
+    }
+
+    op->fd = ra->fd;
+    op->write = 0;
+    op->buf = ra->bufs[i];
+    op->len = len;
+    op->offset = ra->offset;
+    if ( ra->offset != -1 )
+        ra->offset += len;
+    ra->left -= len;
+    io_async_submit(op);
+}
+
+/*
+ * Regular files are read from their offsets, so all the reads can go
+ * on at once, anything else a read after another from the position.
+ */
+void io_ahead_start(struct io_ahead *ra, int fd, unsigned long long limit) {
+    struct stat st;
+
+    ra->fd = fd;
+    ra->left = limit;
+    ra->offset = -1;
+    if ( fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ) {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        if ( offset != -1 )
+            ra->offset = offset;
+    }
+    ra->next = 0;
+    ra->held = -1;
+
+    for (int i = 0; i < IO_AHEAD_BUFFERS; i++)
+        ahead_submit(ra, i);
+}
+
+ssize_t io_ahead_next(struct io_ahead *ra, unsigned char **data) {
+    /* The buffer handed out last time is free to read into again. */
+    if ( ra->held != -1 )
+        ahead_submit(ra, ra->held);
+    ra->held = -1;
+
+    struct io_op *op = &ra->ops[ra->next];
+    if ( op->state == IO_OP_IDLE )
+        return 0;
+
+    double start = io_stats.enabled? now() : 0;
+    io_async_wait(op);
+    if ( io_stats.enabled )
+        io_stats.read_seconds += now() - start;
+
+    op->state = IO_OP_IDLE;
+    if ( op->error ) {
+        ra->left = 0;
+        errno = op->error;
+        return -1;
+    }
+    if ( op->done < op->len )
+        ra->left = 0;
+
+    io_stats.bytes_read += op->done;
+    *data = ra->bufs[ra->next];
+    ra->held = ra->next;
+    ra->next = (ra->next + 1) % IO_AHEAD_BUFFERS;
+    return op->done;
+}
+
+void io_ahead_stop(struct io_ahead *ra) {
+    for (int i = 0; i < IO_AHEAD_BUFFERS; i++) {
+        if ( ra->ops[i].state != IO_OP_IDLE )
+            io_async_wait(&ra->ops[i]);
+        ra->ops[i].state = IO_OP_IDLE;
+    }
+}
+
+/*
+ * Maps the rest of fd from its current offset, writable and shared
+ * with the file if asked, so changes go straight back into it.
+ * Returns -1 with errno set if fd can't be mapped, in which case
+ * it should be read instead, as it will be for pipes and terminals.
+ */
+int io_map(int fd, int writable, struct io_map *map) {
+    struct stat st;
+    off_t offset;
+
+    if ( fstat(fd, &st) == -1 )
+        return -1;
+    if ( !S_ISREG(st.st_mode) ) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ( ( offset = lseek(fd, 0, SEEK_CUR) ) == -1 )
+        return -1;
+
+    map->data = NULL;
+    map->base = NULL;
+    map->len = map->map_len = 0;
+    if ( offset >= st.st_size )
+        return 0;
+
+    /* Mappings have to start on a page boundary. */
+    off_t start = offset - offset % sysconf(_SC_PAGESIZE);
+
+    map->map_len = st.st_size - start;
+    map->base = mmap(NULL, map->map_len,
+                     PROT_READ | (writable? PROT_WRITE : 0),
+                     writable? MAP_SHARED : MAP_PRIVATE, fd, start);
+    if ( map->base == MAP_FAILED )
+        return -1;
+
+    posix_madvise(map->base, map->map_len, POSIX_MADV_SEQUENTIAL);
+
+    map->data = (unsigned char *) map->base + (offset - start);
+    map->len = st.st_size - offset;
+    __atomic_fetch_add(&io_stats.bytes_read, map->len, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void io_unmap(struct io_map *map) {
+    if ( map->base != NULL )
+        munmap(map->base, map->map_len);
+    map->base = NULL;
+}
+
+/* "nul" or "length", or -1 for anything else. */
+int io_records_framing(const char *name) {
+    if ( strcmp(name, "nul") == 0 )
+        return IO_RECORDS_NUL;
+    if ( strcmp(name, "length") == 0 )
+        return IO_RECORDS_LENGTH;
+    return -1;
+}
+
+void io_records_init(struct io_records *r, int fd, int framing,
+                     struct io_writer *flush) {
+    r->fd = fd;
+    r->framing = framing;
+    r->flush = flush;
+    r->buf = NULL;
+    r->size = r->start = r->end = 0;
+    r->eof = 0;
+}
+
+void io_records_free(struct io_records *r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+/*
+ * Reads whatever is there, at least one byte unless at the end,
+ * after moving what is left to the front of the buffer and making
+ * sure there is room for at least want bytes. Returns -1 with errno
+ * set on error.
+ */
+static int fill_records(struct io_records *r, size_t want) {
+    size_t left = r->end - r->start;
+
+    memmove(r->buf, r->buf + r->start, left);
+    r->start = 0;
+    r->end = left;
+
+    if ( want < left + IO_BUFSIZE )
+        want = left + IO_BUFSIZE;
+    if ( want > r->size ) {
+        unsigned char *buf = realloc(r->buf, want);
+        if ( buf == NULL )
+            return -1;
+        r->buf = buf;
+        r->size = want;
+    }
+
+    if ( r->flush != NULL )
+        io_flush(r->flush);
+
+    double start = io_stats.enabled? now() : 0;
+    ssize_t n;
+    do {
+        n = read(r->fd, r->buf + r->end, r->size - r->end);
+    } while ( n == -1 && errno == EINTR );
+    if ( n == -1 )
+        return -1;
+    if ( n == 0 )
+        r->eof = 1;
+
+    r->end += n;
+    io_stats.bytes_read += n;
+    if ( io_stats.enabled )
+        io_stats.read_seconds += now() - start;
+    return 0;
+}
+
+/*
+ * Sets data and len to the next record, without its NUL or length.
+ * Returns 1 for a record, 0 at the end of the input and -1 on error
+ * with errno set, EINVAL for a record cut short by the end. A last
+ * record without its NUL still counts.
+ */
+int io_record_next(struct io_records *r, const unsigned char **data,
+                   size_t *len) {
+    for (size_t want = 0; ; ) {
+        size_t left = r->end - r->start;
+        unsigned char *p = r->buf + r->start;
+
+        if ( r->framing == IO_RECORDS_NUL ) {
+            unsigned char *nul = left? memchr(p, '\0', left) : NULL;
+            if ( nul != NULL ) {
+                *data = p;
+                *len = nul - p;
+                r->start += *len + 1;
+                return 1;
+            }
+            if ( r->eof ) {
+                *data = p;
+                *len = left;
+                r->start = r->end;
+                return left > 0;
+            }
+        } else {
+            if ( left >= 4 ) {
+                size_t n = (size_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+                if ( left - 4 >= n ) {
+                    *data = p + 4;
+                    *len = n;
+                    r->start += 4 + n;
+                    return 1;
+                }
+                want = 4 + n;
+            }
+            if ( r->eof ) {
+                if ( left == 0 )
+                    return 0;
+                errno = EINVAL;
+                return -1;
+            }
+        }
+
+        if ( fill_records(r, want) == -1 )
+            return -1;
+    }
+}
+
+void io_write_record(struct io_writer *w, int framing, const void *data,
+                     size_t len) {
+    if ( framing == IO_RECORDS_LENGTH ) {
+        unsigned char prefix[4] = {
+            len >> 24 & 0xff, len >> 16 & 0xff, len >> 8 & 0xff, len & 0xff,
+        };
+        io_write(w, prefix, sizeof(prefix));
+        io_write(w, data, len);
+    } else {
+        io_write(w, data, len);
+        io_putc(w, '\0');
+    }
+}
+
+static void write_all(struct io_writer *w, const unsigned char *data, size_t len) {
+    double start = io_stats.enabled? now() : 0;
+
+    io_stats.bytes_written += len;
+    while ( len > 0 ) {
+        ssize_t n = write(w->fd, data, len);
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            perror(w->name);
+            exit(EXIT_FAILURE);
+        }
+        data += n;
+        len -= n;
+    }
+    if ( io_stats.enabled )
+        io_stats.write_seconds += now() - start;
+}
+
+void io_writer_init(struct io_writer *w, int fd, const char *name) {
+    w->fd = fd;
+    w->name = name;
+    w->len = 0;
+    w->buf = w->local;
+    w->async = 0;
+}
+
+int io_writer_async(struct io_writer *w) {
+    if ( io_async_start() == -1 )
+        return -1;
+
+    w->bufs[0] = w->local;
+    for (int i = 1; i < IO_WRITE_BUFFERS; i++)
+        if ( ( w->bufs[i] = malloc(IO_BUFSIZE) ) == NULL )
+            return -1;
+    for (int i = 0; i < IO_WRITE_BUFFERS; i++)
+        w->ops[i].state = IO_OP_IDLE;
+
+    w->async = 1;
+    w->current = 0;
+    w->buf = w->bufs[0];
+    return 0;
+}
+
+/* Waits for the write of a buffer to finish so it can be reused. */
+static void wait_write(struct io_writer *w, struct io_op *op) {
+    if ( op->state == IO_OP_IDLE )
+        return;
+
+    double start = io_stats.enabled? now() : 0;
+    io_async_wait(op);
+    if ( io_stats.enabled )
+        io_stats.write_seconds += now() - start;
+
+    op->state = IO_OP_IDLE;
+    if ( op->error ) {
+        errno = op->error;
+        perror(w->name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Writes out the buffer, or starts it being written, once it's full. */
+void io_pass_on(struct io_writer *w) {
+    if ( !w->async ) {
+        write_all(w, w->buf, w->len);
+        w->len = 0;
+        return;
+    }
+    if ( w->len == 0 )
+        return;
+
+    struct io_op *op = &w->ops[w->current];
+    op->fd = w->fd;
+    op->write = 1;
+    op->buf = w->buf;
+    op->len = w->len;
+    op->offset = -1;
+    io_stats.bytes_written += w->len;
+    io_async_submit(op);
+
+    w->current = (w->current + 1) % IO_WRITE_BUFFERS;
+    wait_write(w, &w->ops[w->current]);
+    w->buf = w->bufs[w->current];
+    w->len = 0;
+}
+
+/* Writes out everything so far, waiting for any in the background. */
+void io_flush(struct io_writer *w) {
+    io_pass_on(w);
+    if ( w->async )
+        for (int i = 0; i < IO_WRITE_BUFFERS; i++)
+            wait_write(w, &w->ops[i]);
+}
+
+void io_write(struct io_writer *w, const void *data, size_t len) {
+    /* The caller can reuse data at once, so it goes through the buffers. */
+    if ( w->async ) {
+        while ( len > 0 ) {
+            if ( w->len == IO_BUFSIZE )
+                io_pass_on(w);
+            size_t n = IO_BUFSIZE - w->len < len? IO_BUFSIZE - w->len : len;
+            memcpy(w->buf + w->len, data, n);
+            w->len += n;
+            data = (const unsigned char *) data + n;
+            len -= n;
+        }
+        return;
+    }
+
+
+    /* Big writes skip the buffer rather than being copied through it. */
+    if ( w->len + len > IO_BUFSIZE ) {
+        io_pass_on(w);
+        if ( len >= IO_BUFSIZE ) {
+            write_all(w, data, len);
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
@@ -0,0 +1,174 @@
+#ifndef CIPHER_IO_H
+#define CIPHER_IO_H
+
+#include <stddef.h>
+#include <unistd.h>
+
+#include "io_async.h"
+
+/*
+ * Size of the chunks the ciphers read and write at a time.
+ * Moving large chunks through read() and write() avoids paying
+ * for a stdio call on every single character.
+ */
+#define IO_BUFSIZE (1 << 17)
+
+/*
+ * With io_writer_async() a full buffer is passed on to be written in
+ * the background and the next of IO_WRITE_BUFFERS taken in its place,
+ * otherwise buf is always local and written straight away.
+ */
+#define IO_WRITE_BUFFERS 4
+
+struct io_writer {
+    int fd;
+    const char *name;   /* used to prefix error messages */
+    size_t len;
+    unsigned char *buf;
+    int async;
+    int current;
+    struct io_op ops[IO_WRITE_BUFFERS];
+    unsigned char *bufs[IO_WRITE_BUFFERS];
+    unsigned char local[IO_BUFSIZE];
+};
+
+/*
+ * A regular file mapped into memory so the ciphers can work on it
+ * where it is rather than read() copying it into a buffer first.
+ */
+struct io_map {
+    unsigned char *data;
+    size_t len;
+    void *base;
+    size_t map_len;
+};
+
+/*
+ * Reading ahead for --async-io: with the reads for the next
+ * IO_AHEAD_BUFFERS buffers of size bytes in flight in the background,
+ * io_ahead_next() waits for the first and hands it out to be worked
+ * on, in place if need be, until the next call. It returns 0 at the
+ * end of the file or once limit bytes have been read and -1 with
+ * errno set on error. io_ahead_stop() waits for any reads still going
+ * before the fd is closed or another started.
+ */
+#define IO_AHEAD_BUFFERS 4
+
+struct io_ahead {
+    int fd;
+    size_t size;
+    unsigned long long left;
+    long long offset;
+    int next;
+    int held;
+    struct io_op ops[IO_AHEAD_BUFFERS];
+    unsigned char *bufs[IO_AHEAD_BUFFERS];
+};
+
+/*
+ * What --stats reports. The reads and writes are counted and timed
+ * here, which once enabled is a clock reading either side of each
+ * chunk and otherwise a single addition, and whatever time is left
+ * is taken as transforming. The tools count what they transform with
+ * io_stats_count(), and only when enabled as that is a pass over the
+ * input of its own.
+ */
+enum {
+    IO_STATS_LETTERS,   /* letters are transformed */
+    IO_STATS_BYTES,     /* every byte is transformed */
+    IO_STATS_PRINTING,  /* printing characters other than space are */
+    IO_STATS_MEMBERS,   /* the bytes marked in member are */
+};
+
+struct io_stats {
+    int enabled;
+    int counting;
+    const unsigned char *member;
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    unsigned long long transformed;
+    unsigned long long others;
+    double start;
+    double read_seconds;
+    double write_seconds;
+};
+
+extern struct io_stats io_stats;
+
+void io_stats_start(int counting);
+void io_stats_count(const unsigned char *buf, size_t len);
+void io_stats_report(const char *name);
+
+int io_open(const char *path, int writable);
+ssize_t io_read(int fd, void *buf, size_t len);
+void io_read_flush(struct io_writer *w);
+int io_skip(int fd, unsigned long long len);
+
+int io_ahead_init(struct io_ahead *ra, size_t size);
+void io_ahead_start(struct io_ahead *ra, int fd, unsigned long long limit);
+ssize_t io_ahead_next(struct io_ahead *ra, unsigned char **data);
+void io_ahead_stop(struct io_ahead *ra);
+
+int io_map(int fd, int writable, struct io_map *map);
+void io_unmap(struct io_map *map);
+
+/*
+ * Records for batch mode, many short messages one after another in
+ * the same stream: each ended by a NUL or preceded by its length as
+ * four bytes, most significant first. The reader hands out each
+ * record where it is in its buffer, which grows to fit the longest.
+ * Before waiting on more input it flushes the writer it is given,
+ * if any, so a program feeding in records gets the results of those
+ * already sent back without having to close its end first.
+ */
+enum { IO_RECORDS_NUL, IO_RECORDS_LENGTH, };
+
+struct io_records {
+    int fd;
+    int framing;
+    struct io_writer *flush;
+    unsigned char *buf;
+    size_t size;
+    size_t start;
+    size_t end;
+    int eof;
+};
+
+int io_records_framing(const char *name);
+void io_records_init(struct io_records *r, int fd, int framing,
+                     struct io_writer *flush);
+int io_record_next(struct io_records *r, const unsigned char **data,
+                   size_t *len);
+void io_records_free(struct io_records *r);
+
+void io_writer_init(struct io_writer *w, int fd, const char *name);
+int io_writer_async(struct io_writer *w);
+void io_write(struct io_writer *w, const void *data, size_t len);
+void io_pass_on(struct io_writer *w);
+void io_flush(struct io_writer *w);
+
+void io_write_record(struct io_writer *w, int framing, const void *data,
+                     size_t len);
+
+static inline void io_putc(struct io_writer *w, int c) {
+    if ( w->len == IO_BUFSIZE )
+        io_pass_on(w);
+    w->buf[w->len++] = c;
+}
+
+/*
+ * Returns room for len more bytes, at most IO_BUFSIZE, at the end of
+ * the buffer for a cipher to write straight into, then io_commit()
+ * adds however many it did write.
+ */
+static inline unsigned char *io_reserve(struct io_writer *w, size_t len) {
+    if ( w->len + len > IO_BUFSIZE )
+        io_pass_on(w);
+    return w->buf + w->len;
+}
+
+static inline void io_commit(struct io_writer *w, size_t len) {
+    w->len += len;
+}
+
+#endif
@@ -0,0 +1,267 @@
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include "ciphers.h"
+
+/*
+ * The 25 letters of the grid in order, twice over so a letter's
+ * place plus a rotation of up to 24 can be looked up directly,
+ * and each letter's place in them, with J sharing I's.
+ */
+static const char grid_letters[] = "ABCDEFGHIKLMNOPQRSTUVWXYZ"
+                                   "ABCDEFGHIKLMNOPQRSTUVWXYZ";
+static const unsigned char letter_place[26] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  8,  9, 10, 11,
+    12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+};
+
+static void fill_in_playfair_grid(struct playfair_ctx *ctx, const char *keyword);
+static void set_grid_letter(struct playfair_ctx *ctx, int row, int column,
+                            int letter);
+static void progress_grid(struct playfair_ctx *ctx);
+static void encrypt_letters(const struct playfair_ctx *ctx, char *letter_pair);
+static void build_digraph_table(struct playfair_ctx *ctx);
+static void encrypt_pair(const struct playfair_ctx *ctx, char *letter_pair);
+
+int playfair_valid_keyword(const char *keyword) {
+    if ( keyword == NULL || strlen(keyword) == 0 )
+        return 0;
+
+    for (int i = 0; i < strlen(keyword); i++)
+        if ( !isalpha((unsigned char) keyword[i]) )
+            return 0;
+
+    return 1;
+}
+
+int playfair_init(struct playfair_ctx *ctx, const char *keyword, int options) {
+    if ( !playfair_valid_keyword(keyword) )
+        return -1;
+
+    ctx->progress_keyword = options & PLAYFAIR_PROGRESS;
+    ctx->decrypt = options & PLAYFAIR_DECRYPT;
+    ctx->grid_rotation = 0;
+    ctx->letter_pair[0] = ctx->letter_pair[1] = 0;
+    ctx->pair_letters = 0;
+    ctx->padding = 0;
+    ctx->progressions = 0;
+
+    fill_in_playfair_grid(ctx, keyword);
+
+    return 0;
+}
+
+void playfair_reset(struct playfair_ctx *ctx) {
+    ctx->grid_rotation = 0;
+    ctx->pair_letters = 0;
+}
+
+int playfair_grid_letter(const struct playfair_ctx *ctx, int row, int column) {
+    return grid_letters[letter_place[ctx->grid[row][column] - 'A']
+                        + ctx->grid_rotation];
+}
+
+/*
+ * Progressing the grid moves every letter on to the next one, so
+ * rather than rewriting the grid it is kept as the keyword laid it
+ * out and grid_rotation counts how far its letters have moved on.
+ */
+static void progress_grid(struct playfair_ctx *ctx) {
+    ctx->progressions++;
+    if ( ++ctx->grid_rotation == 25 )
+        ctx->grid_rotation = 0;
+}
+
+static void set_grid_letter(struct playfair_ctx *ctx, int row, int column,
+                            int letter) {
+    ctx->grid[row][column] = letter;
+    ctx->letter_row[letter - 'A'] = row;
+    ctx->letter_column[letter - 'A'] = column;
+}
+
+static void fill_in_playfair_grid(struct playfair_ctx *ctx, const char *keyword) {
+    /* nth bit will be the nth letter of the alphabet */
+    int32_t used_letters = 0;
+    int n_spaces_filled = 0;
+
+    for (int i = 0; i < strlen(keyword); i++) {
+        int letter = toupper((unsigned char) keyword[i]);
+
+        /*
+         * There are only 25 spaces in the Playfair
+         * Grid but 26 letters of the alphabet so
+         * one of the spaces has to be used twice.
+         * Thus I doubles up as J.
+         */
+        if (letter == 'J')
+            letter = 'I';
+
+        /* if letter is already in grid skip */
+        if ( used_letters & ( 1 << (letter - 'A') ) )
+            continue;
+        else
+            used_letters |= ( 1 << (letter - 'A') );
+
+        set_grid_letter(ctx, n_spaces_filled / 5, n_spaces_filled % 5, letter);
+
+        n_spaces_filled++;
+    }
+
+    /* Fill in any remaining spaces of the grid. */
+    for (int i = 0; i < 26; i++) {
+        if ( n_spaces_filled == 25 )
+            break;
+        if ( i == 'J' - 'A' ) /* Skip J because I has its place */
+            continue;
+        if ( used_letters & (1 << i) )
+            continue;
+
+        set_grid_letter(ctx, n_spaces_filled / 5, n_spaces_filled % 5, i + 'A');
+        n_spaces_filled++;
+    }
+
+    build_digraph_table(ctx);
+
+    return;
+}
+
+/*
+ * digraph_table holds the encryption (or decryption) of every pair
+ * of places in the unrotated grid. Encrypting a pair in a rotated
+ * grid is then encrypting the pair moved back by the rotation and
+ * moving the result forward again.
+ */
+static void build_digraph_table(struct playfair_ctx *ctx) {
+    char letter_pair[2];
+    for (int i = 0; i < 25; i++) {
+        for (int j = 0; j < 25; j++) {
+            letter_pair[0] = grid_letters[i];
+            letter_pair[1] = grid_letters[j];
+            encrypt_letters(ctx, letter_pair);
+            ctx->digraph_table[i * 25 + j][0] = letter_place[letter_pair[0] - 'A'];
+            ctx->digraph_table[i * 25 + j][1] = letter_place[letter_pair[1] - 'A'];
+        }
+    }
+}
+
+static void encrypt_pair(const struct playfair_ctx *ctx, char *letter_pair) {
+    int rotation = ctx->grid_rotation;
+    int first = letter_place[letter_pair[0] - 'A'] + 25 - rotation;
+    int second = letter_place[letter_pair[1] - 'A'] + 25 - rotation;
+    const unsigned char *digraph = ctx->digraph_table[(first % 25) * 25
+                                                      + second % 25];
+
+    letter_pair[0] = grid_letters[digraph[0] + rotation];
+    letter_pair[1] = grid_letters[digraph[1] + rotation];
+}
+
+static void encrypt_letters(const struct playfair_ctx *ctx, char *letter_pair) {
+    int row_1 = ctx->letter_row[letter_pair[0] - 'A'],
+        column_1 = ctx->letter_column[letter_pair[0] - 'A'],
+        row_2 = ctx->letter_row[letter_pair[1] - 'A'],
+        column_2 = ctx->letter_column[letter_pair[1] - 'A'];
+    int step = ctx->decrypt? 4 : 1;
+
+    if ( row_1 == row_2 ) {
+        /* Rule 3 --- shift to the right in the grid */
+        letter_pair[0] = ctx->grid[row_1][(column_1 + step) % 5];
+        letter_pair[1] = ctx->grid[row_2][(column_2 + step) % 5];
+    } else if ( column_1 == column_2 ) {
+        /* Rule 4 --- shift downwards in the grid */
+        letter_pair[0] = ctx->grid[(row_1 + step) % 5][column_1];
+        letter_pair[1] = ctx->grid[(row_2 + step) % 5][column_2];
+    } else {
+        /*
+         * Rule 5 --- swap to different corners of the rectangle
+         * that the letters are in
+         */
+        letter_pair[0] = ctx->grid[row_1][column_2];
+        letter_pair[1] = ctx->grid[row_2][column_1];
+    }
+
+    return;
+}
+
+/*
+ * Encrypts the letters of in a pair at a time, carrying a half
+ * finished pair over to the next call in the context.
+ */
+size_t playfair_update(struct playfair_ctx *ctx, unsigned char *out,
+                       const unsigned char *in, size_t len) {
+    char *letter_pair = ctx->letter_pair;
+    int i = ctx->pair_letters;
+    size_t n = 0;
+
+    for (size_t j = 0; j < len; j++) {
+        int c = in[j];
+        if ( !isalpha(c) )
+            continue;
+        if ( c == 'j' || c == 'J' )
+            c = 'I';
+
+        letter_pair[i++] = toupper(c);
+
+        if ( i < 2 )
+            continue;
+
+        /*
+         * Rule 2 for Playfair --- duplicate
+         * letters have a low frequency letter
+         * put between them.
+         */
+        int double_letter = 0;
+        if ( letter_pair[0] == letter_pair[1] ) {
+            if ( letter_pair[0] != 'X' )
+                letter_pair[1] = 'X';
+            else
+                letter_pair[1] = 'Q';
+            double_letter = letter_pair[0];
+            ctx->padding++;
+        }
+
+        encrypt_pair(ctx, letter_pair);
+
+        if ( ctx->progress_keyword )
+            progress_grid(ctx);
+
+        out[n++] = letter_pair[0];
+        out[n++] = letter_pair[1];
+
+        /*
+         * Resetting the letter pair because the one
+         * just handled was two of the same letter
+         * see Rule 2.
+         */
+        if ( double_letter ) {
+            i = 1;
+            letter_pair[0] = double_letter;
+            double_letter = 0;
+        } else {
+            i = 0;
+        }
+    }
+
+    ctx->pair_letters = i;
+    return n;
+}
+
+size_t playfair_final(struct playfair_ctx *ctx, unsigned char *out) {
+    char *letter_pair = ctx->letter_pair;
+
+    /*
+     * If there is an odd number of letters in the plain text
+     * add an extra one and encrypt
+     */
+    if ( ctx->pair_letters == 0 )
+        return 0;
+
+    letter_pair[1] = (letter_pair[0] != 'X')? 'X' : 'Q';
+    ctx->padding++;
+    encrypt_pair(ctx, letter_pair);
+    ctx->pair_letters = 0;
+
+    out[0] = letter_pair[0];
+    out[1] = letter_pair[1];
+    return 2;
+}
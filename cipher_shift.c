@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ciphers.h"
+
+int shift_init(struct shift_ctx *ctx, const int *keyword, int multiplier,
+               int options) {
+    return shift_init_alphabet(ctx, NULL, keyword, multiplier, options);
+}
+
+int shift_init_alphabet(struct shift_ctx *ctx,
+                        const struct shift_alphabet *alphabet,
+                        const int *keyword, int multiplier, int options) {
+    int length = 0;
+    while ( keyword[length] != -1 )
+        length++;
+
+    /* The keyword as given goes after it, for shift_reset(). */
+    ctx->keyword = malloc(2 * (length + 1) * sizeof(int));
+    if ( ctx->keyword == NULL )
+        return -1;
+    ctx->initial = ctx->keyword + length + 1;
+    ctx->length = length;
+    memcpy(ctx->initial, keyword, (length + 1) * sizeof(int));
+    shift_reset(ctx);
+
+    shift_key_init(&ctx->key, alphabet, multiplier, options);
+    return 0;
+}
+
+int shift_update(struct shift_ctx *ctx, unsigned char *out,
+                 const unsigned char *in, size_t len) {
+    return shift_apply(&ctx->key, ctx->keyword, &ctx->index, out, in, len);
+}
+
+void shift_reset(struct shift_ctx *ctx) {
+    memcpy(ctx->keyword, ctx->initial, (ctx->length + 1) * sizeof(int));
+    ctx->index = 0;
+}
+
+int shift_copy(struct shift_ctx *ctx, const struct shift_ctx *from) {
+    ctx->keyword = malloc(2 * (from->length + 1) * sizeof(int));
+    if ( ctx->keyword == NULL )
+        return -1;
+    ctx->initial = ctx->keyword + from->length + 1;
+    ctx->length = from->length;
+    memcpy(ctx->initial, from->initial, (from->length + 1) * sizeof(int));
+    shift_reset(ctx);
+
+    shift_key_copy(&ctx->key, &from->key);
+    return 0;
+}
+
+void shift_skip(struct shift_ctx *ctx, unsigned long long nletters) {
+    shift_advance(&ctx->key, ctx->keyword, &ctx->index, nletters);
+}
+
+void shift_free(struct shift_ctx *ctx) {
+    free(ctx->keyword);
+    ctx->keyword = NULL;
+}
+
+void shift_options_init(struct shift_options *o,
+                        const struct shift_alphabet *alphabet) {
+    o->alphabet = alphabet;
+    o->keyword = NULL;
+    o->multiplier = 1;
+    o->multiplier_given = 0;
+    o->options = SHIFT_NONE;
+    o->error[0] = '\0';
+}
+
+static int option_error(struct shift_options *o, const char *message) {
+    snprintf(o->error, sizeof(o->error), "%s", message);
+    return -1;
+}
+
+/* Replaces the keyword with one of length shifts, left to be filled in. */
+static int new_keyword(struct shift_options *o, int length) {
+    free(o->keyword);
+    if ( ( o->keyword = calloc(length + 1, sizeof(int)) ) == NULL )
+        return option_error(o, strerror(errno));
+    o->keyword[length] = -1;
+    return 0;
+}
+
+static int in_alphabet(const struct shift_alphabet *alphabet,
+                       const char *word) {
+    if ( word == NULL || *word == '\0' )
+        return 0;
+
+    for (; *word; word++)
+        if ( alphabet->place[(unsigned char) *word] == -1 )
+            return 0;
+
+    return 1;
+}
+
+int shift_option(struct shift_options *o, int option, const char *value) {
+    int size = o->alphabet->size;
+    int shift;
+
+    switch ( option ) {
+        case 'm':
+            o->multiplier = atoi(value);
+            o->multiplier_given = 1;
+            if ( o->multiplier >= 2 && o->multiplier < size
+              && shift_inverse(o->multiplier, size) != -1 )
+                return 0;
+            if ( o->alphabet->letters )
+                return option_error(o, "Multiplier needs to be an odd number "
+                                       "between 3 and 25 inclusive (except "
+                                       "13).");
+            if ( size == 2 )
+                return option_error(o, "There is no multiplier other than 1 "
+                                       "for this alphabet.");
+            snprintf(o->error, sizeof(o->error), "Multiplier needs to be "
+                     "between 2 and %d inclusive and have no factor in "
+                     "common with %d.", size - 1, size);
+            return -1;
+        case 'p':
+            o->options |= SHIFT_PROGRESS;
+            return 0;
+        case 'd':
+            o->options |= SHIFT_DECRYPT;
+            return 0;
+    }
+
+    /* The fixed shifts replace any keyword, the others only come once. */
+    if ( o->keyword != NULL && ( option == 's' || option == 'k'
+                              || option == 'a' || option == 'z' ) )
+        return option_error(o, option == 's'? "Only one keyword or shift "
+                                              "needed."
+                                             : "Only one keyword needed.");
+
+    switch ( option ) {
+        case 's': case 'c': case 'r':
+            /* Fixed shifts wrap round a smaller alphabet like any other. */
+            shift = option == 's'? atoi(value) : (option == 'c'? 3 : 13) % size;
+            if ( shift <= 0 || shift >= size ) {
+                snprintf(o->error, sizeof(o->error), "The shift needs to be "
+                         "a number between 1 and %d inclusive.", size - 1);
+                return -1;
+            }
+            if ( new_keyword(o, 1) )
+                return -1;
+            o->keyword[0] = shift;
+            return 0;
+        case 'b':
+            o->multiplier = size - 1;
+            o->multiplier_given = 1;
+            if ( new_keyword(o, 1) )
+                return -1;
+            o->keyword[0] = size - 1;
+            return 0;
+        case 'a': case 'z':
+            if ( new_keyword(o, size) )
+                return -1;
+            for (int i = 0; i < size; i++)
+                o->keyword[i] = option == 'a'? i : size - 1 - i;
+            return 0;
+        case 'k':
+            if ( !in_alphabet(o->alphabet, value) )
+                return option_error(o, o->alphabet->letters?
+                                       "Keyword must only contain letters."
+                                     : "Keyword must only contain characters "
+                                       "of the alphabet.");
+            if ( new_keyword(o, strlen(value)) )
+                return -1;
+            for (int i = 0; value[i]; i++)
+                o->keyword[i] = o->alphabet->place[(unsigned char) value[i]];
+            return 0;
+    }
+
+    return option_error(o, "Unknown option.");
+}
+
+int shift_options_init_ctx(struct shift_options *o, struct shift_ctx *ctx) {
+    int identity[2] = { 0, -1 };
+    return shift_init_alphabet(ctx, o->alphabet,
+                               o->keyword != NULL? o->keyword : identity,
+                               o->multiplier, o->options);
+}
+
+void shift_options_free(struct shift_options *o) {
+    free(o->keyword);
+    o->keyword = NULL;
+}
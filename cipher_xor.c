@@ -0,0 +1,24 @@
+#include "ciphers.h"
+
+int xor_init(struct xor_ctx *ctx, const char *keyword) {
+    ctx->pos = 0;
+    return xor_key_init(&ctx->key, keyword);
+}
+
+size_t xor_update(struct xor_ctx *ctx, unsigned char *out,
+                  const unsigned char *in, size_t len) {
+    ctx->pos = xor_apply(&ctx->key, ctx->pos, out, in, len);
+    return len;
+}
+
+void xor_reset(struct xor_ctx *ctx) {
+    ctx->pos = 0;
+}
+
+void xor_seek(struct xor_ctx *ctx, unsigned long long offset) {
+    ctx->pos = offset % ctx->key.period;
+}
+
+void xor_free(struct xor_ctx *ctx) {
+    xor_key_free(&ctx->key);
+}
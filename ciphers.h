@@ -0,0 +1,154 @@
+#ifndef CIPHERS_H
+#define CIPHERS_H
+
+#include <stddef.h>
+
+#include "shift_kernel.h"
+#include "xor_kernel.h"
+
+/*
+ * Streaming versions of the ciphers. Each keeps all of its state in
+ * a context so any number of streams can be encrypted side by side:
+ * set one up with the _init function, pass the input through the
+ * _update function as many buffers as it comes in, and finish with
+ * the _final function where the cipher has something left to write.
+ * Nothing is shared between contexts, so different threads can use
+ * different contexts at the same time. This header and the ones it
+ * includes are the interface to libciphers.
+ */
+
+/*
+ * Shift ciphers. keyword holds the shift for each letter, terminated
+ * by -1, and is copied. The options are the SHIFT_ ones from
+ * shift_kernel.h. shift_init_alphabet() works on the characters of
+ * alphabet rather than letters, each shift being a place in it. The
+ * output is always as long as the input and out may be the same as
+ * in. shift_skip() moves the keyword on as if nletters more letters
+ * had been encrypted, to start part way through, and shift_reset()
+ * starts it from the beginning again. shift_copy() sets up ctx with
+ * the same key as from, as from was first set up, without building
+ * the tables again.
+ */
+struct shift_ctx {
+    struct shift_key key;
+    int *keyword;
+    int *initial;
+    int length;
+    int index;
+};
+
+int shift_init(struct shift_ctx *ctx, const int *keyword, int multiplier,
+               int options);
+int shift_init_alphabet(struct shift_ctx *ctx,
+                        const struct shift_alphabet *alphabet,
+                        const int *keyword, int multiplier, int options);
+int shift_update(struct shift_ctx *ctx, unsigned char *out,
+                 const unsigned char *in, size_t len);
+void shift_skip(struct shift_ctx *ctx, unsigned long long nletters);
+void shift_reset(struct shift_ctx *ctx);
+int shift_copy(struct shift_ctx *ctx, const struct shift_ctx *from);
+void shift_free(struct shift_ctx *ctx);
+
+/*
+ * The key as the shift tool and pipeline's shift stages are given it,
+ * an option at a time named after the tool's short flags: m, s and k
+ * with a value and a, z, p, b, c, r and d without. Each is checked
+ * against the alphabet, which has to outlive the options, so that
+ * both take and refuse the same keys. shift_option() returns -1 with
+ * the reason in error for an option the key can't have, and
+ * shift_options_init_ctx() sets up ctx from them, with the identity
+ * shift when given no keyword or shift, returning -1 with errno set
+ * on error.
+ */
+struct shift_options {
+    const struct shift_alphabet *alphabet;
+    int *keyword;
+    int multiplier;
+    int multiplier_given;
+    int options;
+    char error[96];
+};
+
+void shift_options_init(struct shift_options *o,
+                        const struct shift_alphabet *alphabet);
+int shift_option(struct shift_options *o, int option, const char *value);
+int shift_options_init_ctx(struct shift_options *o, struct shift_ctx *ctx);
+void shift_options_free(struct shift_options *o);
+
+/*
+ * Xor cipher. The output is always as long as the input and out may
+ * be the same as in. xor_reset() starts the key from the beginning
+ * again, as the xor tool does for each file, and xor_seek() from
+ * where it would be offset bytes in.
+ */
+struct xor_ctx {
+    struct xor_key key;
+    size_t pos;
+};
+
+int xor_init(struct xor_ctx *ctx, const char *keyword);
+size_t xor_update(struct xor_ctx *ctx, unsigned char *out,
+                  const unsigned char *in, size_t len);
+void xor_reset(struct xor_ctx *ctx);
+void xor_seek(struct xor_ctx *ctx, unsigned long long offset);
+void xor_free(struct xor_ctx *ctx);
+
+/*
+ * Playfair cipher. Only letters are encrypted, so the output can be
+ * up to twice as long as the input: out must have room for
+ * PLAYFAIR_OUTPUT_MAX(len) bytes for playfair_update() and
+ * PLAYFAIR_FINAL_MAX for playfair_final(). playfair_final() pads and
+ * encrypts any letter left over at the end of a message, ready for
+ * the next one. When progressing, the grid carries on progressing
+ * from one message to the next unless playfair_reset() puts it back
+ * as the keyword laid it out, which also drops any letter left over.
+ */
+enum { PLAYFAIR_NONE = 0, PLAYFAIR_DECRYPT = 1, PLAYFAIR_PROGRESS = 2, };
+
+#define PLAYFAIR_OUTPUT_MAX(len) (2 * (len))
+#define PLAYFAIR_FINAL_MAX 2
+
+struct playfair_ctx {
+    int grid[5][5];
+    int letter_row[26];
+    int letter_column[26];
+    int grid_rotation;
+    unsigned char digraph_table[25 * 25][2];
+    int progress_keyword;
+    int decrypt;
+    char letter_pair[2];
+    int pair_letters;
+    /* How many X or Q have been put in by rule 2 or at the end. */
+    unsigned long padding;
+    /* How often the grid has moved on, which padding at the end doesn't. */
+    unsigned long progressions;
+};
+
+int playfair_valid_keyword(const char *keyword);
+int playfair_init(struct playfair_ctx *ctx, const char *keyword, int options);
+size_t playfair_update(struct playfair_ctx *ctx, unsigned char *out,
+                       const unsigned char *in, size_t len);
+size_t playfair_final(struct playfair_ctx *ctx, unsigned char *out);
+void playfair_reset(struct playfair_ctx *ctx);
+int playfair_grid_letter(const struct playfair_ctx *ctx, int row, int column);
+
+/*
+ * Grouping into blocks. Whitespace and non-printing characters are
+ * dropped and a space or newline is put before each new block, so
+ * out must have room for BLOCK_OUTPUT_MAX(len) bytes. All of that
+ * room is used along the way, so out can't overlap in.
+ */
+#define BLOCK_OUTPUT_MAX(len) (2 * (len))
+
+struct block_ctx {
+    int block_size;
+    int nblocks;
+    int char_pos;
+    int block_num;
+};
+
+void block_init(struct block_ctx *ctx, int block_size, int nblocks);
+size_t block_update(struct block_ctx *ctx, unsigned char *out,
+                    const unsigned char *in, size_t len);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef CPU_H
+#define CPU_H
+
+/*
+ * Runtime detection of the vector instructions the kernels can use.
+ * The kernels are compiled for every instruction set with target
+ * attributes and the best one the running processor supports is
+ * picked the first time a cipher is used.
+ */
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define CPU_X86 1
+#endif
+
+enum {
+    CPU_SSE2     = 1 << 0,
+    CPU_SSSE3    = 1 << 1,
+    CPU_AVX2     = 1 << 2,
+    CPU_AVX512F  = 1 << 3,
+    CPU_AVX512BW = 1 << 4,
+};
+
+static inline int cpu_features(void) {
+    int features = 0;
+#ifdef CPU_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("sse2") )
+        features |= CPU_SSE2;
+    if ( __builtin_cpu_supports("ssse3") )
+        features |= CPU_SSSE3;
+    if ( __builtin_cpu_supports("avx2") )
+        features |= CPU_AVX2;
+    if ( __builtin_cpu_supports("avx512f") )
+        features |= CPU_AVX512F;
+    if ( __builtin_cpu_supports("avx512bw") )
+        features |= CPU_AVX512BW;
+#endif
+    return features;
+}
+
+#endif
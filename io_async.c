@@ -0,0 +1,401 @@
+#define _POSIX_C_SOURCE 200809L
+/* For syscall() and MAP_POPULATE. */
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "io_async.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) \
+ && defined(IORING_FEAT_RW_CUR_POS)
+#define HAVE_IO_URING
+#endif
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+enum { BACKEND_NONE, BACKEND_URING, BACKEND_THREADS, };
+
+static int backend = BACKEND_NONE;
+
+static void finish(struct io_op *op);
+
+/*
+ * Carries out as much of op as one read() or write() will and returns
+ * what it did, -1 with errno set on error.
+ */
+static ssize_t perform(struct io_op *op) {
+    unsigned char *buf = op->buf + op->done;
+    size_t len = op->len - op->done;
+
+    if ( op->offset == -1 )
+        return op->write? write(op->fd, buf, len) : read(op->fd, buf, len);
+    return op->write? pwrite(op->fd, buf, len, op->offset + op->done)
+                    : pread(op->fd, buf, len, op->offset + op->done);
+}
+
+/*
+ * Takes what op's latest read or write did, -errno for an error, and
+ * returns whether there is more of it to do.
+ */
+static int progress(struct io_op *op, long result) {
+    if ( result == -EINTR || result == -EAGAIN )
+        return 1;
+    if ( result < 0 ) {
+        op->error = -result;
+        return 0;
+    }
+    if ( result == 0 ) {
+        if ( op->write )
+            op->error = EIO;
+        return 0;
+    }
+
+    op->done += result;
+    return op->done < op->len;
+}
+
+/* Carries out the rest of op here and now. */
+static void perform_all(struct io_op *op) {
+    ssize_t n;
+    do {
+        n = perform(op);
+    } while ( progress(op, n == -1? -errno : n) );
+}
+
+/* Whether op ends the reads queued after it, see io_async.h. */
+static int ends_reads(const struct io_op *op) {
+    return !op->write && op->offset == -1 && !op->error && op->done < op->len;
+}
+
+#ifdef HAVE_IO_URING
+/*
+ * io_uring is driven by whichever thread is waiting, so there are no
+ * threads of its own. The ring has room for more than the buffers
+ * the tools ever have in flight. Operations using the fd's position
+ * wait in serial until the one before them in the same direction is
+ * done, as io_uring would otherwise run them side by side.
+ */
+#define RING_ENTRIES 64
+
+static struct {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned entries;
+    unsigned in_flight;
+} ring;
+
+static struct io_op *running[2];
+static struct io_op *serial_head[2], *serial_tail[2];
+
+static void reap(int wait);
+
+static int ring_enter(unsigned submit, unsigned wait) {
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, ring.fd, submit, wait,
+                      wait? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while ( ret == -1 && errno == EINTR );
+    return ret;
+}
+
+static int ring_setup(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    ring.fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if ( ring.fd == -1 )
+        return -1;
+    if ( !(p.features & IORING_FEAT_RW_CUR_POS) ) {
+        close(ring.fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if ( single && cq_len > sq_len )
+        sq_len = cq_len;
+
+    unsigned char *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring.fd,
+                             IORING_OFF_SQ_RING);
+    unsigned char *cq = sq;
+    if ( sq != MAP_FAILED && !single )
+        cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring.fd, IORING_OFF_SQES);
+    if ( sq == MAP_FAILED || cq == MAP_FAILED || ring.sqes == MAP_FAILED ) {
+        close(ring.fd);
+        return -1;
+    }
+
+    ring.sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *) (sq + p.sq_off.array);
+    ring.cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    ring.entries = p.sq_entries;
+    ring.in_flight = 0;
+    return 0;
+}
+
+/* Hands the rest of op to the kernel. */
+static void ring_push(struct io_op *op) {
+    while ( ring.in_flight == ring.entries )
+        reap(1);
+
+    unsigned tail = *ring.sq_tail;
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op->write? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = op->fd;
+    sqe->addr = (unsigned long) (op->buf + op->done);
+    sqe->len = op->len - op->done;
+    sqe->off = op->offset == -1? (unsigned long long) -1
+                               : (unsigned long long) op->offset + op->done;
+    sqe->user_data = (unsigned long) op;
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.in_flight++;
+
+    if ( ring_enter(1, 0) == -1 ) {
+        /* Nothing went in, so do it here and now instead. */
+        ring.in_flight--;
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+        perform_all(op);
+        finish(op);
+    }
+}
+
+static void ring_submit(struct io_op *op) {
+    if ( op->offset != -1 ) {
+        ring_push(op);
+        return;
+    }
+
+    op->next = NULL;
+    if ( running[op->write] != NULL ) {
+        if ( serial_tail[op->write] != NULL )
+            serial_tail[op->write]->next = op;
+        else
+            serial_head[op->write] = op;
+        serial_tail[op->write] = op;
+        return;
+    }
+
+    running[op->write] = op;
+    ring_push(op);
+}
+
+/* Starts the next serial operation after op, once op is done. */
+static void ring_next(struct io_op *op) {
+    int dir = op->write;
+    struct io_op **link = &serial_head[dir];
+
+    running[dir] = NULL;
+
+    if ( ends_reads(op) ) {
+        while ( *link != NULL ) {
+            if ( (*link)->fd == op->fd ) {
+                struct io_op *ended = *link;
+                *link = ended->next;
+                ended->state = IO_OP_DONE;
+            } else
+                link = &(*link)->next;
+        }
+        serial_tail[dir] = NULL;
+        for (struct io_op *o = serial_head[dir]; o != NULL; o = o->next)
+            serial_tail[dir] = o;
+    }
+
+    struct io_op *next = serial_head[dir];
+    if ( next == NULL )
+        return;
+    if ( ( serial_head[dir] = next->next ) == NULL )
+        serial_tail[dir] = NULL;
+    running[dir] = next;
+    ring_push(next);
+}
+
+/* Takes in whatever has completed, waiting for something if asked. */
+static void reap(int wait) {
+    unsigned head = *ring.cq_head;
+
+    if ( wait && head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) )
+        ring_enter(0, 1);
+
+    for (; head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE); head++) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        struct io_op *op = (struct io_op *) (unsigned long) cqe->user_data;
+        long result = cqe->res;
+
+        __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+        ring.in_flight--;
+
+        if ( progress(op, result) )
+            ring_push(op);
+        else
+            finish(op);
+    }
+}
+#endif
+
+/*
+ * The threads each take the operations for their direction from a
+ * queue in turn, so everything happens in the order it was asked for.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queued[2] = {
+    PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+};
+static struct io_op *queue_head[2], *queue_tail[2];
+
+static void *io_thread(void *arg) {
+    int dir = arg != NULL;
+
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while ( queue_head[dir] == NULL )
+            pthread_cond_wait(&queued[dir], &lock);
+        struct io_op *op = queue_head[dir];
+        if ( ( queue_head[dir] = op->next ) == NULL )
+            queue_tail[dir] = NULL;
+        pthread_mutex_unlock(&lock);
+
+        perform_all(op);
+
+        pthread_mutex_lock(&lock);
+        finish(op);
+        pthread_cond_broadcast(&done);
+        pthread_mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
+
+/* Called with the lock held for the threads. */
+static void finish(struct io_op *op) {
+    op->state = IO_OP_DONE;
+
+#ifdef HAVE_IO_URING
+    if ( backend == BACKEND_URING ) {
+        if ( op->offset == -1 )
+            ring_next(op);
+        return;
+    }
+#endif
+
+    if ( ends_reads(op) ) {
+        struct io_op **link = &queue_head[0];
+        while ( *link != NULL ) {
+            if ( (*link)->fd == op->fd && (*link)->offset == -1 ) {
+                struct io_op *ended = *link;
+                *link = ended->next;
+                ended->state = IO_OP_DONE;
+            } else
+                link = &(*link)->next;
+        }
+        queue_tail[0] = NULL;
+        for (struct io_op *o = queue_head[0]; o != NULL; o = o->next)
+            queue_tail[0] = o;
+    }
+}
+
+static int threads_start(void) {
+    pthread_t thread;
+
+    for (int dir = 0; dir < 2; dir++) {
+        int err = pthread_create(&thread, NULL, io_thread, dir? &backend : NULL);
+        if ( err ) {
+            errno = err;
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    return 0;
+}
+
+int io_async_start(void) {
+    if ( backend != BACKEND_NONE )
+        return 0;
+
+#ifdef HAVE_IO_URING
+    const char *choice = getenv("CIPHERS_IO");
+    if ( ( choice == NULL || strcmp(choice, "threads") != 0 )
+      && ring_setup() == 0 ) {
+        backend = BACKEND_URING;
+        return 0;
+    }
+#endif
+
+    if ( threads_start() == -1 )
+        return -1;
+    backend = BACKEND_THREADS;
+    return 0;
+}
+
+const char *io_async_backend(void) {
+    static const char *names[] = { "none", "io_uring", "threads" };
+    return names[backend];
+}
+
+void io_async_submit(struct io_op *op) {
+    op->done = 0;
+    op->error = 0;
+    op->state = IO_OP_QUEUED;
+    op->next = NULL;
+
+#ifdef HAVE_IO_URING
+    if ( backend == BACKEND_URING ) {
+        ring_submit(op);
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&lock);
+    if ( queue_tail[op->write] != NULL )
+        queue_tail[op->write]->next = op;
+    else
+        queue_head[op->write] = op;
+    queue_tail[op->write] = op;
+    pthread_cond_signal(&queued[op->write]);
+    pthread_mutex_unlock(&lock);
+}
+
+void io_async_wait(struct io_op *op) {
+#ifdef HAVE_IO_URING
+    if ( backend == BACKEND_URING ) {
+        while ( op->state != IO_OP_DONE )
+            reap(1);
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&lock);
+    while ( op->state != IO_OP_DONE )
+        pthread_cond_wait(&done, &lock);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,44 @@
+#ifndef IO_ASYNC_H
+#define IO_ASYNC_H
+
+#include <stddef.h>
+
+/*
+ * Reads and writes carried out in the background while the caller
+ * gets on with something else, through io_uring where the kernel has
+ * it and otherwise a thread for reading and one for writing.
+ *
+ * An operation reads len bytes into buf, stopping early only at the
+ * end of the input, or writes all len bytes of it. With an offset of
+ * -1 it uses the fd's position, and such operations on the same fd
+ * and in the same direction are carried out one after another in the
+ * order they were submitted. A read that comes up short ends the ones
+ * queued after it on its fd, which complete having read nothing
+ * rather than wait on a terminal for more.
+ */
+enum { IO_OP_IDLE, IO_OP_QUEUED, IO_OP_DONE, };
+
+struct io_op {
+    int fd;
+    int write;
+    unsigned char *buf;
+    size_t len;
+    long long offset;
+    size_t done;        /* bytes read or written so far */
+    int error;          /* errno if it failed, otherwise 0 */
+    int state;
+    struct io_op *next;
+};
+
+/*
+ * Starts the background I/O, once for the whole program. Returns -1
+ * with errno set if neither io_uring nor the threads can be started.
+ * Setting CIPHERS_IO=threads in the environment skips io_uring.
+ */
+int io_async_start(void);
+const char *io_async_backend(void);
+
+void io_async_submit(struct io_op *op);
+void io_async_wait(struct io_op *op);
+
+#endif
@@ -0,0 +1,581 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "cipher_io.h"
+#include "ciphers.h"
+
+static char *prog_name = "pipeline";
+static char *prog_version = "1.0";
+static char *invoc_name = NULL;
+static char *author = "a-chap";
+
+static struct io_writer out;
+
+/* Size of the pieces of input passed down the pipeline. */
+#define PIECE_SIZE (1 << 16)
+#define MAX_STAGES 16
+
+/*
+ * With --batch, the framing of the records, or -1, and the output of
+ * the record going through the pipeline, which is framed once it is
+ * all there.
+ */
+static int framing = -1;
+static unsigned char *record = NULL;
+static size_t record_len = 0, record_size = 0;
+
+static struct option options[] = {
+    { "batch", required_argument, NULL, 'B'},
+    { "help", no_argument, NULL, 'h'},
+    { "version", no_argument, NULL, 'v'},
+    { NULL, 0, NULL, 0 }
+};
+
+/*
+ * A stage of the pipeline. update() encrypts a piece of the stream
+ * into the stage's buffer and end() writes out whatever the stage is
+ * holding on to at the end of a stream, as the tool would when its
+ * input runs out. reset() puts the stage back as it was set up, for
+ * the next record in batch mode. growth is how many times longer
+ * than its input the output of update() can be.
+ */
+struct stage {
+    const char *name;
+    size_t (*update)(struct stage *s, unsigned char *dest,
+                     const unsigned char *src, size_t len);
+    size_t (*end)(struct stage *s, unsigned char *dest);
+    void (*reset)(struct stage *s);
+    size_t growth;
+    unsigned char *buf;
+    union {
+        struct shift_ctx shift;
+        struct xor_ctx xor;
+        struct playfair_ctx playfair;
+        struct block_ctx block;
+    } ctx;
+};
+
+static struct stage stages[MAX_STAGES];
+static int nstages = 0;
+
+static void print_version();
+static void print_help();
+
+static void parse_pipeline(char *spec);
+static void parse_stage(struct stage *s, char *spec);
+static void parse_shift(struct stage *s, char *args);
+static void parse_xor(struct stage *s, char *args);
+static void parse_playfair(struct stage *s, char *args);
+static void parse_block(struct stage *s, char *args);
+static void spec_error(const char *stage, const char *message);
+static char *next_field(char **s, int separator);
+static char *trim(char *s);
+
+static void run(int from, const unsigned char *data, size_t len);
+static void run_file(int fd);
+static void run_records(int fd);
+static void end_stage(int i);
+
+int main(int argc, char **argv) {
+    invoc_name = argv[0];
+
+    int c;
+    while ((c = getopt_long(argc, argv, "hv", options, NULL)) != -1) {
+        switch(c) {
+            case 'B':
+                if ( ( framing = io_records_framing(optarg) ) == -1 ) {
+                    fprintf(stderr, "%s: Records are either 'nul' or "
+                                    "'length'.\n", invoc_name);
+                    fprintf(stderr, "Try '%s --help' for more information.\n",
+                                    invoc_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+            case 'v':
+                print_version();
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                fprintf(stderr, "Try '%s --help' for more information.\n", invoc_name);
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+
+    if ( optind == argc ) {
+        fprintf(stderr, "%s: Pipeline missing.\n"
+                        "Try '%s --help' for more information.\n"
+                        , invoc_name, invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    parse_pipeline(argv[optind]);
+
+    /*
+     * Each stage writes into its own buffer, big enough for the most
+     * the stages before it can make of a piece of input.
+     */
+    size_t size = PIECE_SIZE;
+    for (int i = 0; i < nstages; i++) {
+        size *= stages[i].growth;
+        stages[i].buf = malloc(size);
+        if ( stages[i].buf == NULL ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    io_writer_init(&out, STDOUT_FILENO, invoc_name);
+    io_read_flush(&out);
+
+    if ( optind + 1 == argc ) {
+        if ( framing != -1 )
+            run_records(STDIN_FILENO);
+        else
+            run_file(STDIN_FILENO);
+    } else {
+        for (int i = optind + 1; i < argc; i++) {
+            int fd = io_open(argv[i], 0);
+            if ( fd == -1 ) {
+                fprintf(stderr, "%s: ", invoc_name);
+                perror(argv[i]);
+                continue;
+            }
+
+            if ( framing != -1 )
+                run_records(fd);
+            else
+                run_file(fd);
+
+            close(fd);
+        }
+    }
+
+    /*
+     * The later stages read the whole of the first one's output as a
+     * single stream, so they only come to its end now.
+     */
+    if ( framing == -1 )
+        for (int i = 1; i < nstages; i++)
+            end_stage(i);
+
+    io_flush(&out);
+
+    for (int i = 0; i < nstages; i++)
+        free(stages[i].buf);
+    free(record);
+
+    return 0;
+}
+
+/*
+ * Passes data through the stages from the given one onwards and
+ * writes out what comes out of the last.
+ */
+static void run(int from, const unsigned char *data, size_t len) {
+    for (int i = from; i < nstages && len > 0; i++) {
+        len = stages[i].update(&stages[i], stages[i].buf, data, len);
+        data = stages[i].buf;
+    }
+
+    if ( framing == -1 ) {
+        io_write(&out, data, len);
+        return;
+    }
+
+    if ( record_len + len > record_size ) {
+        size_t size = record_size? record_size : PIECE_SIZE;
+        while ( size < record_len + len )
+            size *= 2;
+        if ( ( record = realloc(record, size) ) == NULL ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        record_size = size;
+    }
+    memcpy(record + record_len, data, len);
+    record_len += len;
+}
+
+/*
+ * The first stage is the tool reading the files itself, so it comes
+ * to the end of each file in turn.
+ */
+static void run_file(int fd) {
+    static unsigned char buf[PIECE_SIZE];
+    struct io_map map;
+    ssize_t n;
+
+    if ( io_map(fd, 0, &map) == 0 ) {
+        for (size_t done = 0; done < map.len; done += PIECE_SIZE)
+            run(0, map.data + done,
+                map.len - done < PIECE_SIZE? map.len - done : PIECE_SIZE);
+        io_unmap(&map);
+    } else {
+        while ( ( n = io_read(fd, buf, sizeof(buf)) ) > 0 )
+            run(0, buf, n);
+
+        if ( n == -1 )
+            perror(invoc_name);
+    }
+
+    end_stage(0);
+}
+
+/*
+ * Each record goes through the pipeline as if it were the whole
+ * input of a run of its own, with every stage put back as it was set
+ * up first and brought to its end after, but without setting them up
+ * again.
+ */
+static void run_records(int fd) {
+    struct io_records records;
+    const unsigned char *data;
+    size_t len;
+    int n;
+
+    io_records_init(&records, fd, framing, &out);
+
+    while ( ( n = io_record_next(&records, &data, &len) ) == 1 ) {
+        for (int i = 0; i < nstages; i++)
+            if ( stages[i].reset != NULL )
+                stages[i].reset(&stages[i]);
+
+        record_len = 0;
+        for (size_t done = 0; done < len; done += PIECE_SIZE)
+            run(0, data + done, len - done < PIECE_SIZE? len - done : PIECE_SIZE);
+        for (int i = 0; i < nstages; i++)
+            end_stage(i);
+
+        io_write_record(&out, framing, record, record_len);
+    }
+
+    if ( n == -1 ) {
+        if ( errno == EINVAL )
+            fprintf(stderr, "%s: The last record is cut short.\n", invoc_name);
+        else
+            perror(invoc_name);
+    }
+
+    io_records_free(&records);
+}
+
+static void end_stage(int i) {
+    struct stage *s = &stages[i];
+    if ( s->end == NULL )
+        return;
+
+    size_t len = s->end(s, s->buf);
+    if ( len > 0 ) {
+        /* run() overwrites the buffer the output is in, so copy it. */
+        unsigned char tail[PLAYFAIR_FINAL_MAX];
+        memcpy(tail, s->buf, len);
+        run(i + 1, tail, len);
+    }
+}
+
+static size_t shift_stage(struct stage *s, unsigned char *dest,
+                          const unsigned char *src, size_t len) {
+    if ( shift_update(&s->ctx.shift, dest, src, len) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    return len;
+}
+
+static void shift_reset_stage(struct stage *s) {
+    shift_reset(&s->ctx.shift);
+}
+
+static size_t xor_stage(struct stage *s, unsigned char *dest,
+                        const unsigned char *src, size_t len) {
+    return xor_update(&s->ctx.xor, dest, src, len);
+}
+
+static size_t xor_end(struct stage *s, unsigned char *dest) {
+    xor_reset(&s->ctx.xor);
+    return 0;
+}
+
+static void xor_reset_stage(struct stage *s) {
+    xor_reset(&s->ctx.xor);
+}
+
+static size_t playfair_stage(struct stage *s, unsigned char *dest,
+                             const unsigned char *src, size_t len) {
+    return playfair_update(&s->ctx.playfair, dest, src, len);
+}
+
+static size_t playfair_end(struct stage *s, unsigned char *dest) {
+    return playfair_final(&s->ctx.playfair, dest);
+}
+
+static void playfair_reset_stage(struct stage *s) {
+    playfair_reset(&s->ctx.playfair);
+}
+
+static size_t block_stage(struct stage *s, unsigned char *dest,
+                          const unsigned char *src, size_t len) {
+    return block_update(&s->ctx.block, dest, src, len);
+}
+
+static void block_reset_stage(struct stage *s) {
+    block_init(&s->ctx.block, s->ctx.block.block_size, s->ctx.block.nblocks);
+}
+
+static void parse_pipeline(char *spec) {
+    for (char *stage; ( stage = next_field(&spec, '|') ) != NULL; ) {
+        if ( nstages == MAX_STAGES ) {
+            fprintf(stderr, "%s: At most %d stages can be used.\n",
+                            invoc_name, MAX_STAGES);
+            exit(EXIT_FAILURE);
+        }
+        stage = trim(stage);
+        if ( *stage == '\0' )
+            spec_error("", "Empty stage.");
+        parse_stage(&stages[nstages++], stage);
+    }
+
+    if ( nstages == 0 )
+        spec_error("", "Empty pipeline.");
+}
+
+static void parse_stage(struct stage *s, char *spec) {
+    char *args = strchr(spec, ':');
+    if ( args != NULL )
+        *args++ = '\0';
+
+    s->name = trim(spec);
+    s->end = NULL;
+    s->reset = NULL;
+    s->growth = 1;
+
+    if ( strcmp(s->name, "shift") == 0 )
+        parse_shift(s, args);
+    else if ( strcmp(s->name, "xor") == 0 )
+        parse_xor(s, args);
+    else if ( strcmp(s->name, "playfair") == 0 )
+        parse_playfair(s, args);
+    else if ( strcmp(s->name, "block") == 0 )
+        parse_block(s, args);
+    else
+        spec_error(s->name, "Unknown cipher.");
+}
+
+/*
+ * shift takes comma separated options named after its short flags:
+ * k=WORD, s=N, m=N, a, z, p, b, c, r and d, as well as alphabet=SPEC
+ * for --alphabet-spec, which as with the tool counts wherever it is.
+ */
+static void parse_shift(struct stage *s, char *args) {
+    struct shift_alphabet alphabet;
+    struct shift_options key;
+    const char *spec = "letters";
+    char *fields[64];
+    int nfields = 0;
+
+    for (char *arg; ( arg = next_field(&args, ',') ) != NULL; ) {
+        arg = trim(arg);
+        if ( strncmp(arg, "alphabet=", 9) == 0 )
+            spec = arg + 9;
+        else if ( nfields < 64 )
+            fields[nfields++] = arg;
+        else
+            spec_error("shift", "Too many options.");
+    }
+
+    if ( shift_alphabet_init(&alphabet, spec) ) {
+        char message[128];
+        snprintf(message, sizeof(message), "'%s' isn't an alphabet.", spec);
+        spec_error("shift", message);
+    }
+    shift_options_init(&key, &alphabet);
+
+    for (int i = 0; i < nfields; i++) {
+        int option = fields[i][0];
+        const char *value = NULL;
+
+        /* Anything not like the flags is left for shift_option() to refuse. */
+        if ( option != '\0' && strchr("msk", option) && fields[i][1] == '=' )
+            value = fields[i] + 2;
+        else if ( option == '\0' || !strchr("azpbcrd", option)
+               || fields[i][1] != '\0' )
+            option = '?';
+
+        if ( shift_option(&key, option, value) )
+            spec_error("shift", key.error);
+    }
+
+    if ( shift_options_init_ctx(&key, &s->ctx.shift) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    shift_options_free(&key);
+
+    s->update = shift_stage;
+    s->reset = shift_reset_stage;
+}
+
+/* Everything after the colon is the key, as xor takes any string. */
+static void parse_xor(struct stage *s, char *args) {
+    if ( args == NULL )
+        spec_error("xor", "Keyword missing.");
+    if ( xor_init(&s->ctx.xor, args) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    s->update = xor_stage;
+    s->end = xor_end;
+    s->reset = xor_reset_stage;
+}
+
+/* playfair takes its keyword on its own or as k=WORD, then p and d. */
+static void parse_playfair(struct stage *s, char *args) {
+    char *keyword = NULL;
+    int cipher_options = PLAYFAIR_NONE;
+
+    for (char *arg; ( arg = next_field(&args, ',') ) != NULL; ) {
+        arg = trim(arg);
+        if ( strcmp(arg, "p") == 0 )
+            cipher_options |= PLAYFAIR_PROGRESS;
+        else if ( strcmp(arg, "d") == 0 )
+            cipher_options |= PLAYFAIR_DECRYPT;
+        else if ( keyword != NULL )
+            spec_error("playfair", "Only one keyword needed.");
+        else if ( strncmp(arg, "k=", 2) == 0 )
+            keyword = arg + 2;
+        else
+            keyword = arg;
+    }
+
+    if ( keyword == NULL )
+        spec_error("playfair", "Keyword missing.");
+    if ( playfair_init(&s->ctx.playfair, keyword, cipher_options) )
+        spec_error("playfair", "Keyword must consist only of letters.");
+
+    s->update = playfair_stage;
+    s->end = playfair_end;
+    s->reset = playfair_reset_stage;
+    s->growth = 2;
+}
+
+/* block takes b=SIZE and n=N. */
+static void parse_block(struct stage *s, char *args) {
+    int block_size = 5;
+    int nblock_line = 0;
+
+    for (char *arg; ( arg = next_field(&args, ',') ) != NULL; ) {
+        arg = trim(arg);
+        if ( strncmp(arg, "b=", 2) == 0 )
+            block_size = atoi(arg + 2);
+        else if ( strncmp(arg, "n=", 2) == 0 )
+            nblock_line = atoi(arg + 2);
+        else
+            spec_error("block", "Unknown option.");
+    }
+
+    block_init(&s->ctx.block, block_size, nblock_line);
+
+    s->update = block_stage;
+    s->reset = block_reset_stage;
+    s->growth = 2;
+}
+
+static void spec_error(const char *stage, const char *message) {
+    fprintf(stderr, "%s: %s%s%s\n", invoc_name, stage, *stage? ": " : "",
+                    message);
+    fprintf(stderr, "Try '%s --help' for more information.\n", invoc_name);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Returns the next field of *s up to the separator, moving *s on
+ * past it, or NULL when there are no more. Like strtok() empty
+ * fields are skipped, but it can be used for fields within fields.
+ */
+static char *next_field(char **s, int separator) {
+    char *field = *s;
+    if ( field == NULL )
+        return NULL;
+
+    while ( *field == separator )
+        field++;
+    if ( *field == '\0' ) {
+        *s = NULL;
+        return NULL;
+    }
+
+    char *end = strchr(field, separator);
+    if ( end != NULL )
+        *end++ = '\0';
+    *s = end;
+
+    return field;
+}
+
+static char *trim(char *s) {
+    while ( isspace((unsigned char) *s) )
+        s++;
+
+    char *end = s + strlen(s);
+    while ( end > s && isspace((unsigned char) end[-1]) )
+        end--;
+    *end = '\0';
+
+    return s;
+}
+
+static void print_version() {
+    printf("%s %s\n"
+           "\n"
+           "Written by %s\n",
+           prog_name, prog_version, author);
+}
+
+static void print_help() {
+    printf("Usage: %s [OPTION] PIPELINE [FILE]...\n"
+           "\n"
+           "Runs stdin or FILEs through a pipeline of the ciphers in a\n"
+           "single process. The output is the same as piping the tools\n"
+           "into one another, with the first given the FILEs.\n"
+           "\n"
+           "        --batch FRAMING  rather than one message, read many\n"
+           "                    records and run each through the\n"
+           "                    pipeline as if on its own, writing out\n"
+           "                    the results framed the same way. FRAMING\n"
+           "                    is nul for records each ended by a NUL or\n"
+           "                    length for each preceded by its length\n"
+           "                    as a 4 byte big endian number.\n"
+           "    -h, --help      display this help and exit.\n"
+           "    -v, --version   display version information and exit.\n"
+           "\n"
+           "Pipeline\n"
+           "========\n"
+           "The stages are separated by '|' and each is the name of a\n"
+           "tool, then a colon and its options separated by commas:\n"
+           "\n"
+           "    shift:k=WORD,s=N,m=N,a,z,p,b,c,r,d,alphabet=SPEC\n"
+           "                    the options are shift's short flags and\n"
+           "                    its --alphabet-spec.\n"
+           "    xor:KEYWORD     everything after the colon is the key.\n"
+           "    playfair:KEYWORD,p,d\n"
+           "    block:b=SIZE,n=N\n"
+           "\n"
+           "For example\n"
+           "\n"
+           "    %s 'shift:k=key,p | playfair:keyword | block:b=5,n=10'\n"
+           "\n"
+           "is the same as\n"
+           "\n"
+           "    shift -k key -p | playfair keyword | block -b 5 -n 10\n",
+           invoc_name, invoc_name);
+}
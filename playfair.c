@@ -2,47 +2,108 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#include <stdint.h>
+#include <limits.h>
 #include <getopt.h>
 
+#include "cipher_io.h"
+#include "ciphers.h"
+#include "workers.h"
+#include "batch.h"
+#include "playfair_solve.h"
+
 static char *prog_name = "playfair";
 static char *prog_version = "1.0";
 static char *invoc_name = NULL;
 static char *author = "a-chap";
 
+static struct io_writer out;
+static struct io_ahead ahead;
+static int async_io = 0;
+static const char *out_dir = NULL;
+static int recursive = 0;
+static const struct playfair_ctx *batch_key = NULL;
+static unsigned long batch_padding = 0;
+static unsigned long batch_progressions = 0;
+
 static struct option options[] = {
     { "progress", no_argument, NULL, 'p'},
     { "decrypt", no_argument, NULL, 'd'},
+    { "jobs", required_argument, NULL, 'j'},
+    { "solve", no_argument, NULL, 'S'},
+    { "quadgrams", required_argument, NULL, 'Q'},
+    { "stats", no_argument, NULL, 'X'},
+    { "async-io", no_argument, NULL, 'A'},
+    { "output", required_argument, NULL, 'o'},
+    { "recursive", no_argument, NULL, 'W'},
+    { "time", required_argument, NULL, 'T'},
     { "help", no_argument, NULL, 'h'},
     { "version", no_argument, NULL, 'v'},
     { NULL, 0, NULL, 0 }
 };
 
-static int playfair_grid[5][5];
-static int progress_keyword = 0;
-static int decrypt = 0;
-
 static void print_version();
 static void print_help();
 
-static int valid_keyword(char *keyword);
-static void fill_in_playfair_grid(char *keyword);
-static void progress_grid();
-static void print_playfair_grid();
-static void encrypt_letters(char *letter_pair);
-static void encrypt(FILE *fp);
+static void print_playfair_grid(const struct playfair_ctx *ctx);
+static void solve(char **files, int nfiles, int options, int jobs,
+                  const char *quadgram_path, double seconds);
+static size_t read_letters(int fd, char **letters, size_t n, size_t *size);
+static void encrypt(int fd, struct playfair_ctx *ctx);
+static void encrypt_buffer(struct playfair_ctx *ctx, const unsigned char *buf,
+                           size_t len);
+static void encrypt_batch(char **files, int nfiles, struct playfair_ctx *ctx,
+                          int jobs, int stats);
 
 int main(int argc, char **argv) {
+    static struct playfair_ctx ctx;
+    int cipher_options = PLAYFAIR_NONE;
+    int solving = 0;
+    int stats = 0;
+    int jobs = 0;
+    const char *quadgram_path = NULL;
+    double seconds = 0;
+
     invoc_name = argv[0];
 
     int c;
-    while ((c = getopt_long(argc, argv, "pdhv", options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "pdj:o:hv", options, NULL)) != -1) {
         switch(c) {
             case 'p':
-                progress_keyword = 1;
+                cipher_options |= PLAYFAIR_PROGRESS;
                 break;
             case 'd':
-                decrypt = 1;
+                cipher_options |= PLAYFAIR_DECRYPT;
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                if ( jobs < 1 ) {
+                    fprintf(stderr, "%s: The number of jobs needs to be at "
+                                    "least 1.\n"
+                                    "Try '%s --help' for more information.\n"
+                                    , invoc_name, invoc_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'S':
+                solving = 1;
+                break;
+            case 'Q':
+                quadgram_path = optarg;
+                break;
+            case 'T':
+                seconds = atof(optarg);
+                break;
+            case 'X':
+                stats = 1;
+                break;
+            case 'A':
+                async_io = 1;
+                break;
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'W':
+                recursive = 1;
                 break;
             case 'h':
                 print_help();
@@ -59,6 +120,23 @@ int main(int argc, char **argv) {
         }
     }
 
+    if ( recursive && out_dir == NULL ) {
+        fprintf(stderr, "%s: --recursive needs -o.\n"
+                        "Try '%s --help' for more information.\n"
+                        , invoc_name, invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Each file of a batch is a job of its own, so use every processor. */
+    if ( jobs == 0 )
+        jobs = out_dir != NULL || solving? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+
+    if ( solving ) {
+        solve(argv + optind, argc - optind, cipher_options, jobs,
+              quadgram_path, seconds);
+        return 0;
+    }
+
     if ( optind == argc ) {
         fprintf(stderr, "%s: Keyword missing.\n"
                         "Try '%s --help' for more information.\n"
@@ -69,215 +147,276 @@ int main(int argc, char **argv) {
                         "Try '%s --help' for more information.\n"
                         , invoc_name, invoc_name);
         exit(EXIT_FAILURE);
-    } else if ( !valid_keyword(argv[optind]) ) {
+    } else if ( !playfair_valid_keyword(argv[optind]) ) {
         fprintf(stderr, "%s: Keyword must consist only of letters.\n"
                         "Try '%s --help' for more information.\n"
                         , invoc_name, invoc_name);
         exit(EXIT_FAILURE);
     }
 
-    fill_in_playfair_grid(argv[optind]);
+    playfair_init(&ctx, argv[optind], cipher_options);
+
+    if ( out_dir != NULL ) {
+        if ( optind + 1 == argc ) {
+            fprintf(stderr, "%s: -o needs FILEs.\n"
+                            "Try '%s --help' for more information.\n"
+                            , invoc_name, invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        encrypt_batch(argv + optind + 1, argc - optind - 1, &ctx, jobs, stats);
+    }
+
+    if ( stats )
+        io_stats_start(IO_STATS_LETTERS);
+    io_writer_init(&out, STDOUT_FILENO, invoc_name);
+    io_read_flush(&out);
+    if ( async_io && ( io_writer_async(&out) || io_ahead_init(&ahead, IO_BUFSIZE) ) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
 
     if ( optind + 1 == argc ) {
-        encrypt(stdin);
+        encrypt(STDIN_FILENO, &ctx);
     } else {
         for (int i = optind + 1; i < argc; i++) {
-            FILE *fp = fopen(argv[i], "r");
-            if ( fp == NULL ) {
+            int fd = io_open(argv[i], 0);
+            if ( fd == -1 ) {
                 fprintf(stderr, "%s: ", invoc_name);
                 perror(argv[i]);
                 continue;
             }
 
-            encrypt(fp);
+            encrypt(fd, &ctx);
 
-            fclose(fp);
+            close(fd);
         }
     }
 
-    return 0;
-}
-
-static int valid_keyword(char *keyword) {
-    if ( keyword == NULL || strlen(keyword) == 0 )
-        return 0;
-
-    for (int i = 0; i < strlen(keyword); i++)
-        if ( !isalpha(keyword[i]) )
-            return 0;
-
-    return 1;
-}
-
-static void progress_grid() {
-    for (int i = 0; i < 5; i++) {
-        for (int j = 0; j < 5; j++) {
-            if ( playfair_grid[i][j] == 'Z' )
-                playfair_grid[i][j] = 'A';
-            else if ( playfair_grid[i][j] == 'I' )
-                playfair_grid[i][j] = 'K';
-            else
-                playfair_grid[i][j]++;
-        }
+    io_flush(&out);
+    if ( stats ) {
+        io_stats_report(invoc_name);
+        /* Everything written is a digraph. */
+        unsigned long long digraphs = io_stats.bytes_written / 2;
+        fprintf(stderr, "%s: %llu digraphs, %lu padded with X or Q, "
+                        "%lu grid progressions\n", invoc_name, digraphs,
+                ctx.padding, ctx.progressions);
     }
+
+    return 0;
 }
 
-static void print_playfair_grid() {
+static void print_playfair_grid(const struct playfair_ctx *ctx) {
     for (int i = 0; i < 5; i++) {
         printf("+---+---+---+---+---+\n");
         for (int j = 0; j < 5; j++) {
-            printf("| %c ", playfair_grid[i][j]);
+            printf("| %c ", playfair_grid_letter(ctx, i, j));
         }
         puts("|");
     }
     printf("+---+---+---+---+---+\n");
 }
 
-static void fill_in_playfair_grid(char *keyword) {
-    /* nth bit will be the nth letter of the alphabet */
-    int32_t used_letters = 0;
-    int n_spaces_filled = 0;
-
-    for (int i = 0; i < strlen(keyword); i++) {
-        int letter = toupper(keyword[i]);
-
-        /*
-         * There are only 25 spaces in the Playfair
-         * Grid but 26 letters of the alphabet so
-         * one of the spaces has to be used twice.
-         * Thus I doubles up as J.
-         */
-        if (letter == 'J')
-            letter = 'I';
-
-        /* if letter is already in grid skip */
-        if ( used_letters & ( 1 << (letter - 'A') ) )
+/*
+ * Finds the grid the letters of all of the input were most likely
+ * encrypted with and prints it, and how to decrypt with it.
+ */
+static void solve(char **files, int nfiles, int options, int jobs,
+                  const char *quadgram_path, double seconds) {
+    struct playfair_solution solution;
+    struct playfair_ctx ctx;
+    struct workers *workers;
+    char *letters = NULL;
+    size_t n = 0, size = 0;
+    float *quadgrams;
+
+    if ( quadgram_path == NULL ) {
+        fprintf(stderr, "%s: Solving needs --quadgrams FILE.\n"
+                        "Try '%s --help' for more information.\n"
+                        , invoc_name, invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    if ( ( quadgrams = playfair_quadgrams(quadgram_path) ) == NULL ) {
+        fprintf(stderr, "%s: ", invoc_name);
+        perror(quadgram_path);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( nfiles == 0 )
+        n = read_letters(STDIN_FILENO, &letters, n, &size);
+
+    for (int i = 0; i < nfiles; i++) {
+        int fd = io_open(files[i], 0);
+        if ( fd == -1 ) {
+            fprintf(stderr, "%s: ", invoc_name);
+            perror(files[i]);
             continue;
-        else
-            used_letters |= ( 1 << (letter - 'A') );
+        }
 
-        playfair_grid[n_spaces_filled / 5][n_spaces_filled % 5] = letter;
+        n = read_letters(fd, &letters, n, &size);
 
-        n_spaces_filled++;
+        close(fd);
     }
 
-    /* Fill in any remaining spaces of the grid. */
-    for (int i = 0; i < 26; i++) {
-        if ( n_spaces_filled == 25 )
-            break;
-        if ( i == 'J' - 'A' ) /* Skip J because I has its place */
-            continue;
-        if ( used_letters & (1 << i) )
-            continue;
-
-        playfair_grid[n_spaces_filled / 5][n_spaces_filled % 5] = i + 'A';
-        n_spaces_filled++;
+    if ( n < 2 ) {
+        fprintf(stderr, "%s: There are not enough letters to solve.\n",
+                        invoc_name);
+        exit(EXIT_FAILURE);
     }
 
-    return;
+    if ( ( workers = workers_start(jobs) ) == NULL
+      || playfair_solve(letters, n, options, quadgrams, seconds, workers,
+                        &solution) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    workers_stop(workers);
+    free(quadgrams);
+    free(letters);
+
+    playfair_init(&ctx, solution.keyword, PLAYFAIR_NONE);
+
+    printf("keyword: %s\n", solution.keyword);
+    print_playfair_grid(&ctx);
+    printf("score: %.2f\n", solution.score);
+    printf("grids tried: %ld\n", solution.grids_tried);
+    printf("decrypt with: %s -d%s %s\n", invoc_name,
+           (options & PLAYFAIR_PROGRESS)? " -p" : "", solution.keyword);
 }
 
-static void encrypt_letters(char *letter_pair) {
-    int row_1, column_1,
-        row_2, column_2;
-    row_1 = row_2 = -1;
-
-    for (int x = 0; x < 5; x++) {
-        for (int y = 0; y < 5; y++) {
-            if ( playfair_grid[x][y] == letter_pair[0] ) {
-                row_1 = x;
-                column_1 = y;
-            }
-            if ( playfair_grid[x][y] == letter_pair[1] ) {
-                row_2 = x;
-                column_2 = y;
+/*
+ * Adds the letters of fd, in upper case with J as I as the cipher
+ * has them, to letters, which has n of size so far.
+ */
+static size_t read_letters(int fd, char **letters, size_t n, size_t *size) {
+    static unsigned char buf[IO_BUFSIZE];
+    ssize_t got;
+
+    while ( ( got = io_read(fd, buf, sizeof(buf)) ) > 0 ) {
+        if ( n + got > *size ) {
+            *size = 2 * *size + got;
+            if ( ( *letters = realloc(*letters, *size) ) == NULL ) {
+                perror(invoc_name);
+                exit(EXIT_FAILURE);
             }
+        }
 
-            if (row_1 != -1 && row_2 != -1)
-                goto END_LOOP;
+        for (ssize_t j = 0; j < got; j++) {
+            int c = buf[j];
+            if ( !isalpha(c) )
+                continue;
+            c = toupper(c);
+            (*letters)[n++] = (c == 'J')? 'I' : c;
         }
     }
-    END_LOOP:; /* ; meant to be here. So I can break out of the inner loop */
-
-    if ( row_1 == row_2 ) {
-        /* Rule 3 --- shift to the right in the grid */
-        letter_pair[0] = playfair_grid[row_1][(column_1 + (decrypt? 4 : 1)) % 5];
-        letter_pair[1] = playfair_grid[row_2][(column_2 + (decrypt? 4 : 1)) % 5];
-    } else if ( column_1 == column_2 ) {
-        /* Rule 4 --- shift downwards in the grid */
-        letter_pair[0] = playfair_grid[(row_1 + (decrypt? 4 : 1)) % 5][column_1];
-        letter_pair[1] = playfair_grid[(row_2 + (decrypt? 4 : 1)) % 5][column_2];
+
+    if ( got == -1 )
+        perror(invoc_name);
+
+    return n;
+}
+
+static void encrypt(int fd, struct playfair_ctx *ctx) {
+    static unsigned char buf[IO_BUFSIZE];
+    unsigned char *data;
+    struct io_map map;
+    ssize_t n;
+
+    /*
+     * Regular files are encrypted straight from a mapping of them,
+     * unless reading ahead.
+     */
+    if ( async_io ) {
+        io_ahead_start(&ahead, fd, ULLONG_MAX);
+        while ( ( n = io_ahead_next(&ahead, &data) ) > 0 )
+            encrypt_buffer(ctx, data, n);
+        io_ahead_stop(&ahead);
+
+        if ( n == -1 )
+            perror(invoc_name);
+    } else if ( io_map(fd, 0, &map) == 0 ) {
+        encrypt_buffer(ctx, map.data, map.len);
+        io_unmap(&map);
     } else {
-        /*
-         * Rule 5 --- swap to different corners of the rectangle
-         * that the letters are in
-         */
-        letter_pair[0] = playfair_grid[row_1][column_2];
-        letter_pair[1] = playfair_grid[row_2][column_1];
+        while ( ( n = io_read(fd, buf, sizeof(buf)) ) > 0 )
+            encrypt_buffer(ctx, buf, n);
+
+        if ( n == -1 )
+            perror(invoc_name);
     }
 
-    return;
+    io_commit(&out, playfair_final(ctx, io_reserve(&out, PLAYFAIR_FINAL_MAX)));
 }
 
-static void encrypt(FILE *fp) {
-    char letter_pair[2] = {0, 0};
-    int i = 0;
-    int c;
-    while ( ( c = fgetc(fp) ) != EOF ) {
-        if ( !isalpha(c) )
-            continue;
-        if ( c == 'j' || c == 'J' )
-            c = 'I';
-
-        letter_pair[i++] = toupper(c);
+/*
+ * Encrypts buf straight into the output buffer, in pieces small
+ * enough that their output always fits in it.
+ */
+static void encrypt_buffer(struct playfair_ctx *ctx, const unsigned char *buf,
+                           size_t len) {
+    const size_t piece = IO_BUFSIZE / 2;
+
+    if ( io_stats.enabled )
+        io_stats_count(buf, len);
+
+    for (size_t done = 0; done < len; done += piece) {
+        size_t n = len - done < piece? len - done : piece;
+        unsigned char *dest = io_reserve(&out, PLAYFAIR_OUTPUT_MAX(n));
+        io_commit(&out, playfair_update(ctx, dest, buf + done, n));
+    }
+}
 
-        if ( i < 2 )
-            continue;
+/*
+ * With -o, each file is started from the grid as the keyword laid it
+ * out and finished on its own. Its output can be up to twice as long,
+ * so there is no starting part way through and each file is one job.
+ */
+static int batch_start(void *state) {
+    *(struct playfair_ctx *) state = *batch_key;
+    playfair_reset(state);
+    return 0;
+}
 
-        /*
-         * Rule 2 for Playfair --- duplicate
-         * letters have a low frequency letter
-         * put between them.
-         */
-        int double_letter = 0;
-        if ( letter_pair[0] == letter_pair[1] ) {
-            if ( letter_pair[0] != 'X' )
-                letter_pair[1] = 'X';
-            else
-                letter_pair[1] = 'Q';
-            double_letter = letter_pair[0];
-        }
+static size_t batch_update(void *state, unsigned char *out,
+                           const unsigned char *in, size_t len) {
+    return playfair_update(state, out, in, len);
+}
 
-        encrypt_letters(letter_pair);
+static size_t batch_final(void *state, unsigned char *out) {
+    return playfair_final(state, out);
+}
 
-        if ( progress_keyword )
-            progress_grid();
+static void batch_end(void *state) {
+    const struct playfair_ctx *ctx = state;
+    __atomic_fetch_add(&batch_padding, ctx->padding, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&batch_progressions, ctx->progressions, __ATOMIC_RELAXED);
+}
 
-        printf("%s", letter_pair);
+static void encrypt_batch(char **files, int nfiles, struct playfair_ctx *ctx,
+                          int jobs, int stats) {
+    static const struct batch_cipher cipher = {
+        sizeof(struct playfair_ctx), batch_start, batch_update, batch_final,
+        batch_end, 2, PLAYFAIR_FINAL_MAX, NULL, NULL,
+    };
+    struct workers *workers;
 
-        /*
-         * Resetting the letter pair because the one
-         * just handled was two of the same letter
-         * see Rule 2.
-         */
-        if ( double_letter ) {
-            i = 1;
-            letter_pair[0] = double_letter;
-            double_letter = 0;
-        } else {
-            i = 0;
-        }
+    if ( ( workers = workers_start(jobs) ) == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
     }
 
-    /*
-     * If there is an odd number of letters in the plain text
-     * add an extra one and encrypt
-     */
-    if ( i != 0 ) {
-        letter_pair[1] = (letter_pair[0] != 'X')? 'X' : 'Q';
-        encrypt_letters(letter_pair);
-        printf("%s", letter_pair);
+    batch_key = ctx;
+    if ( stats )
+        io_stats_start(IO_STATS_LETTERS);
+    int failures = batch_run(&cipher, files, nfiles, out_dir, recursive,
+                             workers, invoc_name);
+    if ( stats ) {
+        io_stats_report(invoc_name);
+        unsigned long long digraphs = io_stats.bytes_written / 2;
+        fprintf(stderr, "%s: %llu digraphs, %lu padded with X or Q, "
+                        "%lu grid progressions\n", invoc_name, digraphs,
+                batch_padding, batch_progressions);
     }
+    exit(failures > 0? EXIT_FAILURE : EXIT_SUCCESS);
 }
 
 static void print_version() {
@@ -289,6 +428,7 @@ static void print_version() {
 
 static void print_help() {
     printf("Usage: %s [OPTION] KEYWORD [FILE]...\n"
+           "   or: %s --solve --quadgrams FILE [OPTION]... [FILE]...\n"
            "   or: %s [OPTION]\n"
            "\n"
            "Encrypts stdin or FILEs using the Playfair cipher.\n"
@@ -302,6 +442,30 @@ static void print_help() {
            "                    should be done. You'll have to use your\n"
            "                    own judgement on those and any non-letters\n"
            "                    and capitalisation.\n"
+           "        --solve     rather than encrypting, find the grid the\n"
+           "                    input was encrypted with. There is no\n"
+           "                    KEYWORD, give -p if the grid progressed.\n"
+           "        --quadgrams FILE  the statistics of English to solve\n"
+           "                    with, either lines of four letters and\n"
+           "                    how often they appear or English text.\n"
+           "        --time SECS spend SECS solving rather than cooling\n"
+           "                    down at a fixed rate. Longer is more\n"
+           "                    likely to find the grid.\n"
+           "    -o, --output DIR  encrypt each FILE on its own, from the\n"
+           "                      grid as the keyword lays it out, into a\n"
+           "                      file of the same name in DIR, all at once\n"
+           "                      using -j threads, by default one per\n"
+           "                      processor.\n"
+           "        --recursive  with -o, encrypt the files in any\n"
+           "                     directories given too, recreating them\n"
+           "                     under DIR.\n"
+           "    -j, --jobs N    solve, or encrypt with -o, with N threads,\n"
+           "                    by default one per processor.\n"
+           "        --stats     report what was read, written and transformed\n"
+           "                    and how long it took to standard error.\n"
+           "        --async-io  read ahead and write behind in the background,\n"
+           "                    using io_uring where the kernel has it, so\n"
+           "                    reading, encrypting and writing all overlap.\n"
            "    -h, --help      display this help and exit.\n"
            "    -v, --version   display version information and exit.\n"
            "\n"
@@ -375,5 +539,5 @@ static void print_help() {
            "5. If the letters in the above table form the corners\n"
            "   of a rectangle, swap each with the other corner in its\n"
            "   row. Eg RS -> CO in the above table.\n"
-           ,invoc_name, invoc_name);
+           ,invoc_name, invoc_name, invoc_name);
 }
@@ -0,0 +1,350 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "ciphers.h"
+#include "playfair_solve.h"
+
+/*
+ * The cooling schedule: the temperature starts higher for longer
+ * ciphertexts, whose scores differ by more, and drops by STEP after
+ * every GRIDS_PER_STEP grids tried.
+ */
+#define STEP 0.2
+#define GRIDS_PER_STEP 10000
+
+static const char grid_letters[] = "ABCDEFGHIKLMNOPQRSTUVWXYZ"
+                                   "ABCDEFGHIKLMNOPQRSTUVWXYZ";
+static const unsigned char letter_place[26] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  8,  9, 10, 11,
+    12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+};
+
+struct solve_job {
+    /*
+     * The ciphertext as the places in the grid of its letters, 0 to
+     * 24, with a progressing grid's rotation for each pair already
+     * taken off so every pair can be decrypted with the unrotated
+     * grid.
+     */
+    const unsigned char *letters;
+    size_t n;
+    int progress;
+    /*
+     * Where the Playfair rules move each pair of places in the grid
+     * to when decrypting, whatever letters are in them.
+     */
+    const unsigned char (*digraph_table)[2];
+    const float *quadgrams;
+    double seconds;
+    double deadline;
+    struct playfair_solution *solutions;
+};
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* A random number from 0 up to but not including n. */
+static int random_below(uint64_t *state, int n) {
+    return (next_random(state) >> 32) % n;
+}
+
+static double random_fraction(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+float *playfair_quadgrams(const char *path) {
+    FILE *f = fopen(path, "r");
+    double *counts = calloc(QUADGRAMS, sizeof(double));
+    float *quadgrams = malloc(QUADGRAMS * sizeof(float));
+    double total = 0;
+    char quadgram[5];
+    double count;
+    int c;
+
+    if ( f == NULL || counts == NULL || quadgrams == NULL )
+        goto fail;
+
+    if ( fscanf(f, "%4[A-Za-z] %lf", quadgram, &count) == 2
+      && strlen(quadgram) == 4 ) {
+        do {
+            int q = 0;
+            for (int i = 0; i < 4; i++)
+                q = q * 26 + toupper((unsigned char) quadgram[i]) - 'A';
+            counts[q] += count;
+            total += count;
+        } while ( fscanf(f, " %4[A-Za-z] %lf", quadgram, &count) == 2 );
+    } else {
+        /* Not a list, so count the quadgrams in it as text. */
+        int q = 0, letters = 0;
+        rewind(f);
+        while ( ( c = getc(f) ) != EOF ) {
+            if ( !isalpha(c) )
+                continue;
+            q = (q * 26 + toupper(c) - 'A') % QUADGRAMS;
+            if ( ++letters >= 4 ) {
+                counts[q]++;
+                total++;
+            }
+        }
+    }
+
+    if ( total == 0 ) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    /* Quadgrams never seen are taken as rarer than any that were. */
+    float floor = log10(0.01 / total);
+    for (int q = 0; q < QUADGRAMS; q++)
+        quadgrams[q] = counts[q] > 0? log10(counts[q] / total) : floor;
+
+    free(counts);
+    fclose(f);
+    return quadgrams;
+
+fail:
+    if ( f != NULL )
+        fclose(f);
+    free(counts);
+    free(quadgrams);
+    return NULL;
+}
+
+/* Each letter's place in the grid, for the places of the ciphertext. */
+static void set_grid(unsigned char *place, const char *key) {
+    for (int i = 0; i < 25; i++)
+        place[letter_place[key[i] - 'A']] = i;
+}
+
+/*
+ * Decrypts the ciphertext with the grid in key and scores it a
+ * quadgram at a time as it goes. This is where nearly all the time
+ * goes, so it only looks things up in tables: the ciphertext's
+ * letters are places in the alphabetical grid, their places in key's
+ * grid are looked up, the digraph table gives the places the pair
+ * decrypts to and key has the letters in them.
+ */
+static double score_grid(const struct solve_job *job, const char *key,
+                         const unsigned char *place) {
+    const float *quadgrams = job->quadgrams;
+    const unsigned char (*digraph_table)[2] = job->digraph_table;
+    double score = 0;
+    int a = 0, b = 0, c = 0, rotation = 0;
+
+    for (size_t j = 0; j < job->n; j += 2) {
+        const unsigned char *digraph =
+            digraph_table[place[job->letters[j]] * 25
+                          + place[job->letters[j + 1]]];
+        int first = key[digraph[0]] - 'A', second = key[digraph[1]] - 'A';
+
+        if ( job->progress ) {
+            first = grid_letters[letter_place[first] + rotation] - 'A';
+            second = grid_letters[letter_place[second] + rotation] - 'A';
+            if ( ++rotation == 25 )
+                rotation = 0;
+        }
+
+        if ( j >= 4 )
+            score += quadgrams[((a * 26 + b) * 26 + c) * 26 + first];
+        if ( j >= 2 )
+            score += quadgrams[((b * 26 + c) * 26 + first) * 26 + second];
+        a = c;
+        b = first;
+        c = second;
+    }
+
+    return score;
+}
+
+/*
+ * Mostly swaps two letters, sometimes two rows or columns or flips
+ * the whole grid over, which the annealing couldn't easily get to a
+ * letter at a time.
+ */
+static void change_grid(char *key, uint64_t *random) {
+    int a = random_below(random, 5), b = random_below(random, 5);
+    char t;
+
+    switch ( random_below(random, 50) ) {
+        case 0: /* swap rows */
+            for (int i = 0; i < 5; i++) {
+                t = key[a * 5 + i];
+                key[a * 5 + i] = key[b * 5 + i];
+                key[b * 5 + i] = t;
+            }
+            break;
+        case 1: /* swap columns */
+            for (int i = 0; i < 5; i++) {
+                t = key[i * 5 + a];
+                key[i * 5 + a] = key[i * 5 + b];
+                key[i * 5 + b] = t;
+            }
+            break;
+        case 2: /* flip top to bottom */
+            for (int i = 0; i < 10; i++) {
+                t = key[i];
+                key[i] = key[(4 - i / 5) * 5 + i % 5];
+                key[(4 - i / 5) * 5 + i % 5] = t;
+            }
+            break;
+        case 3: /* flip left to right */
+            for (int i = 0; i < 5; i++) {
+                for (int j = 0; j < 2; j++) {
+                    t = key[i * 5 + j];
+                    key[i * 5 + j] = key[i * 5 + 4 - j];
+                    key[i * 5 + 4 - j] = t;
+                }
+            }
+            break;
+        default: /* swap two letters */
+            a = random_below(random, 25);
+            b = random_below(random, 25);
+            t = key[a];
+            key[a] = key[b];
+            key[b] = t;
+            break;
+    }
+}
+
+/*
+ * A run of annealing from a random grid, for one thread. With a time
+ * budget the temperature falls from the start to nothing over the
+ * budget rather than by a fixed step.
+ */
+static void solve_job(void *arg, int job_number) {
+    struct solve_job *job = arg;
+    struct playfair_solution *best = &job->solutions[job_number];
+    unsigned char place[25];
+    uint64_t random = 0x9e3779b97f4a7c15ull * (job_number + 1);
+    char key[26], candidate[26];
+    double start_temperature = 10 + 0.087 * ((double) job->n - 84);
+
+    if ( start_temperature < 10 )
+        start_temperature = 10;
+
+    memcpy(key, grid_letters, 25);
+    for (int i = 24; i > 0; i--) {
+        int j = random_below(&random, i + 1);
+        char t = key[i];
+        key[i] = key[j];
+        key[j] = t;
+    }
+    key[25] = '\0';
+
+    set_grid(place, key);
+    double score = score_grid(job, key, place);
+    best->score = score;
+    best->grids_tried = 0;
+    memcpy(best->keyword, key, 26);
+
+    double temperature = start_temperature;
+    for (;;) {
+        if ( job->seconds > 0 ) {
+            double left = job->deadline - now();
+            if ( left <= 0 )
+                break;
+            temperature = start_temperature * left / job->seconds;
+        } else if ( temperature <= 0 ) {
+            break;
+        }
+
+        for (int i = 0; i < GRIDS_PER_STEP; i++) {
+            memcpy(candidate, key, 26);
+            change_grid(candidate, &random);
+            set_grid(place, candidate);
+
+            double candidate_score = score_grid(job, candidate, place);
+            double change = candidate_score - score;
+            if ( change >= 0
+              || random_fraction(&random) < exp(change / temperature) ) {
+                memcpy(key, candidate, 26);
+                score = candidate_score;
+
+                if ( score > best->score ) {
+                    best->score = score;
+                    memcpy(best->keyword, key, 26);
+                }
+            }
+        }
+        best->grids_tried += GRIDS_PER_STEP;
+        temperature -= STEP;
+    }
+}
+
+int playfair_solve(const char *letters, size_t n, int options,
+                   const float *quadgrams, double seconds, struct workers *w,
+                   struct playfair_solution *solution) {
+    struct playfair_ctx alphabetical;
+    struct solve_job job;
+    int njobs = workers_count(w);
+    unsigned char *places;
+
+    /* A left over letter can't be decrypted without its pair. */
+    n &= ~(size_t) 1;
+    if ( n == 0 ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*
+     * In the alphabetical grid a letter's place is where it is, so
+     * its digraph table is the rules for places.
+     */
+    playfair_init(&alphabetical, grid_letters, PLAYFAIR_DECRYPT);
+
+    if ( ( places = malloc(n) ) == NULL )
+        return -1;
+
+    job.progress = options & PLAYFAIR_PROGRESS;
+    for (size_t j = 0; j < n; j++) {
+        places[j] = letter_place[letters[j] - 'A'];
+        /* Each pair moved back by the rotation it was encrypted with. */
+        if ( job.progress )
+            places[j] = (places[j] + 25 - (j / 2) % 25) % 25;
+    }
+
+    job.letters = places;
+    job.n = n;
+    job.digraph_table = (const unsigned char (*)[2]) alphabetical.digraph_table;
+    job.quadgrams = quadgrams;
+    job.seconds = seconds;
+    job.deadline = now() + seconds;
+    job.solutions = calloc(njobs, sizeof(struct playfair_solution));
+    if ( job.solutions == NULL ) {
+        free(places);
+        return -1;
+    }
+
+    workers_run(w, njobs, solve_job, &job);
+
+    long grids_tried = 0;
+    *solution = job.solutions[0];
+    for (int i = 0; i < njobs; i++) {
+        if ( job.solutions[i].score > solution->score )
+            *solution = job.solutions[i];
+        grids_tried += job.solutions[i].grids_tried;
+    }
+    solution->grids_tried = grids_tried;
+
+    free(job.solutions);
+    free(places);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef PLAYFAIR_SOLVE_H
+#define PLAYFAIR_SOLVE_H
+
+#include <stddef.h>
+
+#include "workers.h"
+
+/*
+ * Recovering the Playfair grid from ciphertext alone by simulated
+ * annealing: starting from a random grid, letters are swapped around
+ * and each new grid is kept if the ciphertext decrypted with it reads
+ * more like English, or sometimes, less and less often as it cools,
+ * even if it doesn't. How English text reads is scored with the log
+ * probabilities of each run of four letters, its quadgrams.
+ */
+#define QUADGRAMS (26 * 26 * 26 * 26)
+
+struct playfair_solution {
+    /* The grid's letters row by row, which work as its keyword. */
+    char keyword[26];
+    double score;
+    long grids_tried;
+};
+
+/*
+ * Loads quadgram statistics from path, either a list of quadgrams and
+ * their counts, one "TION 13168375" to a line, or any English text to
+ * count them in. Returns a table of QUADGRAMS log probabilities to
+ * free() afterwards, or NULL with errno set.
+ */
+float *playfair_quadgrams(const char *path);
+
+/*
+ * letters is the ciphertext as upper case letters only. options can
+ * have PLAYFAIR_PROGRESS if the grid progressed as it was encrypted.
+ * Each of w's threads anneals from its own random grid, cooling by a
+ * fixed schedule or, if seconds is more than 0, over that many
+ * seconds.
+ * Returns -1 if there weren't at least two letters or memory ran out.
+ */
+int playfair_solve(const char *letters, size_t n, int options,
+                   const float *quadgrams, double seconds, struct workers *w,
+                   struct playfair_solution *solution);
+
+#endif
@@ -1,14 +1,58 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdint.h>
 #include <getopt.h>
 
+#include "cipher_io.h"
+#include "ciphers.h"
+#include "workers.h"
+#include "batch.h"
+#include "shift_crack.h"
+
 static char *prog_name = "shift";
 static char *prog_version = "1.1";
 static char *invoc_name = NULL;
 static char *author = "a-chap";
 
+static struct io_writer out;
+static struct io_ahead ahead;
+static int async_io = 0;
+static struct workers *workers = NULL;
+static unsigned char *buf = NULL;
+static size_t buf_size = IO_BUFSIZE;
+static const char *out_dir = NULL;
+static int recursive = 0;
+static const struct shift_ctx *batch_key = NULL;
+static struct shift_alphabet alphabet;
+
+/* Size of the pieces of input shared out between the workers. */
+#define JOB_SIZE (1 << 20)
+#define JOBS_PER_WORKER 4
+
+/* The part of the input to encrypt, by default all of it. */
+static unsigned long long range_offset = 0;
+static unsigned long long range_length = ULLONG_MAX;
+
+/*
+ * The checkpoint index: INDEX_MAGIC, the interval and then, for every
+ * interval bytes of the output, how many letters came before, each
+ * as a native 64 bit number. The letters before any offset are then
+ * one pread() of the index and counting less than an interval of the
+ * input rather than all of it.
+ */
+#define INDEX_MAGIC "shiftidx"
+#define INDEX_INTERVAL (1 << 20)
+
+static const char *index_path = NULL;
+static FILE *index_file = NULL;
+static uint64_t index_bytes = 0, index_letters = 0;
+
 static struct option options[] = {
     { "multiplier", required_argument, NULL, 'm'},
     { "shift", required_argument, NULL, 's'},
@@ -20,112 +64,147 @@ static struct option options[] = {
     { "caesar", no_argument, NULL, 'c'},
     { "rot13", no_argument, NULL, 'r'},
     { "decrypt", no_argument, NULL, 'd'},
+    { "kernel", required_argument, NULL, 'K'},
+    { "crack", no_argument, NULL, 'C'},
+    { "brute", no_argument, NULL, 'B'},
+    { "jobs", required_argument, NULL, 'j'},
+    { "in-place", no_argument, NULL, 'i'},
+    { "offset", required_argument, NULL, 'O'},
+    { "length", required_argument, NULL, 'L'},
+    { "index", required_argument, NULL, 'I'},
+    { "stats", no_argument, NULL, 'X'},
+    { "async-io", no_argument, NULL, 'A'},
+    { "alphabet-spec", required_argument, NULL, 'S'},
+    { "output", required_argument, NULL, 'o'},
+    { "recursive", no_argument, NULL, 'W'},
     { "help", no_argument, NULL, 'h'},
     { "version", no_argument, NULL, 'v'},
     { NULL, 0, NULL, 0 }
 };
 
-enum { NONE = 0, DECRYPT = 1, PROGRESS = 2, };
-
 static void print_version();
 static void print_help();
 
-static int *set_shift(int shift);
-static int valid_keyword(char *keyword);
-static void encrypt(FILE *fp, int *keyword, int multiplier, int options);
+static void encrypt(int fd, struct shift_ctx *ctx);
+static void encrypt_in_place(const char *path, struct shift_ctx *ctx);
+static void encrypt_buffer(struct shift_ctx *ctx, unsigned char *dest,
+                           const unsigned char *src, size_t len);
+static void encrypt_parallel(struct shift_ctx *ctx, unsigned char *dest,
+                             const unsigned char *src, size_t len);
+static void crack(char **files, int nfiles, int multiplier, int options);
+static void brute(char **files, int nfiles);
+static void count_file(int fd, long counts[26], unsigned char *preview,
+                       size_t *preview_len);
+static size_t read_letters(int fd, unsigned char **letters, size_t n,
+                           size_t *size);
+static int parse_size(const char *s, unsigned long long *size);
+static void seek(int fd, struct shift_ctx *ctx);
+static void write_index_header(void);
+static void start_stats(const struct shift_key *key);
+static void index_letters_of(const struct shift_key *key,
+                             const unsigned char *buf, size_t len);
+static void encrypt_batch(char **files, int nfiles, struct shift_ctx *ctx,
+                          int stats);
 
 int main(int argc, char **argv) {
+    static struct shift_ctx ctx;
     invoc_name = argv[0];
-    int multiplier = 1;
-    int *keyword = NULL;
-    int cipher_options = NONE;
+    struct shift_options key;
+    int jobs = 0;
+    int in_place = 0;
+    int stats = 0;
+    int ranged = 0;
+    int cracking = 0;
+    int bruting = 0;
+    const char *alphabet_spec = "letters";
     int c;
-    while ((c = getopt_long(argc, argv, "m:s:k:azpbcrdhv", options, NULL)) != -1) {
+
+    /*
+     * The alphabet is found first as what the other options accept
+     * depends on its size, then the options are gone through again.
+     */
+    opterr = 0;
+    while ((c = getopt_long(argc, argv, "m:s:k:azpbcrdj:io:hv", options, NULL)) != -1)
+        if ( c == 'S' )
+            alphabet_spec = optarg;
+    opterr = 1;
+    optind = 0;
+
+    if ( shift_alphabet_init(&alphabet, alphabet_spec) ) {
+        fprintf(stderr, "%s: '%s' isn't an alphabet.\n", invoc_name,
+                        alphabet_spec);
+        fprintf(stderr, "Try '%s --help' for more information.\n",
+                        invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    shift_options_init(&key, &alphabet);
+
+    while ((c = getopt_long(argc, argv, "m:s:k:azpbcrdj:io:hv", options, NULL)) != -1) {
         switch(c) {
-            case 'm':
-                multiplier = atoi(optarg);
-                if ( multiplier <= 2  || multiplier >= 26
-                  || multiplier == 13 || (multiplier & 1) == 0 ) {
-                    fprintf(stderr, "%s: Multiplier needs to be an odd number "
-                                    "between 3 and 25 inclusive (except 13).\n",
-                                    invoc_name);
+            case 'm': case 's': case 'k': case 'a': case 'z':
+            case 'p': case 'b': case 'c': case 'r': case 'd':
+                if ( shift_option(&key, c, optarg) ) {
+                    fprintf(stderr, "%s: %s\n", invoc_name, key.error);
                     fprintf(stderr, "Try '%s --help' for more information.\n",
                                     invoc_name);
                     exit(EXIT_FAILURE);
                 }
                 break;
-            case 's':
-                if ( keyword != NULL ) {
-                    fprintf(stderr, "%s: Only one keyword or shift needed.\n",
-                                    invoc_name);
-                    fprintf(stderr, "Try '%s --help' for more information.\n",
-                                    invoc_name);
-                    exit(EXIT_FAILURE);
-                }
-                keyword = set_shift(atoi(optarg));
-                if ( keyword[0] <= 0 || keyword[0] >= 26 ) {
-                    fprintf(stderr, "%s: The shift needs to be a number between "
-                                    "1 and 25 inclusive.\n", invoc_name);
+            case 'j':
+                jobs = atoi(optarg);
+                if ( jobs < 1 ) {
+                    fprintf(stderr, "%s: The number of jobs needs to be at "
+                                    "least 1.\n", invoc_name);
                     fprintf(stderr, "Try '%s --help' for more information.\n",
                                     invoc_name);
                     exit(EXIT_FAILURE);
                 }
                 break;
-            case 'a': case 'z':
-                if ( keyword != NULL ) {
-                    fprintf(stderr, "%s: Only one keyword needed.\n", invoc_name);
-                    fprintf(stderr, "Try '%s --help' for more information.\n",
-                                    invoc_name);
-                    exit(EXIT_FAILURE);
-                }
-                keyword = calloc(27, sizeof(int));
-                if ( keyword == NULL ) {
-                    perror(invoc_name);
-                    exit(EXIT_FAILURE);
-                }
-                for (int i = 0; i < 26; i++) {
-                    keyword[i] = (c == 'a')? i : 25 - i;
-                }
-                keyword[26] = -1;
+            case 'i':
+                in_place = 1;
                 break;
-            case 'k':
-                if ( keyword != NULL ) {
-                    fprintf(stderr, "%s: Only one keyword needed.\n", invoc_name);
+            case 'C':
+                cracking = 1;
+                break;
+            case 'B':
+                bruting = 1;
+                break;
+            case 'K':
+                if ( shift_set_kernel(optarg) ) {
+                    fprintf(stderr, "%s: Kernel '%s' is unknown or not supported "
+                                    "by this processor.\n", invoc_name, optarg);
                     fprintf(stderr, "Try '%s --help' for more information.\n",
                                     invoc_name);
                     exit(EXIT_FAILURE);
                 }
-                if ( ! valid_keyword(optarg) ) {
-                    fprintf(stderr, "%s: Keyword must only contain letters.\n",
-                                    invoc_name);
+                break;
+            case 'O': case 'L':
+                if ( parse_size(optarg, c == 'O'? &range_offset
+                                                      : &range_length) ) {
+                    fprintf(stderr, "%s: '%s' isn't a number of bytes.\n",
+                                    invoc_name, optarg);
                     fprintf(stderr, "Try '%s --help' for more information.\n",
                                     invoc_name);
                     exit(EXIT_FAILURE);
                 }
-
-                int length = strlen(optarg);
-                keyword = calloc(length + 1, sizeof(int));
-
-                keyword[length] = -1;
-                for (int i = 0; i < length; i++)
-                    keyword[i] = tolower(optarg[i]) - 'a';
-
+                ranged = 1;
                 break;
-            case 'p':
-                cipher_options |= PROGRESS;
+            case 'I':
+                index_path = optarg;
                 break;
-            case 'c':
-                keyword = set_shift(3);
+            case 'X':
+                stats = 1;
                 break;
-            case 'r':
-                keyword = set_shift(13);
+            case 'A':
+                async_io = 1;
                 break;
-            case 'b':
-                multiplier = 25;
-                keyword = set_shift(25);
+            case 'S':
                 break;
-            case 'd':
-                cipher_options |= DECRYPT;
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'W':
+                recursive = 1;
                 break;
             case 'h':
                 print_help();
@@ -143,102 +222,666 @@ int main(int argc, char **argv) {
         }
     }
 
-    if ( keyword == NULL )
-        keyword = set_shift(0);
+    if ( recursive && out_dir == NULL ) {
+        fprintf(stderr, "%s: --recursive needs -o.\n", invoc_name);
+        fprintf(stderr, "Try '%s --help' for more information.\n",
+                        invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Each file of a batch is a job of its own, so use every processor. */
+    if ( jobs == 0 )
+        jobs = out_dir != NULL && !cracking && !bruting?
+               sysconf(_SC_NPROCESSORS_ONLN) : 1;
+
+    if ( ( bruting || cracking ) && !alphabet.letters ) {
+        fprintf(stderr, "%s: --crack and --brute only work on letters.\n",
+                        invoc_name);
+        fprintf(stderr, "Try '%s --help' for more information.\n",
+                        invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( bruting ) {
+        brute(argv + optind, argc - optind);
+        return 0;
+    }
+
+    if ( jobs > 1 || cracking || out_dir != NULL ) {
+        if ( ( workers = workers_start(jobs) ) == NULL ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        buf_size = (size_t) JOBS_PER_WORKER * workers_count(workers) * JOB_SIZE;
+    }
+
+    if ( cracking ) {
+        crack(argv + optind, argc - optind,
+              key.multiplier_given? key.multiplier : 0, key.options);
+        workers_stop(workers);
+        return 0;
+    }
+
+    if ( shift_options_init_ctx(&key, &ctx) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    shift_options_free(&key);
+
+    if ( out_dir != NULL ) {
+        if ( in_place || ranged || index_path != NULL || optind == argc ) {
+            fprintf(stderr, "%s: -o needs FILEs and can't be used with "
+                            "--in-place, --offset, --length or --index.\n",
+                            invoc_name);
+            fprintf(stderr, "Try '%s --help' for more information.\n",
+                            invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        encrypt_batch(argv + optind, argc - optind, &ctx, stats);
+    }
+
+    if ( in_place && optind == argc ) {
+        fprintf(stderr, "%s: Encrypting in place needs FILEs.\n", invoc_name);
+        fprintf(stderr, "Try '%s --help' for more information.\n",
+                        invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( ranged && ( in_place || argc - optind > 1 ) ) {
+        fprintf(stderr, "%s: --offset and --length need a single FILE or "
+                        "stdin.\n", invoc_name);
+        fprintf(stderr, "Try '%s --help' for more information.\n",
+                        invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Without an offset to find, the index is written rather than read. */
+    if ( index_path != NULL && !ranged ) {
+        if ( ( index_file = fopen(index_path, "wb") ) == NULL ) {
+            fprintf(stderr, "%s: ", invoc_name);
+            perror(index_path);
+            exit(EXIT_FAILURE);
+        }
+        write_index_header();
+    }
 
-    if ( optind == argc ) {
-        encrypt(stdin, keyword, multiplier, cipher_options);
+    if ( ( buf = malloc(buf_size) ) == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( stats )
+        start_stats(&ctx.key);
+    io_writer_init(&out, STDOUT_FILENO, invoc_name);
+    io_read_flush(&out);
+    if ( async_io && ( io_writer_async(&out) || io_ahead_init(&ahead, buf_size) ) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( in_place ) {
+        for (int i = optind; i < argc; i++)
+            encrypt_in_place(argv[i], &ctx);
+    } else if ( optind == argc ) {
+        if ( ranged )
+            seek(STDIN_FILENO, &ctx);
+        encrypt(STDIN_FILENO, &ctx);
     } else {
         for (int i = optind; i < argc; i++) {
-            FILE *fp = fopen(argv[i], "r");
-            if ( fp == NULL ) {
+            int fd = io_open(argv[i], 0);
+            if ( fd == -1 ) {
                 fprintf(stderr, "%s: ", invoc_name);
                 perror(argv[i]);
                 continue;
             }
 
-            encrypt(fp, keyword, multiplier, cipher_options);
+            if ( ranged )
+                seek(fd, &ctx);
+            encrypt(fd, &ctx);
 
-            fclose(fp);
+            close(fd);
         }
     }
 
+    io_flush(&out);
+    if ( index_file != NULL && fclose(index_file) == EOF ) {
+        fprintf(stderr, "%s: ", invoc_name);
+        perror(index_path);
+        exit(EXIT_FAILURE);
+    }
+    if ( stats )
+        io_stats_report(invoc_name);
+    shift_free(&ctx);
+
+    if ( workers != NULL )
+        workers_stop(workers);
+
     return 0;
 }
 
-static int valid_keyword(char *keyword) {
-    if ( keyword == NULL || strlen(keyword) == 0 )
-        return 0;
+/*
+ * With -o, each file is started from a copy of the key as given and
+ * its letters counted to start it part way through.
+ */
+static int batch_start(void *state) {
+    return shift_copy(state, batch_key);
+}
+
+static size_t batch_update(void *state, unsigned char *out,
+                           const unsigned char *in, size_t len) {
+    if ( shift_update(state, out, in, len) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    return len;
+}
+
+static void batch_end(void *state) {
+    shift_free(state);
+}
+
+static unsigned long long batch_count(const unsigned char *in, size_t len) {
+    return shift_count(&batch_key->key, in, len);
+}
+
+static void batch_skip(void *state, unsigned long long letters) {
+    shift_skip(state, letters);
+}
+
+static void encrypt_batch(char **files, int nfiles, struct shift_ctx *ctx,
+                          int stats) {
+    static const struct batch_cipher cipher = {
+        sizeof(struct shift_ctx), batch_start, batch_update, NULL, batch_end,
+        1, 0, batch_count, batch_skip,
+    };
+
+    batch_key = ctx;
+    if ( stats )
+        start_stats(&ctx->key);
+    int failures = batch_run(&cipher, files, nfiles, out_dir, recursive,
+                             workers, invoc_name);
+    if ( stats )
+        io_stats_report(invoc_name);
+    exit(failures > 0? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/* --stats counts what is in the alphabet as transformed. */
+static void start_stats(const struct shift_key *key) {
+    if ( key->alphabet.letters ) {
+        io_stats_start(IO_STATS_LETTERS);
+    } else {
+        io_stats.member = key->letter;
+        io_stats_start(IO_STATS_MEMBERS);
+    }
+}
+
+/*
+ * Regular files are mapped and encrypted straight from the mapping
+ * into the output buffer, anything else is read a buffer at a time.
+ * With --async-io everything is read ahead instead, and encrypted
+ * where it was read into.
+ */
+static void encrypt(int fd, struct shift_ctx *ctx) {
+    unsigned long long left = range_length;
+    unsigned char *data;
+    struct io_map map;
+    ssize_t n = 0;
+
+    if ( async_io ) {
+        io_ahead_start(&ahead, fd, left);
+        while ( ( n = io_ahead_next(&ahead, &data) ) > 0 ) {
+            encrypt_buffer(ctx, data, data, n);
+            io_write(&out, data, n);
+        }
+        io_ahead_stop(&ahead);
+    } else if ( io_map(fd, 0, &map) == 0 ) {
+        if ( map.len > left )
+            map.len = left;
+        for (size_t done = 0; done < map.len; done += n) {
+            n = map.len - done < buf_size? map.len - done : buf_size;
+            encrypt_buffer(ctx, buf, map.data + done, n);
+            io_write(&out, buf, n);
+        }
+        io_unmap(&map);
+        return;
+    } else {
+        while ( left > 0
+             && ( n = io_read(fd, buf, left < buf_size? left : buf_size) ) > 0 ) {
+            encrypt_buffer(ctx, buf, buf, n);
+            io_write(&out, buf, n);
+            left -= n;
+        }
+    }
+
+    if ( n == -1 )
+        perror(invoc_name);
+}
+
+/*
+ * Moves fd on to the offset and the keyword on past the letters
+ * before it. They are counted from the start of the input or, with
+ * an index, from the last checkpoint before the offset.
+ */
+static void seek(int fd, struct shift_ctx *ctx) {
+    unsigned long long from = 0, letters = 0, left;
+    unsigned char header[16];
+    uint64_t interval, count;
+    ssize_t n = 0;
+
+    if ( index_path != NULL ) {
+        int index = io_open(index_path, 0);
+        if ( index == -1 ) {
+            fprintf(stderr, "%s: ", invoc_name);
+            perror(index_path);
+            exit(EXIT_FAILURE);
+        }
+        if ( pread(index, header, sizeof(header), 0) != sizeof(header)
+          || memcmp(header, INDEX_MAGIC, 8) != 0 ) {
+            fprintf(stderr, "%s: %s: Not a shift index.\n", invoc_name,
+                            index_path);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(&interval, header + 8, sizeof(interval));
+
+        /* Past the end of the input there is nothing to decrypt anyway. */
+        off_t size = lseek(index, 0, SEEK_END);
+        uint64_t checkpoint = interval? range_offset / interval : 0;
+        if ( size > (off_t) sizeof(header)
+          && checkpoint > (size - sizeof(header)) / sizeof(count) )
+            checkpoint = (size - sizeof(header)) / sizeof(count);
+
+        if ( checkpoint > 0 ) {
+            if ( pread(index, &count, sizeof(count), sizeof(header)
+                         + (checkpoint - 1) * sizeof(count)) != sizeof(count) ) {
+                fprintf(stderr, "%s: ", invoc_name);
+                perror(index_path);
+                exit(EXIT_FAILURE);
+            }
+            from = checkpoint * interval;
+            letters = count;
+        }
+        close(index);
+    }
+
+    if ( io_skip(fd, from) == -1 ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    for (left = range_offset - from; left > 0; left -= n) {
+        n = io_read(fd, buf, left < buf_size? left : buf_size);
+        if ( n <= 0 )
+            break;
+        letters += shift_count(&ctx->key, buf, n);
+    }
+    if ( n == -1 ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    shift_skip(ctx, letters);
+}
+
+static void write_index_header(void) {
+    uint64_t interval = INDEX_INTERVAL;
+
+    fwrite(INDEX_MAGIC, 1, 8, index_file);
+    fwrite(&interval, sizeof(interval), 1, index_file);
+}
+
+/* Adds a checkpoint to the index at every interval buf crosses. */
+static void index_letters_of(const struct shift_key *key,
+                             const unsigned char *buf, size_t len) {
+    while ( len > 0 ) {
+        size_t n = INDEX_INTERVAL - index_bytes % INDEX_INTERVAL;
+        if ( n > len )
+            n = len;
+
+        index_letters += shift_count(key, buf, n);
+        index_bytes += n;
+        buf += n;
+        len -= n;
+
+        if ( index_bytes % INDEX_INTERVAL == 0 )
+            fwrite(&index_letters, sizeof(index_letters), 1, index_file);
+    }
+}
+
+/* A number of bytes, which has to be all digits. */
+static int parse_size(const char *s, unsigned long long *size) {
+    char *end;
+
+    errno = 0;
+    *size = strtoull(s, &end, 10);
+    if ( *s < '0' || *s > '9' || *end != '\0' || errno == ERANGE )
+        return -1;
+    return 0;
+}
+
+static void encrypt_in_place(const char *path, struct shift_ctx *ctx) {
+    struct io_map map;
+    int fd = io_open(path, 1);
+
+    if ( fd == -1 || io_map(fd, 1, &map) == -1 ) {
+        fprintf(stderr, "%s: ", invoc_name);
+        perror(path);
+        if ( fd != -1 )
+            close(fd);
+        return;
+    }
 
-    for (int i = 0; i < strlen(keyword); i++)
-        if ( !isalpha(keyword[i]) )
-            return 0;
+    encrypt_buffer(ctx, map.data, map.data, map.len);
 
-    return 1;
+    io_unmap(&map);
+    close(fd);
 }
 
-static int *set_shift(int shift) {
-    int *keyword = calloc(2,sizeof(int));
-    if ( keyword == NULL ) {
+static void encrypt_buffer(struct shift_ctx *ctx, unsigned char *dest,
+                           const unsigned char *src, size_t len) {
+    if ( io_stats.enabled )
+        io_stats_count(src, len);
+    if ( index_file != NULL )
+        index_letters_of(&ctx->key, src, len);
+
+    if ( workers != NULL ) {
+        encrypt_parallel(ctx, dest, src, len);
+    } else if ( shift_update(ctx, dest, src, len) ) {
         perror(invoc_name);
         exit(EXIT_FAILURE);
     }
-    keyword[0] = shift;
-    keyword[1] = -1;
-    return keyword;
 }
 
-static void encrypt(FILE *fp, int *keyword, int multiplier, int options) {
-    static int i = 0;
-    int decrypt = options & DECRYPT;
-    int progress_keyword = options & PROGRESS;
-    int first_letter;
-    int c;
+struct shift_job {
+    const struct shift_key *key;
+    unsigned char *dest;
+    const unsigned char *src;
+    size_t len;
+    size_t letters;
+    int *keyword;   /* the keyword as it is at the start of src */
+    int index;
+    int failed;
+};
 
-    if ( decrypt && multiplier != 1) {
-        /* Can't divide with modular arithmetic,
-         * the inverse of multiplication is multiplication
-         * a a^{-1} = 1 (mod 26)
-         * When solved gives the inverse a^{-1} of multiplication
-         * by a.
-         */
-        int inverse_multipliers[26] = {
-             [3]  =  9, [5]  = 21, [7]  = 15, [9]  =  3,
-             [11] = 19, [15] =  7, [17] = 23, [19] = 11,
-             [21] =  5, [23] = 17, [25] = 25,
-        };
-        multiplier = inverse_multipliers[multiplier];
-    }
-
-    while ( ( c = fgetc(fp) ) != EOF ) {
-        if ( isalpha(c) ) {
-            /* retain this so can restore case after encryption */
-            first_letter = islower(c)? 'a' : 'A';
-            c -= first_letter;
-
-            if ( decrypt ) {
-                c += 26 - keyword[i];
-                c *= multiplier;
-            } else {
-                c *= multiplier;
-                c += keyword[i];
-            }
+static void count_job(void *arg, int n) {
+    struct shift_job *job = (struct shift_job *) arg + n;
+    job->letters = shift_count(job->key, job->src, job->len);
+}
+
+static void encrypt_job(void *arg, int n) {
+    struct shift_job *job = (struct shift_job *) arg + n;
+    job->failed = shift_apply(job->key, job->keyword, &job->index,
+                              job->dest, job->src, job->len);
+}
+
+/*
+ * Splits the buffer into pieces and, as the key for any letter
+ * only depends on how many letters came before it, counts the
+ * letters in every piece first so that each one can be started
+ * from the right place in the keyword and encrypted on its own.
+ */
+static void encrypt_parallel(struct shift_ctx *ctx, unsigned char *dest,
+                             const unsigned char *src, size_t len) {
+    const struct shift_key *key = &ctx->key;
+    int *keyword = ctx->keyword;
+    static struct shift_job *jobs = NULL;
+    static int *keywords = NULL;
+    int max_jobs = JOBS_PER_WORKER * workers_count(workers);
+    int length = 0;
+
+    while ( keyword[length] != -1 )
+        length++;
+
+    if ( jobs == NULL ) {
+        jobs = calloc(max_jobs, sizeof(*jobs));
+        keywords = calloc((size_t) max_jobs * (length + 1), sizeof(int));
+        if ( jobs == NULL || keywords == NULL ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* A single shift that never changes doesn't need the letters counted. */
+    int need_count = length > 1 || ( key->options & SHIFT_PROGRESS );
+
+    while ( len > 0 ) {
+        size_t letters = 0;
+        int njobs = 0;
 
-            c %= 26;
-            c += first_letter; /* revert to character */
+        while ( len > 0 && njobs < max_jobs ) {
+            struct shift_job *job = &jobs[njobs];
+            job->key = key;
+            job->dest = dest;
+            job->src = src;
+            job->len = len < JOB_SIZE? len : JOB_SIZE;
+            job->letters = 0;
+            job->keyword = keywords + (size_t) njobs * (length + 1);
 
-            if ( progress_keyword ) {
-                keyword[i]++;
-                keyword[i] %= 26;
+            dest += job->len;
+            src += job->len;
+            len -= job->len;
+            njobs++;
+        }
+
+        if ( need_count )
+            workers_run(workers, njobs, count_job, jobs);
+
+        for (int j = 0; j < njobs; j++) {
+            memcpy(jobs[j].keyword, keyword, (length + 1) * sizeof(int));
+            jobs[j].index = ctx->index;
+            shift_advance(key, jobs[j].keyword, &jobs[j].index, letters);
+            letters += jobs[j].letters;
+        }
+
+        workers_run(workers, njobs, encrypt_job, jobs);
+
+        for (int j = 0; j < njobs; j++) {
+            if ( jobs[j].failed ) {
+                perror(invoc_name);
+                exit(EXIT_FAILURE);
             }
+        }
+
+        shift_advance(key, keyword, &ctx->index, letters);
+    }
+}
+
+/*
+ * Reads the letters of all of the input and prints the keyword it
+ * was most likely encrypted with, and how to decrypt with it. The
+ * keyword carries on from one file to the next as when encrypting.
+ */
+static void crack(char **files, int nfiles, int multiplier, int options) {
+    unsigned char *letters = NULL;
+    size_t n = 0, size = 0;
+    struct crack_result result;
+
+    if ( nfiles == 0 )
+        n = read_letters(STDIN_FILENO, &letters, n, &size);
+
+    for (int i = 0; i < nfiles; i++) {
+        int fd = io_open(files[i], 0);
+        if ( fd == -1 ) {
+            fprintf(stderr, "%s: ", invoc_name);
+            perror(files[i]);
+            continue;
+        }
+
+        n = read_letters(fd, &letters, n, &size);
+
+        close(fd);
+    }
+
+    if ( n == 0 ) {
+        fprintf(stderr, "%s: There are no letters to crack.\n", invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( shift_crack(letters, n, multiplier, options, workers, &result) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    free(letters);
+
+    printf("key length: %d\n", result.length);
+    printf("multiplier: %d\n", result.multiplier);
+    printf("keyword: ");
+    for (int i = 0; i < result.length; i++)
+        putchar('a' + result.keyword[i]);
+    printf("\n");
+    printf("index of coincidence: %.4f\n", result.ioc);
+    printf("chi-squared: %.1f\n", result.chi_squared / result.length);
+
+    printf("decrypt with: %s -d", invoc_name);
+    if ( result.multiplier != 1 )
+        printf(" -m %d", result.multiplier);
+    printf(" -k ");
+    for (int i = 0; i < result.length; i++)
+        putchar('a' + result.keyword[i]);
+    printf("%s\n", (options & SHIFT_PROGRESS)? " -p" : "");
+}
+
+/* How much of the start of the input --brute decrypts to show. */
+#define PREVIEW_SIZE 60
 
-            i++;
-            if ( keyword[i] == -1 )
-                i = 0;
+/*
+ * Counts the letters of all of the input in one go and, as every
+ * multiplier and shift just moves the counts around, scores each of
+ * them from the counts alone. They are listed best first with the
+ * start of the input decrypted with them.
+ */
+static void brute(char **files, int nfiles) {
+    static struct brute_candidate candidates[BRUTE_CANDIDATES];
+    unsigned char preview[PREVIEW_SIZE];
+    size_t preview_len = 0;
+    long counts[26] = { 0 }, total = 0;
+
+    if ( ( buf = malloc(buf_size) ) == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( nfiles == 0 )
+        count_file(STDIN_FILENO, counts, preview, &preview_len);
+
+    for (int i = 0; i < nfiles; i++) {
+        int fd = io_open(files[i], 0);
+        if ( fd == -1 ) {
+            fprintf(stderr, "%s: ", invoc_name);
+            perror(files[i]);
+            continue;
         }
 
-        printf("%c", c);
+        count_file(fd, counts, preview, &preview_len);
+
+        close(fd);
     }
+
+    for (int c = 0; c < 26; c++)
+        total += counts[c];
+    if ( total == 0 ) {
+        fprintf(stderr, "%s: There are no letters to decrypt.\n", invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t j = 0; j < preview_len; j++)
+        if ( !isprint(preview[j]) )
+            preview[j] = ' ';
+
+    shift_brute(counts, candidates);
+
+    for (int i = 0; i < BRUTE_CANDIDATES; i++) {
+        const struct brute_candidate *candidate = &candidates[i];
+        unsigned char decrypted[PREVIEW_SIZE];
+        int keyword[2] = { candidate->shift, -1 };
+        struct shift_ctx ctx;
+        char options[32] = "-d";
+
+        if ( shift_init(&ctx, keyword, candidate->multiplier, SHIFT_DECRYPT)
+          || shift_update(&ctx, decrypted, preview, preview_len) ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        shift_free(&ctx);
+
+        /* -m 1 and -s 0 aren't accepted, as they are the defaults. */
+        if ( candidate->multiplier != 1 )
+            sprintf(options + strlen(options), " -m %d", candidate->multiplier);
+        if ( candidate->shift != 0 )
+            sprintf(options + strlen(options), " -s %d", candidate->shift);
+
+        printf("%3d %10.2f  %-16s %.*s\n", i + 1, candidate->chi_squared,
+               options, (int) preview_len, decrypted);
+    }
+
+    free(buf);
+}
+
+/*
+ * Adds the letters of fd to counts, and keeps the first of it in
+ * preview until that is full.
+ */
+static void count_file(int fd, long counts[26], unsigned char *preview,
+                       size_t *preview_len) {
+    struct io_map map;
+    ssize_t n;
+
+    if ( io_map(fd, 0, &map) == 0 ) {
+        n = map.len < PREVIEW_SIZE - *preview_len?
+            map.len : PREVIEW_SIZE - *preview_len;
+        memcpy(preview + *preview_len, map.data, n);
+        *preview_len += n;
+        brute_count_letters(map.data, map.len, counts);
+        io_unmap(&map);
+        return;
+    }
+
+    while ( ( n = io_read(fd, buf, buf_size) ) > 0 ) {
+        size_t keep = n < PREVIEW_SIZE - *preview_len?
+                      n : PREVIEW_SIZE - *preview_len;
+        memcpy(preview + *preview_len, buf, keep);
+        *preview_len += keep;
+        brute_count_letters(buf, n, counts);
+    }
+
+    if ( n == -1 )
+        perror(invoc_name);
+}
+
+/* Adds the letters of fd to letters, which has n of size so far. */
+static size_t read_letters(int fd, unsigned char **letters, size_t n,
+                           size_t *size) {
+    struct io_map map;
+    ssize_t got;
+
+    if ( io_map(fd, 0, &map) == 0 ) {
+        if ( n + map.len > *size ) {
+            *size = n + map.len;
+            if ( ( *letters = realloc(*letters, *size) ) == NULL ) {
+                perror(invoc_name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        n += crack_letters(*letters + n, map.data, map.len);
+        io_unmap(&map);
+        return n;
+    }
+
+    for (;;) {
+        if ( n + buf_size > *size ) {
+            *size = 2 * *size + buf_size;
+            if ( ( *letters = realloc(*letters, *size) ) == NULL ) {
+                perror(invoc_name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if ( ( got = io_read(fd, *letters + n, buf_size) ) <= 0 )
+            break;
+        n += crack_letters(*letters + n, *letters + n, got);
+    }
+
+    if ( got == -1 )
+        perror(invoc_name);
+
+    return n;
 }
 
 static void print_version() {
@@ -270,6 +913,45 @@ static void print_help() {
            "    -r, --rot13     use a shift of 13 letters.\n"
            "    -b, --atbash    use atbash cipher -- swap a with z, b with y etc.\n"
            "    -d, --decrypt   decrypt cipher text.\n"
+           "        --alphabet-spec SPEC  work on the characters of SPEC\n"
+           "                    rather than letters: alnum, printable or\n"
+           "                    chars: followed by the characters in order.\n"
+           "                    Shifts, keywords and multipliers are then\n"
+           "                    modulo its size.\n"
+           "    -j, --jobs N    encrypt large inputs with N threads.\n"
+           "    -i, --in-place  encrypt the FILEs themselves rather than\n"
+           "                    writing to standard output.\n"
+           "    -o, --output DIR  encrypt each FILE on its own, from the\n"
+           "                      start of the keyword, into a file of the\n"
+           "                      same name in DIR, all at once using -j\n"
+           "                      threads, by default one per processor.\n"
+           "        --recursive  with -o, encrypt the files in any\n"
+           "                     directories given too, recreating them\n"
+           "                     under DIR.\n"
+           "        --offset N  start N bytes into the input, with the\n"
+           "                    keyword where it would be there.\n"
+           "        --length N  encrypt at most N bytes of the input.\n"
+           "        --index FILE  write a checkpoint index of the output\n"
+           "                      to FILE, or with --offset, use one to\n"
+           "                      find the keyword quickly.\n"
+           "        --crack     rather than encrypting, find the keyword the\n"
+           "                    input was encrypted with. Give -m if it is\n"
+           "                    known, otherwise every multiplier is tried,\n"
+           "                    -p if the keyword progressed and -j to use\n"
+           "                    more threads.\n"
+           "        --brute     rather than encrypting, decrypt the start of\n"
+           "                    the input with every multiplier and shift\n"
+           "                    and list them, the most English first.\n"
+           "        --kernel NAME  encrypt with the named kernel: fixed, avx2,\n"
+           "                       ssse3, table or scalar. Defaults to the\n"
+           "                       fastest one the processor supports. fixed\n"
+           "                       is avx2 but using a kernel built for the\n"
+           "                       key when there is one.\n"
+           "        --stats     report what was read, written and transformed\n"
+           "                    and how long it took to standard error.\n"
+           "        --async-io  read ahead and write behind in the background,\n"
+           "                    using io_uring where the kernel has it, so\n"
+           "                    reading, encrypting and writing all overlap.\n"
            "    -h, --help      display this help and exit.\n"
            "    -v, --version   display version information and exit.\n",
            invoc_name);
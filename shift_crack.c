@@ -0,0 +1,448 @@
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+
+#include "shift_kernel.h"
+#include "shift_crack.h"
+
+/*
+ * Kasiski's spacings are only looked for in this many letters, and
+ * the lengths are told apart with this many, which is plenty. Only
+ * the length picked has all of the letters counted.
+ */
+#define KASISKI_LETTERS (1 << 16)
+#define SAMPLE_LETTERS (1 << 18)
+
+const int crack_multipliers[12] = {
+    1, 3, 5, 7, 9, 11, 15, 17, 19, 21, 23, 25,
+};
+
+/* Percentages of each letter in English text. */
+static const double english_frequencies[26] = {
+    8.167, 1.492, 2.782, 4.253, 12.702, 2.228, 2.015, 6.094, 6.966,
+    0.153, 0.772, 4.025, 2.406, 6.749, 7.507, 1.929, 0.095, 5.987,
+    6.327, 9.056, 2.758, 0.978, 2.360, 0.150, 1.974, 0.074,
+};
+
+/*
+ * Everything found out about one keyword length. The columns are
+ * the letters encrypted with each letter of the keyword.
+ */
+struct length_score {
+    int length;
+    long *counts;           /* length rows of 26 */
+    double ioc;
+    double chi_squared;
+    int multiplier;
+    int keyword[CRACK_MAX_LENGTH + 1];
+};
+
+struct crack_job {
+    const unsigned char *letters;
+    size_t n;
+    size_t sample;
+    int multiplier;
+    int progress;
+    int max_length;
+    struct length_score *scores;
+    long *kasiski;
+};
+
+/* Each letter's value plus one, so everything else is 0. */
+static const unsigned char letter[256] = {
+#define L(c) [c] = c - 'A' + 1, [c + 32] = c - 'A' + 1
+    L('A'), L('B'), L('C'), L('D'), L('E'), L('F'), L('G'), L('H'),
+    L('I'), L('J'), L('K'), L('L'), L('M'), L('N'), L('O'), L('P'),
+    L('Q'), L('R'), L('S'), L('T'), L('U'), L('V'), L('W'), L('X'),
+    L('Y'), L('Z'),
+#undef L
+};
+
+size_t crack_letters(unsigned char *dest, const unsigned char *src, size_t len) {
+    size_t n = 0;
+
+    /* Written every time but only kept, by moving on, for letters. */
+    for (size_t j = 0; j < len; j++) {
+        int c = letter[src[j]];
+        dest[n] = c - 1;
+        n += c != 0;
+    }
+
+    return n;
+}
+
+/*
+ * Counts into four tables in turn so runs of the same letter don't
+ * each wait for the last one's count to be stored.
+ */
+void brute_count_letters(const unsigned char *buf, size_t len,
+                         long counts[26]) {
+    uint32_t tables[4][27] = { { 0 } };
+    size_t j = 0;
+
+    for (; j + 4 <= len; j += 4) {
+        tables[0][letter[buf[j]]]++;
+        tables[1][letter[buf[j + 1]]]++;
+        tables[2][letter[buf[j + 2]]]++;
+        tables[3][letter[buf[j + 3]]]++;
+    }
+    for (; j < len; j++)
+        tables[0][letter[buf[j]]]++;
+
+    for (int c = 0; c < 26; c++)
+        counts[c] += (long) tables[0][c + 1] + tables[1][c + 1]
+                   + tables[2][c + 1] + tables[3][c + 1];
+}
+
+static int compare_candidates(const void *a, const void *b) {
+    const struct brute_candidate *x = a, *y = b;
+
+    if ( x->chi_squared != y->chi_squared )
+        return x->chi_squared < y->chi_squared? -1 : 1;
+    if ( x->multiplier != y->multiplier )
+        return x->multiplier - y->multiplier;
+    return x->shift - y->shift;
+}
+
+/*
+ * Decrypting with a multiplier and shift only moves the letters, so
+ * each candidate's plaintext counts are the ciphertext counts moved
+ * the same way.
+ */
+void shift_brute(const long counts[26],
+                 struct brute_candidate candidates[BRUTE_CANDIDATES]) {
+    long total = 0;
+
+    for (int c = 0; c < 26; c++)
+        total += counts[c];
+
+    for (int m = 0; m < 12; m++) {
+        for (int k = 0; k < 26; k++) {
+            struct brute_candidate *candidate = &candidates[m * 26 + k];
+            long plain[26];
+
+            for (int p = 0; p < 26; p++)
+                plain[p] = counts[(p * crack_multipliers[m] + k) % 26];
+
+            candidate->multiplier = crack_multipliers[m];
+            candidate->shift = k;
+            candidate->chi_squared = english_chi_squared(plain, total);
+        }
+    }
+
+    qsort(candidates, BRUTE_CANDIDATES, sizeof(candidates[0]),
+          compare_candidates);
+}
+
+double english_chi_squared(const long counts[26], long total) {
+    double chi_squared = 0;
+
+    for (int p = 0; p < 26; p++) {
+        double expected = total * english_frequencies[p] / 100;
+        double difference = counts[p] - expected;
+        chi_squared += difference * difference / expected;
+    }
+
+    return chi_squared;
+}
+
+/*
+ * A piece of the letters for counting the columns of the length
+ * picked, each piece into its own counts.
+ */
+struct count_job {
+    const struct crack_job *crack;
+    int length;
+    size_t piece;
+    long *counts;
+};
+
+/*
+ * Counts the letters in each column, for letters starting at the
+ * start'th. With a progressing keyword each time round the keyword
+ * shifts the letters on by one more, so that is taken back off first.
+ */
+static void count_columns(const unsigned char *letters, size_t n, size_t start,
+                          int length, int progressing, long *counts) {
+    int column = start % length;
+    int progress = progressing? (start / length) % 26 : 0;
+
+    for (size_t j = 0; j < n; j++) {
+        int c = letters[j] - progress;
+        if ( c < 0 )
+            c += 26;
+        counts[column * 26 + c]++;
+
+        if ( ++column == length ) {
+            column = 0;
+            if ( progressing && ++progress == 26 )
+                progress = 0;
+        }
+    }
+}
+
+static double index_of_coincidence(const long counts[26]) {
+    long total = 0, pairs = 0;
+
+    for (int c = 0; c < 26; c++) {
+        total += counts[c];
+        pairs += counts[c] * (counts[c] - 1);
+    }
+
+    return total > 1? (double) pairs / ((double) total * (total - 1)) : 0;
+}
+
+/*
+ * Finds the multiplier and shift for each column that make the
+ * columns most like English. The multiplier is the same for every
+ * column, so it is the one with the lowest total.
+ */
+static void score_columns(const struct crack_job *job, struct length_score *s) {
+    s->chi_squared = DBL_MAX;
+
+    for (int m = 0; m < 12; m++) {
+        int multiplier = crack_multipliers[m];
+        int keyword[CRACK_MAX_LENGTH];
+        double total = 0;
+
+        if ( job->multiplier && multiplier != job->multiplier )
+            continue;
+
+        for (int column = 0; column < s->length; column++) {
+            const long *counts = s->counts + column * 26;
+            double best = DBL_MAX;
+            long letters = 0;
+
+            for (int c = 0; c < 26; c++)
+                letters += counts[c];
+
+            for (int k = 0; k < 26; k++) {
+                long plain[26];
+                for (int p = 0; p < 26; p++)
+                    plain[p] = counts[(p * multiplier + k) % 26];
+
+                double chi_squared = english_chi_squared(plain, letters);
+                if ( chi_squared < best ) {
+                    best = chi_squared;
+                    keyword[column] = k;
+                }
+            }
+            total += best;
+        }
+
+        if ( total < s->chi_squared ) {
+            s->chi_squared = total;
+            s->multiplier = multiplier;
+            memcpy(s->keyword, keyword, s->length * sizeof(int));
+            s->keyword[s->length] = -1;
+        }
+    }
+}
+
+/*
+ * Kasiski's test: repeated runs of three letters in the ciphertext
+ * are mostly the same plaintext encrypted with the same part of the
+ * keyword, so the distances between them tend to be multiples of
+ * its length.
+ */
+static void count_kasiski(const struct crack_job *job) {
+    size_t n = job->n < KASISKI_LETTERS? job->n : KASISKI_LETTERS;
+    const unsigned char *letters = job->letters;
+    long *kasiski = job->kasiski;
+    int *last = malloc(26 * 26 * 26 * sizeof(int));
+
+    if ( last == NULL )
+        return;
+    memset(last, -1, 26 * 26 * 26 * sizeof(int));
+
+    for (size_t j = 0; j + 2 < n; j++) {
+        int trigram = (letters[j] * 26 + letters[j + 1]) * 26 + letters[j + 2];
+        if ( last[trigram] != -1 ) {
+            int distance = j - last[trigram];
+            for (int length = 1; length <= job->max_length; length++)
+                kasiski[length] += distance % length == 0;
+        }
+        last[trigram] = j;
+    }
+
+    free(last);
+}
+
+static void count_job(void *arg, int job_number) {
+    struct count_job *job = arg;
+    const struct crack_job *crack = job->crack;
+    size_t start = job_number * job->piece;
+    size_t n = crack->n - start < job->piece? crack->n - start : job->piece;
+
+    count_columns(crack->letters + start, n, start, job->length,
+                  crack->progress, job->counts + job_number * job->length * 26);
+}
+
+/*
+ * Counts all of the letters into the length's columns and scores
+ * them again, the letters split into a piece for each thread.
+ */
+static int count_all(struct workers *w, const struct crack_job *crack,
+                     struct length_score *s) {
+    struct count_job job;
+    int njobs = workers_count(w);
+
+    job.crack = crack;
+    job.length = s->length;
+    job.piece = (crack->n + njobs - 1) / njobs;
+    job.counts = calloc((size_t) njobs * s->length * 26, sizeof(long));
+    if ( job.counts == NULL )
+        return -1;
+
+    workers_run(w, njobs, count_job, &job);
+
+    memset(s->counts, 0, s->length * 26 * sizeof(long));
+    for (int i = 0; i < njobs; i++)
+        for (int c = 0; c < s->length * 26; c++)
+            s->counts[c] += job.counts[i * s->length * 26 + c];
+    free(job.counts);
+
+    s->ioc = 0;
+    for (int column = 0; column < s->length; column++)
+        s->ioc += index_of_coincidence(s->counts + column * 26);
+    s->ioc /= s->length;
+
+    score_columns(crack, s);
+    return 0;
+}
+
+/* A job for each length, and one more for Kasiski's test. */
+static void crack_job(void *arg, int job_number) {
+    struct crack_job *job = arg;
+
+    if ( job_number == job->max_length ) {
+        if ( !job->progress )
+            count_kasiski(job);
+        return;
+    }
+
+    struct length_score *s = &job->scores[job_number];
+    count_columns(job->letters, job->sample, 0, s->length, job->progress,
+                  s->counts);
+
+    s->ioc = 0;
+    for (int column = 0; column < s->length; column++)
+        s->ioc += index_of_coincidence(s->counts + column * 26);
+    s->ioc /= s->length;
+
+    score_columns(job, s);
+}
+
+/*
+ * The index of coincidence of English is about 0.066 against 0.038
+ * for random letters, and it is as high for any multiple of the
+ * keyword's length as for the length itself, so the length is the
+ * shortest whose columns are nearly as English as the best. When
+ * there are too few letters for the columns to stand out, it is the
+ * length most of Kasiski's repeats are a multiple of instead, counted
+ * against how many would be by chance.
+ */
+static int pick_length(const struct crack_job *job) {
+    const double random = 1.0 / 26;
+    double best = 0, best_kasiski = 0;
+    int kasiski_length = -1;
+
+    for (int i = 0; i < job->max_length; i++)
+        if ( job->scores[i].ioc - random > best )
+            best = job->scores[i].ioc - random;
+
+    if ( best < 0.01 ) {
+        for (int i = 1; i < job->max_length; i++) {
+            double kasiski = (double) job->kasiski[i + 1] * (i + 1);
+            if ( kasiski > 1.5 * job->kasiski[1] && kasiski > best_kasiski ) {
+                best_kasiski = kasiski;
+                kasiski_length = i;
+            }
+        }
+        if ( kasiski_length != -1 )
+            return kasiski_length;
+    }
+
+    for (int i = 0; i < job->max_length; i++)
+        if ( job->scores[i].ioc - random >= 0.8 * best )
+            return i;
+
+    return 0;
+}
+
+/*
+ * With few letters the columns of a multiple of the length can look
+ * the more English by chance. The keyword found for it then just
+ * repeats the one for the length, so the shortest length whose own
+ * keyword it repeats is taken instead.
+ */
+static int shortest_repeat(const struct crack_job *job, int i) {
+    const struct length_score *s = &job->scores[i];
+
+    for (int d = 1; d < s->length; d++) {
+        const struct length_score *shorter = &job->scores[d - 1];
+        int repeats = s->length % d == 0
+                   && shorter->multiplier == s->multiplier;
+
+        for (int k = 0; repeats && k < s->length; k++)
+            repeats = s->keyword[k] == shorter->keyword[k % d];
+        if ( repeats )
+            return d - 1;
+    }
+
+    return i;
+}
+
+int shift_crack(const unsigned char *letters, size_t n, int multiplier,
+                int options, struct workers *w, struct crack_result *result) {
+    struct crack_job job;
+    int ret = -1;
+
+    if ( n == 0 )
+        return -1;
+
+    /* Leave enough letters in each column to tell English apart. */
+    job.max_length = n / 10 < CRACK_MAX_LENGTH? n / 10 : CRACK_MAX_LENGTH;
+    if ( job.max_length < 1 )
+        job.max_length = 1;
+
+    job.letters = letters;
+    job.n = n;
+    job.sample = n < SAMPLE_LETTERS? n : SAMPLE_LETTERS;
+    job.multiplier = multiplier;
+    job.progress = options & SHIFT_PROGRESS;
+    job.scores = calloc(job.max_length, sizeof(struct length_score));
+    job.kasiski = calloc(job.max_length + 1, sizeof(long));
+    if ( job.scores == NULL || job.kasiski == NULL )
+        goto out;
+
+    for (int i = 0; i < job.max_length; i++) {
+        job.scores[i].length = i + 1;
+        job.scores[i].counts = calloc((i + 1) * 26, sizeof(long));
+        if ( job.scores[i].counts == NULL )
+            goto out;
+    }
+
+    workers_run(w, job.max_length + 1, crack_job, &job);
+
+    struct length_score *s = &job.scores[shortest_repeat(&job,
+                                                         pick_length(&job))];
+    if ( n > job.sample && count_all(w, &job, s) )
+        goto out;
+    result->length = s->length;
+    result->multiplier = s->multiplier;
+    memcpy(result->keyword, s->keyword, (s->length + 1) * sizeof(int));
+    result->ioc = s->ioc;
+    result->chi_squared = s->chi_squared;
+    result->kasiski = job.kasiski[s->length];
+    ret = 0;
+
+out:
+    if ( job.scores != NULL )
+        for (int i = 0; i < job.max_length; i++)
+            free(job.scores[i].counts);
+    free(job.scores);
+    free(job.kasiski);
+    return ret;
+}
@@ -0,0 +1,71 @@
+#ifndef SHIFT_CRACK_H
+#define SHIFT_CRACK_H
+
+#include <stddef.h>
+
+#include "workers.h"
+
+/*
+ * Recovering shift's keyword from the ciphertext alone. The text is
+ * first reduced to just its letters, as 0 to 25, by crack_letters().
+ * shift_crack() then finds the most likely keyword length from how
+ * alike the letters that length apart are, and the keyword itself
+ * a letter at a time by comparing each column of letters with
+ * English.
+ */
+#define CRACK_MAX_LENGTH 40
+
+struct crack_result {
+    int length;
+    /* As given to shift's -m, 1 for none. */
+    int multiplier;
+    /* The shift for each letter, terminated by -1 as shift's is. */
+    int keyword[CRACK_MAX_LENGTH + 1];
+    /* Mean index of coincidence of the columns of letters. */
+    double ioc;
+    /* Summed over the columns, decrypted with the keyword. */
+    double chi_squared;
+    /* How many repeats are a multiple of the length apart. */
+    long kasiski;
+};
+
+/* The valid multipliers, 1 included, for trying each in turn. */
+extern const int crack_multipliers[12];
+
+size_t crack_letters(unsigned char *dest, const unsigned char *src, size_t len);
+
+/*
+ * multiplier is the one the text was encrypted with or 0 to try them
+ * all, and options can have SHIFT_PROGRESS if the keyword progressed.
+ * The letters are scored for each possible length as a job of w's.
+ * Returns -1 if there were no letters or memory ran out.
+ */
+int shift_crack(const unsigned char *letters, size_t n, int multiplier,
+                int options, struct workers *w, struct crack_result *result);
+
+/*
+ * Every multiplier and shift a single letter key can have, scored
+ * against English from a count of the ciphertext's letters alone,
+ * which brute_count_letters() adds a buffer at a time to. shift_brute()
+ * sorts the candidates best first.
+ */
+#define BRUTE_CANDIDATES (12 * 26)
+
+struct brute_candidate {
+    int multiplier;
+    int shift;
+    double chi_squared;
+};
+
+void brute_count_letters(const unsigned char *buf, size_t len,
+                         long counts[26]);
+void shift_brute(const long counts[26],
+                 struct brute_candidate candidates[BRUTE_CANDIDATES]);
+
+/*
+ * How far counts, indexed by plaintext letter, are from English
+ * letter frequencies. The lower the more English.
+ */
+double english_chi_squared(const long counts[26], long total);
+
+#endif
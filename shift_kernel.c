@@ -0,0 +1,958 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "cpu.h"
+#include "shift_kernel.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/* Room past the end of the keyword for a whole vector of keys. */
+#define WINDOW_PAD 64
+
+/*
+ * The keyword rotated so the current index comes first and laid
+ * out far enough past its end that the keys for any vector of
+ * letters starting at base can be loaded in one go.
+ *
+ * When progressing, the entry for the kth letter from the start
+ * of the window has already been incremented by k / length, and
+ * round counts the times the whole keyword has been used up
+ * since, so the key for a letter is keys[base + k] + round.
+ */
+struct key_window {
+    int length;
+    int size;
+    int progress;
+    int base;
+    int round;
+    size_t wraps;
+    unsigned char *keys;
+    /* Short keywords fit here, saving a malloc() for short messages. */
+    unsigned char local[2 * WINDOW_PAD];
+};
+
+typedef void (*shift_kernel)(const struct shift_key *key, struct key_window *w,
+                             unsigned char *out, const unsigned char *in,
+                             size_t len);
+
+static int window_open(struct key_window *w, const struct shift_key *key,
+                       const int *keyword, int index) {
+    int length = 0;
+    while ( keyword[length] != -1 )
+        length++;
+
+    if ( length + WINDOW_PAD <= sizeof(w->local) )
+        w->keys = w->local;
+    else if ( ( w->keys = malloc(length + WINDOW_PAD) ) == NULL )
+        return -1;
+
+    w->length = length;
+    w->size = key->alphabet.size;
+    w->progress = key->options & SHIFT_PROGRESS;
+    w->base = 0;
+    w->round = 0;
+    w->wraps = 0;
+
+    /* p steps through (index + k) % length and round k / length. */
+    for (int k = 0, p = index, round = 0; k < length + WINDOW_PAD; k++) {
+        int shift = keyword[p];
+        if ( w->progress )
+            shift += round;
+        w->keys[k] = shift % w->size;
+        if ( ++p == length )
+            p = 0;
+        if ( p == index )
+            round++;
+    }
+
+    return 0;
+}
+
+/* size is the alphabet's, given so the kernels can make it a constant. */
+static inline void window_advance(struct key_window *w, int nletters, int size) {
+    w->base += nletters;
+    while ( w->base >= w->length ) {
+        w->base -= w->length;
+        w->wraps++;
+        if ( w->progress && ++w->round == size )
+            w->round = 0;
+    }
+}
+
+/*
+ * Moves the keyword on the way the original loop would have after
+ * wraps times through the whole keyword and base letters more:
+ * every entry moves on once for each time it was used and the
+ * index points at the next letter's entry.
+ */
+static void advance_keyword(int *keyword, int *index, int length, int size,
+                            int progress, size_t wraps, int base) {
+    if ( progress ) {
+        int full = wraps % size;
+        for (int k = 0; k < length; k++) {
+            int p = (*index + k) % length;
+            keyword[p] = (keyword[p] + full + (k < base)) % size;
+        }
+    }
+
+    *index = (*index + base) % length;
+}
+
+static void window_close(struct key_window *w, int *keyword, int *index) {
+    advance_keyword(keyword, index, w->length, w->size, w->progress, w->wraps,
+                    w->base);
+    if ( w->keys != w->local )
+        free(w->keys);
+}
+
+static inline int is_letter(int c) {
+    return (unsigned) ((c | 0x20) - 'a') < 26;
+}
+
+static void shift_scalar(const struct shift_key *key, struct key_window *w,
+                         unsigned char *out, const unsigned char *in,
+                         size_t len) {
+    for (size_t j = 0; j < len; j++) {
+        int c = in[j];
+        if ( !is_letter(c) ) {
+            out[j] = c;
+            continue;
+        }
+
+        int first_letter = 'A' | (c & 0x20);
+        int k = w->keys[w->base] + w->round;
+        int x = c - first_letter;
+
+        if ( key->decrypt )
+            x = key->mul[(x + 52 - k) % 26];
+        else
+            x = (key->mul[x] + k) % 26;
+
+        out[j] = x + first_letter;
+        window_advance(w, 1, 26);
+    }
+}
+
+/*
+ * Every character is looked up in the table for its key, so the only
+ * work per character is the lookup and moving the index on. There
+ * are only as many distinct tables as the alphabet has characters
+ * however long the keyword is, and rows maps the key plus the
+ * progress round straight to one of them. Being nothing but tables,
+ * it works for any alphabet.
+ */
+static void shift_table(const struct shift_key *key, struct key_window *w,
+                        unsigned char *out, const unsigned char *in,
+                        size_t len) {
+    for (size_t j = 0; j < len; j++) {
+        int c = in[j];
+        out[j] = key->rows[w->keys[w->base] + w->round][c];
+
+        w->base += key->letter[c];
+        if ( w->base == w->length ) {
+            w->base = 0;
+            w->wraps++;
+            if ( w->progress && ++w->round == w->size )
+                w->round = 0;
+        }
+    }
+}
+
+#ifdef CPU_X86
+/*
+ * The vector kernels classify a whole vector at once and work out
+ * each letter's offset into the key window from a prefix sum of the
+ * letter mask, so non-letters don't use up a key. The keys are then
+ * gathered with a byte shuffle of the window, the multiplication is
+ * a shuffle of a 26 entry table and the modular reduction is done
+ * without branches using an unsigned minimum: for 0 <= x < 52,
+ * min(x, x - 26) is x mod 26 as x - 26 wraps round when x < 26.
+ */
+#define MOD26(x, n26) _mm_min_epu8((x), _mm_sub_epi8((x), (n26)))
+#define MOD26_256(x, n26) _mm256_min_epu8((x), _mm256_sub_epi8((x), (n26)))
+
+__attribute__((target("ssse3")))
+static void shift_ssse3(const struct shift_key *key, struct key_window *w,
+                        unsigned char *out, const unsigned char *in,
+                        size_t len) {
+    const __m128i mul_lo = _mm_loadu_si128((const __m128i *) key->mul);
+    const __m128i mul_hi = _mm_loadu_si128((const __m128i *) (key->mul + 16));
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i upper_a = _mm_set1_epi8('A');
+    const __m128i lower_a = _mm_set1_epi8('a');
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i n15 = _mm_set1_epi8(15);
+    const __m128i n16 = _mm_set1_epi8(16);
+    const __m128i n25 = _mm_set1_epi8(25);
+    const __m128i n26 = _mm_set1_epi8(26);
+
+    const int decrypt = key->decrypt;
+
+    for (; len >= 16; in += 16, out += 16, len -= 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *) in);
+        __m128i x = _mm_sub_epi8(_mm_or_si128(c, case_bit), lower_a);
+        __m128i letter = _mm_cmpeq_epi8(_mm_min_epu8(x, n25), x);
+        int mask = _mm_movemask_epi8(letter);
+        if ( mask == 0 ) {
+            _mm_storeu_si128((__m128i *) out, c);
+            continue;
+        }
+
+        __m128i ones = _mm_and_si128(letter, one);
+        __m128i offset = _mm_add_epi8(ones, _mm_slli_si128(ones, 1));
+        offset = _mm_add_epi8(offset, _mm_slli_si128(offset, 2));
+        offset = _mm_add_epi8(offset, _mm_slli_si128(offset, 4));
+        offset = _mm_add_epi8(offset, _mm_slli_si128(offset, 8));
+        offset = _mm_sub_epi8(offset, ones);
+
+        __m128i window = _mm_loadu_si128((const __m128i *) (w->keys + w->base));
+        __m128i kv = _mm_shuffle_epi8(window, offset);
+        kv = _mm_add_epi8(kv, _mm_set1_epi8(w->round));
+        kv = MOD26(kv, n26);
+
+        if ( decrypt ) {
+            x = _mm_sub_epi8(_mm_add_epi8(x, n26), kv);
+            x = MOD26(x, n26);
+        }
+
+        __m128i y = _mm_or_si128(
+                _mm_shuffle_epi8(mul_lo, _mm_or_si128(x, _mm_cmpgt_epi8(x, n15))),
+                _mm_shuffle_epi8(mul_hi, _mm_sub_epi8(x, n16)));
+
+        if ( !decrypt ) {
+            y = _mm_add_epi8(y, kv);
+            y = MOD26(y, n26);
+        }
+
+        y = _mm_add_epi8(y, _mm_or_si128(upper_a, _mm_and_si128(c, case_bit)));
+        y = _mm_or_si128(_mm_and_si128(letter, y), _mm_andnot_si128(letter, c));
+        _mm_storeu_si128((__m128i *) out, y);
+
+        window_advance(w, __builtin_popcount(mask), 26);
+    }
+
+    shift_scalar(key, w, out, in, len);
+}
+
+__attribute__((target("avx2")))
+static void shift_avx2(const struct shift_key *key, struct key_window *w,
+                       unsigned char *out, const unsigned char *in,
+                       size_t len) {
+    const __m256i mul_lo = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *) key->mul));
+    const __m256i mul_hi = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *) (key->mul + 16)));
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i upper_a = _mm256_set1_epi8('A');
+    const __m256i lower_a = _mm256_set1_epi8('a');
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i n15 = _mm256_set1_epi8(15);
+    const __m256i n16 = _mm256_set1_epi8(16);
+    const __m256i n25 = _mm256_set1_epi8(25);
+    const __m256i n26 = _mm256_set1_epi8(26);
+
+    const int decrypt = key->decrypt;
+
+    for (; len >= 32; in += 32, out += 32, len -= 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *) in);
+        __m256i x = _mm256_sub_epi8(_mm256_or_si256(c, case_bit), lower_a);
+        __m256i letter = _mm256_cmpeq_epi8(_mm256_min_epu8(x, n25), x);
+        unsigned mask = _mm256_movemask_epi8(letter);
+        if ( mask == 0 ) {
+            _mm256_storeu_si256((__m256i *) out, c);
+            continue;
+        }
+
+        /*
+         * Byte shifts and shuffles only work within each 128 bit
+         * half, so the upper half takes its keys from further along
+         * the window by the number of letters in the lower half.
+         */
+        __m256i ones = _mm256_and_si256(letter, one);
+        __m256i offset = _mm256_add_epi8(ones, _mm256_slli_si256(ones, 1));
+        offset = _mm256_add_epi8(offset, _mm256_slli_si256(offset, 2));
+        offset = _mm256_add_epi8(offset, _mm256_slli_si256(offset, 4));
+        offset = _mm256_add_epi8(offset, _mm256_slli_si256(offset, 8));
+        offset = _mm256_sub_epi8(offset, ones);
+
+        int low_letters = __builtin_popcount(mask & 0xffff);
+        const unsigned char *keys = w->keys + w->base;
+        __m256i window = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) keys)),
+                _mm_loadu_si128((const __m128i *) (keys + low_letters)), 1);
+        __m256i kv = _mm256_shuffle_epi8(window, offset);
+        kv = _mm256_add_epi8(kv, _mm256_set1_epi8(w->round));
+        kv = MOD26_256(kv, n26);
+
+        if ( decrypt ) {
+            x = _mm256_sub_epi8(_mm256_add_epi8(x, n26), kv);
+            x = MOD26_256(x, n26);
+        }
+
+        __m256i y = _mm256_or_si256(
+                _mm256_shuffle_epi8(mul_lo, _mm256_or_si256(x, _mm256_cmpgt_epi8(x, n15))),
+                _mm256_shuffle_epi8(mul_hi, _mm256_sub_epi8(x, n16)));
+
+        if ( !decrypt ) {
+            y = _mm256_add_epi8(y, kv);
+            y = MOD26_256(y, n26);
+        }
+
+        y = _mm256_add_epi8(y, _mm256_or_si256(upper_a, _mm256_and_si256(c, case_bit)));
+        y = _mm256_blendv_epi8(c, y, letter);
+        _mm256_storeu_si256((__m256i *) out, y);
+
+        window_advance(w, __builtin_popcount(mask), 26);
+    }
+
+    shift_ssse3(key, w, out, in, len);
+}
+
+/*
+ * Alphabets other than letters made of up to four runs of consecutive
+ * characters, like alnum and printable, are classified a run at a
+ * time: a character is in a run if taking away the run's first
+ * character leaves less than its length, and its place is what is
+ * left plus the run's place. Turning places back into characters is
+ * the same the other way round. The keys are gathered as for letters
+ * and, as these alphabets have at most 128 characters, sums are
+ * reduced with the same unsigned minimum. The multiplication can't be
+ * a shuffle of a table that size, so it is done in 16 bit lanes and
+ * reduced by multiplying by the rounded up reciprocal of the size: as
+ * x * multiplier < 2^14 the quotient is at most one too big, leaving
+ * a remainder at most one size too small.
+ */
+#define MOD_256(x, n) _mm256_min_epu8((x), _mm256_sub_epi8((x), (n)))
+
+__attribute__((always_inline, target("avx2")))
+static inline __m256i mul_mod_256(__m256i x, __m256i multiplier,
+                                  __m256i reciprocal, __m256i n) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i halves[2] = {
+        _mm256_unpacklo_epi8(x, zero), _mm256_unpackhi_epi8(x, zero),
+    };
+
+    for (int h = 0; h < 2; h++) {
+        __m256i v = _mm256_mullo_epi16(halves[h], multiplier);
+        __m256i q = _mm256_mulhi_epu16(v, reciprocal);
+        v = _mm256_sub_epi16(v, _mm256_mullo_epi16(q, n));
+        halves[h] = _mm256_add_epi16(v, _mm256_and_si256(n,
+                                             _mm256_cmpgt_epi16(zero, v)));
+    }
+
+    return _mm256_packus_epi16(halves[0], halves[1]);
+}
+
+__attribute__((always_inline, target("avx2")))
+static inline void shift_runs(int nruns, int size, const struct shift_key *key,
+                              struct key_window *w, unsigned char *out,
+                              const unsigned char *in, size_t len) {
+    const __m256i n = _mm256_set1_epi8(size);
+    const __m256i n16 = _mm256_set1_epi16(size);
+    const __m256i reciprocal = _mm256_set1_epi16((65536 + size - 1) / size);
+    const __m256i multiplier = _mm256_set1_epi16(key->multiplier);
+    const __m256i one = _mm256_set1_epi8(1);
+    __m256i first[4], last[4], place[4];
+
+    for (int r = 0; r < nruns; r++) {
+        first[r] = _mm256_set1_epi8(key->run_first[r]);
+        last[r] = _mm256_set1_epi8(key->run_length[r] - 1);
+        place[r] = _mm256_set1_epi8(key->run_place[r]);
+    }
+
+    const int decrypt = key->decrypt;
+    const int multiply = key->multiplier != 1;
+
+    for (; len >= 32; in += 32, out += 32, len -= 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *) in);
+        __m256i x = _mm256_setzero_si256();
+        __m256i member = _mm256_setzero_si256();
+
+        for (int r = 0; r < nruns; r++) {
+            __m256i d = _mm256_sub_epi8(c, first[r]);
+            __m256i in_run = _mm256_cmpeq_epi8(_mm256_min_epu8(d, last[r]), d);
+            x = _mm256_blendv_epi8(x, _mm256_add_epi8(d, place[r]), in_run);
+            member = _mm256_or_si256(member, in_run);
+        }
+
+        unsigned mask = _mm256_movemask_epi8(member);
+        if ( mask == 0 ) {
+            _mm256_storeu_si256((__m256i *) out, c);
+            continue;
+        }
+
+        __m256i ones = _mm256_and_si256(member, one);
+        __m256i offset = _mm256_add_epi8(ones, _mm256_slli_si256(ones, 1));
+        offset = _mm256_add_epi8(offset, _mm256_slli_si256(offset, 2));
+        offset = _mm256_add_epi8(offset, _mm256_slli_si256(offset, 4));
+        offset = _mm256_add_epi8(offset, _mm256_slli_si256(offset, 8));
+        offset = _mm256_sub_epi8(offset, ones);
+
+        int low_members = __builtin_popcount(mask & 0xffff);
+        const unsigned char *keys = w->keys + w->base;
+        __m256i window = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) keys)),
+                _mm_loadu_si128((const __m128i *) (keys + low_members)), 1);
+        __m256i kv = _mm256_shuffle_epi8(window, offset);
+        kv = _mm256_add_epi8(kv, _mm256_set1_epi8(w->round));
+        kv = MOD_256(kv, n);
+
+        if ( decrypt ) {
+            x = _mm256_sub_epi8(_mm256_add_epi8(x, n), kv);
+            x = MOD_256(x, n);
+        }
+
+        if ( multiply )
+            x = mul_mod_256(x, multiplier, reciprocal, n16);
+
+        if ( !decrypt ) {
+            x = _mm256_add_epi8(x, kv);
+            x = MOD_256(x, n);
+        }
+
+        __m256i y = c;
+        for (int r = 0; r < nruns; r++) {
+            __m256i d = _mm256_sub_epi8(x, place[r]);
+            __m256i in_run = _mm256_and_si256(member,
+                    _mm256_cmpeq_epi8(_mm256_min_epu8(d, last[r]), d));
+            y = _mm256_blendv_epi8(y, _mm256_add_epi8(d, first[r]), in_run);
+        }
+        _mm256_storeu_si256((__m256i *) out, y);
+
+        window_advance(w, __builtin_popcount(mask), size);
+    }
+
+    shift_table(key, w, out, in, len);
+}
+
+/*
+ * The runs kernel built for the alphabets given by name, where the
+ * size and the number of runs are known, and for any other.
+ */
+#define RUNS_KERNEL(name, nruns, size) \
+    __attribute__((target("avx2"))) \
+    static void shift_runs_##name(const struct shift_key *key, \
+                                  struct key_window *w, unsigned char *out, \
+                                  const unsigned char *in, size_t len) { \
+        shift_runs(nruns, size, key, w, out, in, len); \
+    }
+
+RUNS_KERNEL(alnum, 2, 36)
+RUNS_KERNEL(printable, 1, 95)
+RUNS_KERNEL(any, key->nruns, key->alphabet.size)
+
+#undef RUNS_KERNEL
+
+static shift_kernel find_runs(const struct shift_key *key) {
+    if ( key->nruns == 2 && key->alphabet.size == 36 )
+        return shift_runs_alnum;
+    if ( key->nruns == 1 && key->alphabet.size == 95 )
+        return shift_runs_printable;
+    return shift_runs_any;
+}
+#endif
+
+#ifdef CPU_X86
+/*
+ * Kernels for keys known when building, the built in single shifts
+ * and any keywords given to make as SHIFT_FIXED_KEYWORDS. Each is the
+ * avx2 kernel inlined with its multiplier, direction and, for a single
+ * shift, the shift itself as constants, so the multiplication table
+ * is a constant, a multiplier of 1 and the direction it isn't going
+ * fold away, and a single shift needs neither the key window nor the
+ * prefix sum to find each letter's key. They don't progress, so the
+ * keys need no round adding either, nor the wraps counting. Shifts
+ * are given with the inverse of their multiplier for decrypting.
+ */
+#define FIXED_SHIFTS \
+    FIXED_SHIFT(caesar, 1, 1, 3) \
+    FIXED_SHIFT(rot13, 1, 1, 13) \
+    FIXED_SHIFT(atbash, 25, 25, 25)
+
+#ifndef SHIFT_FIXED_KEYWORDS
+#define SHIFT_FIXED_KEYWORDS
+#endif
+
+#define M(i) ((i) * multiplier % 26)
+
+__attribute__((always_inline, target("avx2")))
+static inline void shift_fixed(int multiplier, int shift, int length, int decrypt,
+                               const struct shift_key *key,
+                               struct key_window *w, unsigned char *out,
+                               const unsigned char *in, size_t len) {
+    const __m256i mul_lo = _mm256_setr_epi8(
+            M(0), M(1), M(2), M(3), M(4), M(5), M(6), M(7),
+            M(8), M(9), M(10), M(11), M(12), M(13), M(14), M(15),
+            M(0), M(1), M(2), M(3), M(4), M(5), M(6), M(7),
+            M(8), M(9), M(10), M(11), M(12), M(13), M(14), M(15));
+    const __m256i mul_hi = _mm256_setr_epi8(
+            M(16), M(17), M(18), M(19), M(20), M(21), M(22), M(23),
+            M(24), M(25), 0, 0, 0, 0, 0, 0,
+            M(16), M(17), M(18), M(19), M(20), M(21), M(22), M(23),
+            M(24), M(25), 0, 0, 0, 0, 0, 0);
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i upper_a = _mm256_set1_epi8('A');
+    const __m256i lower_a = _mm256_set1_epi8('a');
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i n15 = _mm256_set1_epi8(15);
+    const __m256i n16 = _mm256_set1_epi8(16);
+    const __m256i n25 = _mm256_set1_epi8(25);
+    const __m256i n26 = _mm256_set1_epi8(26);
+
+    for (; len >= 32; in += 32, out += 32, len -= 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *) in);
+        __m256i x = _mm256_sub_epi8(_mm256_or_si256(c, case_bit), lower_a);
+        __m256i letter = _mm256_cmpeq_epi8(_mm256_min_epu8(x, n25), x);
+        __m256i kv;
+
+        if ( shift >= 0 ) {
+            kv = _mm256_set1_epi8(shift);
+        } else {
+            unsigned mask = _mm256_movemask_epi8(letter);
+            if ( mask == 0 ) {
+                _mm256_storeu_si256((__m256i *) out, c);
+                continue;
+            }
+
+            __m256i ones = _mm256_and_si256(letter, one);
+            __m256i offset = _mm256_add_epi8(ones, _mm256_slli_si256(ones, 1));
+            offset = _mm256_add_epi8(offset, _mm256_slli_si256(offset, 2));
+            offset = _mm256_add_epi8(offset, _mm256_slli_si256(offset, 4));
+            offset = _mm256_add_epi8(offset, _mm256_slli_si256(offset, 8));
+            offset = _mm256_sub_epi8(offset, ones);
+
+            int low_letters = __builtin_popcount(mask & 0xffff);
+            const unsigned char *keys = w->keys + w->base;
+            __m256i window = _mm256_inserti128_si256(
+                    _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) keys)),
+                    _mm_loadu_si128((const __m128i *) (keys + low_letters)), 1);
+            kv = _mm256_shuffle_epi8(window, offset);
+
+            /* Without progressing only where in the keyword matters. */
+            w->base = (w->base + __builtin_popcount(mask)) % length;
+        }
+
+        if ( decrypt ) {
+            x = _mm256_sub_epi8(_mm256_add_epi8(x, n26), kv);
+            x = MOD26_256(x, n26);
+        }
+
+        __m256i y = x;
+        if ( multiplier != 1 )
+            y = _mm256_or_si256(
+                    _mm256_shuffle_epi8(mul_lo, _mm256_or_si256(x, _mm256_cmpgt_epi8(x, n15))),
+                    _mm256_shuffle_epi8(mul_hi, _mm256_sub_epi8(x, n16)));
+
+        if ( !decrypt ) {
+            y = _mm256_add_epi8(y, kv);
+            y = MOD26_256(y, n26);
+        }
+
+        y = _mm256_add_epi8(y, _mm256_or_si256(upper_a, _mm256_and_si256(c, case_bit)));
+        y = _mm256_blendv_epi8(c, y, letter);
+        _mm256_storeu_si256((__m256i *) out, y);
+    }
+
+    shift_scalar(key, w, out, in, len);
+}
+
+#undef M
+
+#define FIXED_KERNEL(name, multiplier, shift, length, decrypt) \
+    __attribute__((target("avx2"))) \
+    static void shift_fixed_##name(const struct shift_key *key, \
+                                   struct key_window *w, unsigned char *out, \
+                                   const unsigned char *in, size_t len) { \
+        shift_fixed(multiplier, shift, length, decrypt, key, w, out, in, len); \
+    }
+#define FIXED_SHIFT(name, multiplier, inverse, shift) \
+    FIXED_KERNEL(name, multiplier, shift, 1, 0) \
+    FIXED_KERNEL(name##_decrypt, inverse, shift, 1, 1)
+#define FIXED_KEYWORD(word) \
+    FIXED_KERNEL(word, 1, -1, sizeof(#word) - 1, 0) \
+    FIXED_KERNEL(word##_decrypt, 1, -1, sizeof(#word) - 1, 1)
+
+FIXED_SHIFTS
+SHIFT_FIXED_KEYWORDS
+
+#undef FIXED_KERNEL
+#undef FIXED_SHIFT
+#undef FIXED_KEYWORD
+
+/* What each fixed kernel is for, keyword being NULL for a single shift. */
+static const struct {
+    int multiplier;
+    int inverse;
+    int shift;
+    const char *keyword;
+    shift_kernel encrypt;
+    shift_kernel decrypt;
+} fixed_kernels[] = {
+#define FIXED_SHIFT(name, multiplier, inverse, shift) \
+    { multiplier, inverse, shift, NULL, \
+      shift_fixed_##name, shift_fixed_##name##_decrypt },
+#define FIXED_KEYWORD(word) \
+    { 1, 1, 0, #word, shift_fixed_##word, shift_fixed_##word##_decrypt },
+    FIXED_SHIFTS
+    SHIFT_FIXED_KEYWORDS
+#undef FIXED_SHIFT
+#undef FIXED_KEYWORD
+};
+
+#define NFIXED (sizeof(fixed_kernels) / sizeof(fixed_kernels[0]))
+
+/*
+ * The fixed kernel for key and keyword, if there is one, or NULL.
+ */
+static shift_kernel find_fixed(const struct shift_key *key, const int *keyword) {
+    if ( ( key->options & SHIFT_PROGRESS ) || !key->alphabet.letters )
+        return NULL;
+
+    for (size_t f = 0; f < NFIXED; f++) {
+        const char *word = fixed_kernels[f].keyword;
+        int length = 0;
+
+        if ( key->multiplier != (key->decrypt? fixed_kernels[f].inverse
+                                              : fixed_kernels[f].multiplier) )
+            continue;
+
+        if ( word == NULL ) {
+            if ( keyword[0] != fixed_kernels[f].shift || keyword[1] != -1 )
+                continue;
+        } else {
+            while ( word[length] && keyword[length] == word[length] - 'a' )
+                length++;
+            if ( word[length] || keyword[length] != -1 )
+                continue;
+        }
+
+        return key->decrypt? fixed_kernels[f].decrypt : fixed_kernels[f].encrypt;
+    }
+
+    return NULL;
+}
+#endif
+
+static const struct {
+    const char *name;
+    shift_kernel kernel;
+    int features;
+} kernels[] = {
+#ifdef CPU_X86
+    { "fixed", shift_avx2, CPU_AVX2 },
+    { "avx2", shift_avx2, CPU_AVX2 },
+    { "ssse3", shift_ssse3, CPU_SSSE3 },
+#endif
+    { "table", shift_table, 0 },
+    { "scalar", shift_scalar, 0 },
+};
+
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+/*
+ * The kernel is picked once, whichever thread gets there first, so
+ * contexts can be used from any number of threads. "fixed" is the
+ * avx2 kernel for any key without a fixed kernel of its own, and the
+ * avx2 kernels use the runs kernels for alphabets other than letters.
+ */
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static shift_kernel kernel = NULL;
+static const char *kernel_name = NULL;
+static int use_fixed = 0;
+static int use_runs = 0;
+
+static void use_kernel(size_t k) {
+    kernel = kernels[k].kernel;
+    kernel_name = kernels[k].name;
+    use_fixed = strcmp(kernel_name, "fixed") == 0;
+    use_runs = kernels[k].features == CPU_AVX2;
+}
+
+static void select_kernel(void) {
+    int features = cpu_features();
+
+    for (size_t k = 0; k < NKERNELS; k++) {
+        if ( (kernels[k].features & features) == kernels[k].features ) {
+            use_kernel(k);
+            return;
+        }
+    }
+}
+
+int shift_set_kernel(const char *name) {
+    int features = cpu_features();
+
+    pthread_once(&kernel_once, select_kernel);
+
+    for (size_t k = 0; k < NKERNELS; k++) {
+        if ( strcmp(kernels[k].name, name) != 0 )
+            continue;
+        if ( (kernels[k].features & features) != kernels[k].features )
+            return -1;
+        use_kernel(k);
+        return 0;
+    }
+
+    return -1;
+}
+
+int shift_alphabet_init(struct shift_alphabet *alphabet, const char *spec) {
+    char printable[96];
+    const char *chars;
+
+    for (int c = 0; c < 256; c++)
+        alphabet->place[c] = -1;
+
+    if ( strcmp(spec, "letters") == 0 ) {
+        alphabet->size = 26;
+        alphabet->letters = 1;
+        for (int x = 0; x < 26; x++) {
+            alphabet->place['a' + x] = alphabet->place['A' + x] = x;
+            alphabet->chars[x] = 'a' + x;
+        }
+        return 0;
+    }
+
+    if ( strcmp(spec, "alnum") == 0 ) {
+        chars = "0123456789abcdefghijklmnopqrstuvwxyz";
+    } else if ( strcmp(spec, "printable") == 0 ) {
+        for (int c = ' '; c <= '~'; c++)
+            printable[c - ' '] = c;
+        printable['~' - ' ' + 1] = '\0';
+        chars = printable;
+    } else if ( strncmp(spec, "chars:", 6) == 0 ) {
+        chars = spec + 6;
+    } else {
+        return -1;
+    }
+
+    alphabet->size = 0;
+    alphabet->letters = 0;
+    for (const unsigned char *c = (const unsigned char *) chars; *c; c++) {
+        if ( alphabet->place[*c] != -1 )
+            return -1;
+        alphabet->place[*c] = alphabet->size;
+        alphabet->chars[alphabet->size++] = *c;
+    }
+
+    return alphabet->size < 2? -1 : 0;
+}
+
+int shift_inverse(int multiplier, int modulus) {
+    /* Keeps r = t * multiplier (mod modulus) for both pairs. */
+    int r0 = modulus, r1 = multiplier % modulus;
+    int t0 = 0, t1 = 1;
+
+    while ( r1 != 0 ) {
+        int q = r0 / r1, r = r0 - q * r1, t = t0 - q * t1;
+        r0 = r1;
+        r1 = r;
+        t0 = t1;
+        t1 = t;
+    }
+
+    if ( r0 != 1 )
+        return -1;
+    return t0 < 0? t0 + modulus : t0;
+}
+
+static void set_rows(struct shift_key *key) {
+    int size = key->alphabet.size;
+    for (int k = 0; k < 2 * size; k++)
+        key->rows[k] = key->tables[k % size];
+}
+
+/*
+ * The runs of consecutive characters of an alphabet other than
+ * letters, if it has few enough of them for the runs kernels.
+ */
+static void find_runs_of(struct shift_key *key) {
+    const struct shift_alphabet *a = &key->alphabet;
+
+    key->nruns = 0;
+    if ( a->letters || a->size > 128 )
+        return;
+
+    for (int x = 0; x < a->size; x++) {
+        if ( x > 0 && a->chars[x] == a->chars[x - 1] + 1 ) {
+            key->run_length[key->nruns - 1]++;
+            continue;
+        }
+        if ( key->nruns == 4 ) {
+            key->nruns = 0;
+            return;
+        }
+        key->run_first[key->nruns] = a->chars[x];
+        key->run_length[key->nruns] = 1;
+        key->run_place[key->nruns++] = x;
+    }
+}
+
+void shift_key_init(struct shift_key *key, const struct shift_alphabet *alphabet,
+                    int multiplier, int options) {
+    if ( alphabet != NULL )
+        key->alphabet = *alphabet;
+    else
+        shift_alphabet_init(&key->alphabet, "letters");
+
+    int size = key->alphabet.size;
+    key->decrypt = options & SHIFT_DECRYPT;
+    key->options = options;
+
+    if ( key->decrypt && multiplier != 1) {
+        /* Can't divide with modular arithmetic,
+         * the inverse of multiplication is multiplication
+         * a a^{-1} = 1 (mod size)
+         * When solved gives the inverse a^{-1} of multiplication
+         * by a.
+         */
+        multiplier = shift_inverse(multiplier, size);
+    }
+    key->multiplier = multiplier;
+
+    memset(key->mul, 0, sizeof(key->mul));
+    if ( key->alphabet.letters )
+        for (int x = 0; x < 26; x++)
+            key->mul[x] = x * multiplier % 26;
+
+    for (int c = 0; c < 256; c++)
+        key->letter[c] = key->alphabet.place[c] != -1;
+
+    for (int k = 0; k < size; k++) {
+        for (int c = 0; c < 256; c++) {
+            int x = key->alphabet.place[c];
+            if ( x == -1 ) {
+                key->tables[k][c] = c;
+                continue;
+            }
+
+            if ( key->decrypt )
+                x = (x + size - k) % size * multiplier % size;
+            else
+                x = (x * multiplier + k) % size;
+
+            if ( key->alphabet.letters )
+                key->tables[k][c] = x + ('A' | (c & 0x20));
+            else
+                key->tables[k][c] = key->alphabet.chars[x];
+        }
+    }
+
+    set_rows(key);
+    find_runs_of(key);
+}
+
+void shift_key_copy(struct shift_key *key, const struct shift_key *from) {
+    memcpy(key, from, offsetof(struct shift_key, tables));
+    memcpy(key->tables, from->tables,
+           from->alphabet.size * sizeof(key->tables[0]));
+    set_rows(key);
+}
+
+int shift_apply(const struct shift_key *key, int *keyword, int *index,
+                unsigned char *out, const unsigned char *in, size_t len) {
+    shift_kernel run = NULL;
+    struct key_window w;
+
+    pthread_once(&kernel_once, select_kernel);
+
+#ifdef CPU_X86
+    if ( !key->alphabet.letters )
+        run = use_runs && key->nruns > 0? find_runs(key) : shift_table;
+    else if ( use_fixed )
+        run = find_fixed(key, keyword);
+#else
+    if ( !key->alphabet.letters )
+        run = shift_table;
+#endif
+    if ( run == NULL )
+        run = kernel;
+
+    if ( window_open(&w, key, keyword, *index) )
+        return -1;
+
+    run(key, &w, out, in, len);
+
+    window_close(&w, keyword, index);
+    return 0;
+}
+
+void shift_advance(const struct shift_key *key, int *keyword, int *index,
+                   size_t nletters) {
+    int length = 0;
+    while ( keyword[length] != -1 )
+        length++;
+
+    advance_keyword(keyword, index, length, key->alphabet.size,
+                    key->options & SHIFT_PROGRESS, nletters / length,
+                    nletters % length);
+}
+
+size_t shift_count(const struct shift_key *key, const unsigned char *buf,
+                   size_t len) {
+    if ( key->alphabet.letters )
+        return shift_count_letters(buf, len);
+
+    size_t count = 0;
+    for (size_t j = 0; j < len; j++)
+        count += key->letter[buf[j]];
+    return count;
+}
+
+size_t shift_count_letters(const unsigned char *buf, size_t len) {
+    size_t count = 0;
+    for (size_t j = 0; j < len; j++)
+        count += is_letter(buf[j]);
+    return count;
+}
+
+void shift_apply_reference(int *keyword, int *index, int multiplier,
+                           int options, unsigned char *buf, size_t len) {
+    int decrypt = options & SHIFT_DECRYPT;
+    int progress_keyword = options & SHIFT_PROGRESS;
+    int first_letter;
+    int i = *index;
+
+    for (size_t j = 0; j < len; j++) {
+        int c = buf[j];
+        if ( !isalpha(c) )
+            continue;
+
+        /* retain this so can restore case after encryption */
+        first_letter = islower(c)? 'a' : 'A';
+        c -= first_letter;
+
+        if ( decrypt ) {
+            c += 26 - keyword[i];
+            c *= multiplier;
+        } else {
+            c *= multiplier;
+            c += keyword[i];
+        }
+
+        c %= 26;
+        buf[j] = c + first_letter; /* revert to character */
+
+        if ( progress_keyword ) {
+            keyword[i]++;
+            keyword[i] %= 26;
+        }
+
+        i++;
+        if ( keyword[i] == -1 )
+            i = 0;
+    }
+
+    *index = i;
+}
+
+const char *shift_kernel_name(void) {
+    pthread_once(&kernel_once, select_kernel);
+    return kernel_name;
+}
@@ -0,0 +1,115 @@
+#ifndef SHIFT_KERNEL_H
+#define SHIFT_KERNEL_H
+
+#include <stddef.h>
+
+enum { SHIFT_NONE = 0, SHIFT_DECRYPT = 1, SHIFT_PROGRESS = 2, };
+
+/*
+ * The characters a shift works on, each standing for its place in
+ * the alphabet. The usual alphabet, letters, is the 26 letters in
+ * either case, each keeping its case. Any other is its characters
+ * exactly as given, so alnum is the digits then the lower case
+ * letters, printable is space to ~ in ASCII order and chars: is
+ * followed by the characters themselves.
+ */
+#define SHIFT_ALPHABET_MAX 256
+
+struct shift_alphabet {
+    int size;
+    int letters;
+    short place[256];   /* -1 for characters not in the alphabet */
+    unsigned char chars[SHIFT_ALPHABET_MAX];
+};
+
+/*
+ * Sets up alphabet from spec: letters, alnum, printable or chars:
+ * followed by at least two characters, none repeated. Returns -1 if
+ * spec isn't one of those.
+ */
+int shift_alphabet_init(struct shift_alphabet *alphabet, const char *spec);
+
+/*
+ * The inverse of multiplier modulo modulus, by the extended Euclidean
+ * algorithm, or -1 if they have a factor in common so there is none.
+ */
+int shift_inverse(int multiplier, int modulus);
+
+/*
+ * Everything about the key except the keyword itself, which
+ * changes as it is used. multiplier is the inverse multiplier
+ * when decrypting. letter marks the characters in the alphabet and
+ * tables holds the substitution for each of the size possible keys,
+ * with other characters mapping to themselves, and rows maps a key
+ * plus a progress round of up to size - 1 to its table. An alphabet
+ * of up to four runs of consecutive characters, other than letters,
+ * is also described by them for the vector kernels.
+ */
+struct shift_key {
+    int multiplier;
+    int decrypt;
+    int options;
+    struct shift_alphabet alphabet;
+    int nruns;
+    unsigned char run_first[4];
+    unsigned char run_length[4];
+    unsigned char run_place[4];
+    unsigned char mul[32];
+    unsigned char letter[256];
+    /* Only the first size tables are used, so copies can stop there. */
+    const unsigned char *rows[2 * SHIFT_ALPHABET_MAX];
+    unsigned char tables[SHIFT_ALPHABET_MAX][256];
+};
+
+/* alphabet can be NULL for letters. */
+void shift_key_init(struct shift_key *key, const struct shift_alphabet *alphabet,
+                    int multiplier, int options);
+void shift_key_copy(struct shift_key *key, const struct shift_key *from);
+
+/*
+ * Encrypts len bytes of in into out with the affine shift
+ * c * multiplier + keyword[i] (mod size), or its inverse when
+ * decrypting. out may be the same as in. Only characters in the
+ * alphabet are changed and only they move the keyword index *index
+ * on. keyword is terminated by -1 and, with SHIFT_PROGRESS, each
+ * entry is incremented as it is used, exactly as the original loop
+ * did.
+ * Returns -1 if it runs out of memory.
+ */
+int shift_apply(const struct shift_key *key, int *keyword, int *index,
+                unsigned char *out, const unsigned char *in, size_t len);
+
+/*
+ * Moves keyword and *index on as if nletters characters of the
+ * alphabet had been encrypted, so a buffer can be started from any
+ * count of them, which shift_count() counts. shift_count_letters()
+ * counts letters whatever the key.
+ */
+void shift_advance(const struct shift_key *key, int *keyword, int *index,
+                   size_t nletters);
+size_t shift_count(const struct shift_key *key, const unsigned char *buf,
+                   size_t len);
+size_t shift_count_letters(const unsigned char *buf, size_t len);
+
+/*
+ * The original character at a time loop, kept to check the kernels
+ * against. Here multiplier must already be the inverse multiplier
+ * when decrypting.
+ */
+void shift_apply_reference(int *keyword, int *index, int multiplier,
+                           int options, unsigned char *buf, size_t len);
+
+/*
+ * Picks the kernel by name: fixed, avx2, ssse3, table or scalar.
+ * fixed is avx2 except for the keys built in to shift_kernel.c,
+ * which have kernels of their own. Alphabets other than letters use
+ * the table kernel, or with avx2 or fixed the runs kernel when the
+ * alphabet has runs. Returns -1 if there is no such
+ * kernel or the processor can't run it. Call it before any
+ * encrypting starts, it isn't safe to change the kernel while
+ * another thread is using it.
+ */
+int shift_set_kernel(const char *name);
+const char *shift_kernel_name(void);
+
+#endif
@@ -0,0 +1,1540 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "ciphers.h"
+#include "verify_ref.h"
+
+static char *prog_name = "verifier";
+static char *prog_version = "1.0";
+static char *invoc_name = NULL;
+static char *author = "a-chap";
+
+#define MAX_FILES 4
+
+/* Inputs up to this long, all together, are tried split at every byte. */
+#define EXHAUSTIVE_MAX 512
+
+/* And up to this long fed to the library a byte at a time. */
+#define BYTEWISE_MAX (1 << 16)
+
+static struct option options[] = {
+    { "seed", required_argument, NULL, 's'},
+    { "cases", required_argument, NULL, 'n'},
+    { "tools", required_argument, NULL, 'T'},
+    { "help", no_argument, NULL, 'h'},
+    { "version", no_argument, NULL, 'v'},
+    { NULL, 0, NULL, 0 }
+};
+
+enum { SHIFT, XOR, PLAYFAIR, BLOCK, NCIPHERS };
+
+static const char *cipher_names[NCIPHERS] = { "shift", "xor", "playfair", "block" };
+
+struct buffer {
+    unsigned char *data;
+    size_t len;
+};
+
+/*
+ * One way of running one of the ciphers, held as the options its
+ * tool takes. kind is the shift tool's flag for how the key was
+ * given, s, k, c, r, b, a or z, or 0 for none, and key the keyword
+ * for shift -k, xor and playfair. block_size and nblocks are as
+ * given, before the tools make sense of ones that aren't positive.
+ */
+struct job {
+    int cipher;
+    int kind;
+    int shift;
+    int multiplier;
+    int decrypt;
+    int progress;
+    char key[128];
+    int block_size;
+    int nblocks;
+};
+
+/* A command line being put together, its strings kept in store. */
+struct args {
+    char *v[64];
+    int n;
+    char store[8192];
+    size_t used;
+};
+
+static const int multipliers[] = { 3, 5, 7, 9, 11, 15, 17, 19, 21, 23, 25 };
+
+static const char *kernel_names[] = { "fixed", "avx2", "ssse3", "table", "scalar" };
+static const char *kernels[5];
+static int nkernels;
+static const char *xor_kernel_names[] = { "avx512", "avx2", "sse2", "scalar" };
+static const char *xor_kernels[4];
+static int nxor_kernels;
+
+static unsigned long long seed;
+static int cases = 300;
+static int case_number;
+static unsigned long comparisons[NCIPHERS];
+
+/* The directory the tools are in, if they are being checked too. */
+static char *tools_dir = NULL;
+static char work_dir[PATH_MAX];
+
+static void print_version();
+static void print_help();
+
+static void *xmalloc(size_t size);
+
+static void sweep(int cipher);
+static void random_job(struct job *j, int cipher);
+static void random_files(struct buffer *files, int *nfiles, int large);
+static void check_library(const struct job *j, const struct buffer *files,
+                          int nfiles, int thorough);
+static void check_tools(const struct job *j, const struct buffer *files,
+                        int nfiles);
+static void check_pipeline(const struct buffer *files, int nfiles);
+static void free_files(struct buffer *files, int nfiles);
+static void remove_work_dir(void);
+
+int main(int argc, char **argv) {
+    invoc_name = argv[0];
+    seed = (unsigned long long) time(NULL) ^ (unsigned long long) getpid() << 32;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "s:n:hv", options, NULL)) != -1) {
+        switch(c) {
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                cases = atoi(optarg);
+                if ( cases < 0 ) {
+                    fprintf(stderr, "%s: The number of cases can't be "
+                                    "negative.\n"
+                                    "Try '%s --help' for more information.\n"
+                                    , invoc_name, invoc_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'T':
+                tools_dir = optarg;
+                break;
+            case 'h':
+                print_help();
+                exit(EXIT_SUCCESS);
+                break;
+            case 'v':
+                print_version();
+                exit(EXIT_SUCCESS);
+                break;
+            default:
+                fprintf(stderr, "Try '%s --help' for more information.\n", invoc_name);
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+
+    printf("Seed %llu\n", seed);
+    fflush(stdout);
+
+    /* Every shift and xor kernel this processor can run is checked. */
+    const char *kernel = shift_kernel_name();
+    for (int i = 0; i < 5; i++)
+        if ( shift_set_kernel(kernel_names[i]) == 0 )
+            kernels[nkernels++] = kernel_names[i];
+    shift_set_kernel(kernel);
+    kernel = xor_kernel_name();
+    for (int i = 0; i < 4; i++)
+        if ( xor_set_kernel(xor_kernel_names[i]) == 0 )
+            xor_kernels[nxor_kernels++] = xor_kernel_names[i];
+    xor_set_kernel(kernel);
+
+    /* The tools are run in a directory of their own, on files in it. */
+    if ( tools_dir != NULL ) {
+        const char *tmp = getenv("TMPDIR");
+        char cwd[PATH_MAX];
+
+        if ( tools_dir[0] != '/' ) {
+            if ( getcwd(cwd, sizeof(cwd)) == NULL ) {
+                perror(invoc_name);
+                exit(EXIT_FAILURE);
+            }
+            tools_dir = strcat(strcat(strcpy(xmalloc(strlen(cwd)
+                                                     + strlen(tools_dir) + 2),
+                                             cwd), "/"), tools_dir);
+        }
+        snprintf(work_dir, sizeof(work_dir), "%s/verify.XXXXXX",
+                 tmp != NULL? tmp : "/tmp");
+        if ( mkdtemp(work_dir) == NULL || chdir(work_dir) == -1 ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct buffer files[MAX_FILES];
+    int nfiles;
+    struct job j;
+    int tool_cases = cases / 20 + 1;
+
+    for (int cipher = 0; cipher < NCIPHERS; cipher++) {
+        sweep(cipher);
+
+        for (case_number = 1; case_number <= cases; case_number++) {
+            random_job(&j, cipher);
+            random_files(files, &nfiles, 0);
+            check_library(&j, files, nfiles, 1);
+            free_files(files, nfiles);
+        }
+
+        /*
+         * A letter left over is padded without moving the grid on, so
+         * these progress it once and twice, not two and four times.
+         */
+        if ( tools_dir != NULL && cipher == PLAYFAIR ) {
+            static unsigned char abc[] = "abc";
+            struct buffer odd[2] = { { abc, 3 }, { abc, 3 } };
+
+            memset(&j, 0, sizeof(j));
+            j.cipher = PLAYFAIR;
+            j.progress = 1;
+            strcpy(j.key, "key");
+            case_number = 0;
+            check_tools(&j, odd, 1);
+            check_tools(&j, odd, 2);
+        }
+
+        for (case_number = 1; tools_dir && case_number <= tool_cases; case_number++) {
+            random_job(&j, cipher);
+            random_files(files, &nfiles, case_number % 3 == 0);
+            check_tools(&j, files, nfiles);
+            free_files(files, nfiles);
+        }
+
+        printf("%s: %lu runs match the reference\n", cipher_names[cipher],
+               comparisons[cipher]);
+        fflush(stdout);
+    }
+
+    if ( tools_dir != NULL ) {
+        for (case_number = 1; case_number <= tool_cases; case_number++) {
+            random_files(files, &nfiles, 0);
+            check_pipeline(files, nfiles);
+            free_files(files, nfiles);
+        }
+        printf("pipeline: %d runs of several stages match the reference\n",
+               tool_cases);
+
+        remove_work_dir();
+    }
+
+    return 0;
+}
+
+/* xorshift64*, so a seed gives the same cases everywhere. */
+static uint64_t random_state;
+
+static uint64_t next_random(void) {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545f4914f6cdd1dULL;
+}
+
+/* Between 0 and n - 1. */
+static unsigned below(unsigned n) {
+    return next_random() % n;
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if ( p == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/*
+ * Inputs are made of stretches of one kind of character or another,
+ * several kinds to a file or one throughout: letters, text, bytes of
+ * any value, the bytes either side of the letters and the other
+ * edges classification could trip over, runs of the same letter for
+ * playfair's doubled letters, and mostly punctuation.
+ */
+static const char *words[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+    "Jazz", "XXX", "xx", "balloon", "Mississippi", "quiz", "Hello",
+    "KEEP", "jj", "a", "I", "exxon", "QUEUE",
+};
+
+static const unsigned char edges[] =
+    "@[`{AZazJjXxIiQq\0\x7f\x80\x81\xc1\xca\xda\xdb\xe1\xea\xfa\xfb\xff"
+    " \t\n\v\f\r~!";
+
+static void fill_stretch(unsigned char *p, size_t len, int kind) {
+    size_t i = 0;
+
+    switch ( kind ) {
+        case 0:
+            for (; i < len; i++)
+                p[i] = (below(2)? 'a' : 'A') + below(26);
+            break;
+        case 1:
+            while ( i < len ) {
+                const char *w = words[below(sizeof(words) / sizeof(*words))];
+                for (; *w && i < len; w++)
+                    p[i++] = *w;
+                if ( i < len )
+                    p[i++] = " \n\t,.;'"[below(7)];
+            }
+            break;
+        case 2:
+            for (; i < len; i++)
+                p[i] = below(256);
+            break;
+        case 3:
+            for (; i < len; i++)
+                p[i] = edges[below(sizeof(edges) - 1)];
+            break;
+        case 4: {
+            int letter = "XJxjabQ"[below(7)];
+            for (; i < len; i++) {
+                if ( below(8) == 0 )
+                    letter = (below(2)? 'a' : 'A') + below(26);
+                p[i] = below(10)? letter : ' ';
+            }
+            break;
+        }
+        default:
+            for (; i < len; i++)
+                p[i] = below(6)? "!?., -_0123456789\n"[below(18)]
+                               : 'a' + below(26);
+            break;
+    }
+}
+
+static void fill(unsigned char *p, size_t len) {
+    if ( below(3) == 0 ) {
+        fill_stretch(p, len, below(6));
+        return;
+    }
+    for (size_t i = 0, n; i < len; i += n) {
+        n = 1 + below(below(2)? 40 : 300);
+        if ( n > len - i )
+            n = len - i;
+        fill_stretch(p + i, n, below(6));
+    }
+}
+
+/* Lengths cluster round the vector and block sizes the kernels use. */
+static size_t random_length(int large) {
+    switch ( below(9) ) {
+        case 0:
+            return below(4);
+        case 1:
+            return below(64);
+        case 2: {
+            size_t n = (16 << below(4)) * (1 + below(8)) + below(5);
+            return n < 2? n : n - 2;
+        }
+        case 3: case 4: case 5:
+            return below(4096);
+        case 6:
+            return below(40000);
+        case 7:
+            return (1 << 17) + below(5) - 2;
+        default:
+            return large? (2 << 20) + below(3 << 20) : below(300000);
+    }
+}
+
+static void random_files(struct buffer *files, int *nfiles, int large) {
+    *nfiles = 1 + below(MAX_FILES);
+    int big = large? below(*nfiles) : -1;
+
+    for (int i = 0; i < *nfiles; i++) {
+        files[i].len = random_length(i == big);
+        files[i].data = xmalloc(files[i].len);
+        fill(files[i].data, files[i].len);
+    }
+}
+
+static void free_files(struct buffer *files, int nfiles) {
+    for (int i = 0; i < nfiles; i++)
+        free(files[i].data);
+}
+
+static void random_letters(char *key, int len) {
+    for (int i = 0; i < len; i++)
+        key[i] = (below(2)? 'a' : 'A') + below(26);
+    key[len] = '\0';
+}
+
+static void random_job(struct job *j, int cipher) {
+    memset(j, 0, sizeof(*j));
+    j->cipher = cipher;
+    j->multiplier = 1;
+    j->decrypt = below(2);
+    j->progress = below(2);
+
+    switch ( cipher ) {
+        case SHIFT:
+            j->kind = "\0skkcrbaz"[below(9)];
+            if ( j->kind == 'b' )
+                j->multiplier = 25;
+            else if ( below(2) )
+                j->multiplier = multipliers[below(11)];
+            j->shift = 1 + below(25);
+            random_letters(j->key, 1 + below(below(4)? 8 : 60));
+            break;
+        case XOR: {
+            int len = 1 + below(below(5)? 12 : 100);
+            for (int i = 0; i < len; i++)
+                j->key[i] = below(2)? ' ' + below(95) : 1 + below(255);
+            j->key[len] = '\0';
+            break;
+        }
+        case PLAYFAIR:
+            random_letters(j->key, 1 + below(30));
+            break;
+        case BLOCK:
+            j->block_size = below(5)? 1 + (int) below(12) : -2 + (int) below(3);
+            j->nblocks = -1 + (int) below(8);
+            break;
+    }
+}
+
+/* The keyword shift would have made from its options. */
+static void shift_keyword(const struct job *j, int *keyword) {
+    int length = 1;
+
+    switch ( j->kind ) {
+        case 's': keyword[0] = j->shift; break;
+        case 'c': keyword[0] = 3; break;
+        case 'r': keyword[0] = 13; break;
+        case 'b': keyword[0] = 25; break;
+        case 'a': case 'z':
+            for (int i = 0; i < 26; i++)
+                keyword[i] = (j->kind == 'a')? i : 25 - i;
+            length = 26;
+            break;
+        case 'k':
+            length = strlen(j->key);
+            for (int i = 0; i < length; i++)
+                keyword[i] = (j->key[i] | 0x20) - 'a';
+            break;
+        default: keyword[0] = 0; break;
+    }
+    keyword[length] = -1;
+}
+
+/*
+ * The reference output of one run of the original tool on files,
+ * the state carrying on from one file to the next as it did.
+ */
+static struct buffer reference(const struct job *j, const struct buffer *files,
+                               int nfiles) {
+    struct buffer out;
+    char *data;
+    int keyword[130];
+    char key[128];
+    FILE *o = open_memstream(&data, &out.len);
+
+    if ( o == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    ref_reset();
+    shift_keyword(j, keyword);
+    strcpy(key, j->key);
+    if ( j->cipher == PLAYFAIR )
+        ref_playfair_init(key, j->progress, j->decrypt);
+
+    for (int i = 0; i < nfiles; i++) {
+        FILE *fp = files[i].len? fmemopen(files[i].data, files[i].len, "r")
+                               : fopen("/dev/null", "r");
+        if ( fp == NULL ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+
+        switch ( j->cipher ) {
+            case SHIFT:
+                ref_shift(fp, o, keyword, j->multiplier,
+                          (j->decrypt? REF_DECRYPT : 0)
+                          | (j->progress? REF_PROGRESS : 0));
+                break;
+            case XOR:
+                ref_xor(fp, o, key);
+                break;
+            case PLAYFAIR:
+                ref_playfair(fp, o);
+                break;
+            case BLOCK:
+                ref_block(fp, o, j->block_size > 0? j->block_size : 5,
+                          j->nblocks > 0? j->nblocks : 0);
+                break;
+        }
+
+        fclose(fp);
+    }
+
+    fclose(o);
+    out.data = (unsigned char *) data;
+    return out;
+}
+
+static void push(struct args *a, const char *format, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, format);
+    n = vsnprintf(a->store + a->used, sizeof(a->store) - a->used, format, ap);
+    va_end(ap);
+    if ( n < 0 || a->used + n >= sizeof(a->store) || a->n + 1 >= 64 ) {
+        fprintf(stderr, "%s: Command line too long.\n", invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    a->v[a->n++] = a->store + a->used;
+    a->v[a->n] = NULL;
+    a->used += n + 1;
+}
+
+/* The options the tool takes for j, ending with its keyword if any. */
+static void job_args(struct args *a, const struct job *j) {
+    switch ( j->cipher ) {
+        case SHIFT:
+            if ( j->multiplier != 1 && j->kind != 'b' )
+                push(a, "-m%d", j->multiplier);
+            if ( j->kind == 's' )
+                push(a, "-s%d", j->shift);
+            else if ( j->kind == 'k' )
+                push(a, "-k%s", j->key);
+            else if ( j->kind != 0 )
+                push(a, "-%c", j->kind);
+            if ( j->progress )
+                push(a, "-p");
+            if ( j->decrypt )
+                push(a, "-d");
+            break;
+        case XOR:
+            push(a, "--");
+            push(a, "%s", j->key);
+            break;
+        case PLAYFAIR:
+            if ( j->progress )
+                push(a, "-p");
+            if ( j->decrypt )
+                push(a, "-d");
+            push(a, "--");
+            push(a, "%s", j->key);
+            break;
+        case BLOCK:
+            push(a, "-b%d", j->block_size);
+            push(a, "-n%d", j->nblocks);
+            break;
+    }
+}
+
+/* The same as a pipeline stage. */
+static void job_stage(char *s, size_t size, const struct job *j) {
+    size_t n = snprintf(s, size, "%s", cipher_names[j->cipher]);
+    const char *sep = ":";
+
+#define ADD(...) ( n += snprintf(s + n, size - n, "%s", sep), \
+                   n += snprintf(s + n, size - n, __VA_ARGS__), sep = "," )
+    switch ( j->cipher ) {
+        case SHIFT:
+            if ( j->multiplier != 1 && j->kind != 'b' )
+                ADD("m=%d", j->multiplier);
+            if ( j->kind == 's' )
+                ADD("s=%d", j->shift);
+            else if ( j->kind == 'k' )
+                ADD("k=%s", j->key);
+            else if ( j->kind != 0 )
+                ADD("%c", j->kind);
+            if ( j->progress )
+                ADD("p");
+            if ( j->decrypt )
+                ADD("d");
+            break;
+        case XOR:
+            ADD("%s", j->key);
+            break;
+        case PLAYFAIR:
+            ADD("%s", j->key);
+            if ( j->progress )
+                ADD("p");
+            if ( j->decrypt )
+                ADD("d");
+            break;
+        case BLOCK:
+            ADD("b=%d", j->block_size);
+            ADD("n=%d", j->nblocks);
+            break;
+    }
+#undef ADD
+}
+
+/*
+ * pipeline splits its stages on | and trims the space round them,
+ * so xor keywords with those can't be given to it.
+ */
+static int pipeline_safe(const struct job *j) {
+    size_t len = strlen(j->key);
+    return j->cipher != XOR || ( strchr(j->key, '|') == NULL
+        && strchr(" \t\n\v\f\r", j->key[0]) == NULL
+        && strchr(" \t\n\v\f\r", j->key[len - 1]) == NULL );
+}
+
+/* Prints s with anything unprintable escaped. */
+static void print_escaped(FILE *fp, const char *s) {
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if ( c < ' ' || c > '~' || c == '\\' )
+            fprintf(fp, "\\x%02x", c);
+        else
+            fputc(c, fp);
+    }
+}
+
+static void print_args(FILE *fp, const struct args *a) {
+    for (int i = 0; i < a->n; i++) {
+        fputc(' ', fp);
+        print_escaped(fp, a->v[i]);
+    }
+}
+
+static void write_file(const char *path, const unsigned char *data, size_t len) {
+    FILE *fp = fopen(path, "wb");
+    if ( fp == NULL || fwrite(data, 1, len, fp) != len || fclose(fp) == EOF ) {
+        fprintf(stderr, "%s: ", invoc_name);
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static struct buffer read_file(const char *path) {
+    struct buffer b = { NULL, 0 };
+    struct stat st;
+    FILE *fp = fopen(path, "rb");
+
+    if ( fp == NULL || fstat(fileno(fp), &st) == -1 ) {
+        fprintf(stderr, "%s: ", invoc_name);
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    b.data = xmalloc(st.st_size);
+    b.len = fread(b.data, 1, st.st_size, fp);
+    fclose(fp);
+    return b;
+}
+
+/* Writes the files of a failing case somewhere they'll be kept. */
+static void save_files(const struct buffer *files, int nfiles) {
+    char dir[PATH_MAX], path[PATH_MAX + 16];
+    const char *tmp = getenv("TMPDIR");
+
+    snprintf(dir, sizeof(dir), "%s/verify-failure.XXXXXX",
+             tmp != NULL? tmp : "/tmp");
+    if ( mkdtemp(dir) == NULL ) {
+        perror(invoc_name);
+        return;
+    }
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        write_file(path, files[i].data, files[i].len);
+    }
+    fprintf(stderr, "  the input files are in %s\n", dir);
+}
+
+static void print_bytes(const char *name, const struct buffer *b, size_t at) {
+    size_t from = at < 8? 0 : at - 8;
+
+    fprintf(stderr, "  %-9s", name);
+    for (size_t i = from; i < at + 8 && i < b->len; i++)
+        fprintf(stderr, i == at? " [%02x]" : " %02x", b->data[i]);
+    if ( at >= b->len )
+        fprintf(stderr, " [end]");
+    fputc('\n', stderr);
+}
+
+/*
+ * Reports where got first differs from expected, the case that did
+ * it and how to run it again, and gives up: one divergence is enough
+ * to go on.
+ */
+static void diverged(const struct job *j, const char *path,
+                     const struct buffer *files, int nfiles,
+                     const struct buffer *expected, const struct buffer *got) {
+    struct args a = { .n = 0, .used = 0 };
+    size_t at = 0;
+
+    while ( at < expected->len && at < got->len
+         && expected->data[at] == got->data[at] )
+        at++;
+
+    push(&a, "%s", cipher_names[j->cipher]);
+    job_args(&a, j);
+    fprintf(stderr, "%s: Diverged from the reference:", invoc_name);
+    print_args(stderr, &a);
+    fprintf(stderr, "\n  by %s\n  on %d file%s of", path, nfiles,
+            nfiles == 1? "" : "s");
+    for (int i = 0; i < nfiles; i++)
+        fprintf(stderr, "%s %zu", i? "," : "", files[i].len);
+    fprintf(stderr, " bytes\n  first at byte %zu, expected %zu bytes, got %zu\n",
+            at, expected->len, got->len);
+    print_bytes("expected", expected, at);
+    print_bytes("got", got, at);
+    save_files(files, nfiles);
+    fprintf(stderr, "  case %d, run again with %s -s %llu -n %d%s%s\n",
+            case_number, invoc_name, seed, cases,
+            tools_dir? " --tools " : "", tools_dir? tools_dir : "");
+    if ( tools_dir != NULL )
+        fprintf(stderr, "  the tools' last input and output are in %s\n",
+                work_dir);
+    exit(EXIT_FAILURE);
+}
+
+static void compare(const struct job *j, const char *path,
+                    const struct buffer *files, int nfiles,
+                    const struct buffer *expected, const struct buffer *got) {
+    if ( expected->len != got->len
+      || memcmp(expected->data, got->data, got->len) != 0 )
+        diverged(j, path, files, nfiles, expected, got);
+    comparisons[j->cipher]++;
+}
+
+/*
+ * How the library is fed each file: whole, split once at a byte, a
+ * byte at a time or in random lengths.
+ */
+enum { WHOLE, SPLIT, BYTEWISE, RANDOM };
+
+struct cuts {
+    int how;
+    int file;
+    size_t at;
+};
+
+static size_t next_cut(const struct cuts *c, int file, size_t pos, size_t len) {
+    switch ( c->how ) {
+        case SPLIT:
+            if ( file == c->file && pos < c->at )
+                return c->at - pos;
+            return len - pos;
+        case BYTEWISE:
+            return len - pos? 1 : 0;
+        case RANDOM: {
+            size_t n = below(4)? below(64) : below(1 << 18);
+            return n < len - pos? n : len - pos;
+        }
+        default:
+            return len - pos;
+    }
+}
+
+static size_t total_length(const struct buffer *files, int nfiles) {
+    size_t total = 0;
+    for (int i = 0; i < nfiles; i++)
+        total += files[i].len;
+    return total;
+}
+
+/* The library encrypting files as the tool would, fed as c says. */
+static struct buffer library(const struct job *j, const struct buffer *files,
+                             int nfiles, const struct cuts *c) {
+    struct buffer out;
+    int keyword[130];
+    struct shift_ctx shift;
+    struct xor_ctx xor;
+    struct playfair_ctx playfair;
+    struct block_ctx block;
+    int failed = 0;
+
+    out.data = xmalloc(2 * total_length(files, nfiles) + 2 * nfiles);
+    out.len = 0;
+
+    switch ( j->cipher ) {
+        case SHIFT:
+            shift_keyword(j, keyword);
+            failed = shift_init(&shift, keyword, j->multiplier,
+                                (j->decrypt? SHIFT_DECRYPT : 0)
+                                | (j->progress? SHIFT_PROGRESS : 0));
+            break;
+        case XOR:
+            failed = xor_init(&xor, j->key);
+            break;
+        case PLAYFAIR:
+            failed = playfair_init(&playfair, j->key,
+                                   (j->decrypt? PLAYFAIR_DECRYPT : 0)
+                                   | (j->progress? PLAYFAIR_PROGRESS : 0));
+            break;
+        case BLOCK:
+            block_init(&block, j->block_size, j->nblocks);
+            break;
+    }
+    if ( failed ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int f = 0; f < nfiles; f++) {
+        const unsigned char *in = files[f].data;
+        size_t len = files[f].len;
+
+        if ( j->cipher == XOR )
+            xor_reset(&xor);
+
+        for (size_t pos = 0, n; pos < len; pos += n) {
+            n = next_cut(c, f, pos, len);
+            switch ( j->cipher ) {
+                case SHIFT:
+                    if ( shift_update(&shift, out.data + out.len, in + pos, n) ) {
+                        perror(invoc_name);
+                        exit(EXIT_FAILURE);
+                    }
+                    out.len += n;
+                    break;
+                case XOR:
+                    out.len += xor_update(&xor, out.data + out.len, in + pos, n);
+                    break;
+                case PLAYFAIR:
+                    out.len += playfair_update(&playfair, out.data + out.len,
+                                               in + pos, n);
+                    break;
+                case BLOCK:
+                    out.len += block_update(&block, out.data + out.len,
+                                            in + pos, n);
+                    break;
+            }
+        }
+
+        if ( j->cipher == PLAYFAIR )
+            out.len += playfair_final(&playfair, out.data + out.len);
+    }
+
+    if ( j->cipher == SHIFT )
+        shift_free(&shift);
+    else if ( j->cipher == XOR )
+        xor_free(&xor);
+    return out;
+}
+
+/*
+ * As the tools encrypt large inputs with -j and -o: each piece from
+ * a copy of the key as it started, moved on to where the piece
+ * starts, by the letters before it for shift and the bytes for xor.
+ */
+static struct buffer library_pieces(const struct job *j,
+                                    const struct buffer *files, int nfiles) {
+    struct buffer out;
+    int keyword[130];
+    struct shift_ctx shift, piece;
+    struct xor_ctx xor;
+    unsigned long long letters = 0;
+    int failed;
+
+    out.data = xmalloc(total_length(files, nfiles));
+    out.len = 0;
+
+    if ( j->cipher == SHIFT ) {
+        shift_keyword(j, keyword);
+        failed = shift_init(&shift, keyword, j->multiplier,
+                            (j->decrypt? SHIFT_DECRYPT : 0)
+                            | (j->progress? SHIFT_PROGRESS : 0));
+    } else {
+        failed = xor_init(&xor, j->key);
+    }
+    if ( failed ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int f = 0; f < nfiles; f++) {
+        const unsigned char *in = files[f].data;
+        size_t len = files[f].len;
+
+        for (size_t pos = 0, n; pos < len; pos += n) {
+            n = 1 + below(below(2)? 100 : 1 << 16);
+            if ( n > len - pos )
+                n = len - pos;
+
+            if ( j->cipher == SHIFT ) {
+                if ( shift_copy(&piece, &shift) ) {
+                    perror(invoc_name);
+                    exit(EXIT_FAILURE);
+                }
+                shift_skip(&piece, letters);
+                shift_update(&piece, out.data + out.len, in + pos, n);
+                letters += shift_count_letters(in + pos, n);
+                shift_free(&piece);
+            } else {
+                xor_seek(&xor, pos);
+                xor_update(&xor, out.data + out.len, in + pos, n);
+            }
+            out.len += n;
+        }
+    }
+
+    if ( j->cipher == SHIFT )
+        shift_free(&shift);
+    else
+        xor_free(&xor);
+    return out;
+}
+
+static void check_cuts(const struct job *j, const struct buffer *files,
+                       int nfiles, const struct buffer *expected,
+                       const struct cuts *c, const char *kernel) {
+    char path[128];
+    struct buffer got = library(j, files, nfiles, c);
+    int n = snprintf(path, sizeof(path), "the library%s%s%s", kernel? ", " : "",
+                     kernel? kernel : "", kernel? " kernel" : "");
+
+    switch ( c->how ) {
+        case WHOLE:
+            snprintf(path + n, sizeof(path) - n, ", each file whole");
+            break;
+        case SPLIT:
+            snprintf(path + n, sizeof(path) - n, ", file %d split at byte %zu",
+                     c->file, c->at);
+            break;
+        case BYTEWISE:
+            snprintf(path + n, sizeof(path) - n, ", a byte at a time");
+            break;
+        case RANDOM:
+            snprintf(path + n, sizeof(path) - n, ", in random lengths");
+            break;
+    }
+
+    compare(j, path, files, nfiles, expected, &got);
+    free(got.data);
+}
+
+/*
+ * j on files against the reference, with each shift or xor kernel. Only
+ * thorough checks feed the library a byte at a time and split short
+ * inputs at every byte, as they take a while.
+ */
+static void check_library(const struct job *j, const struct buffer *files,
+                          int nfiles, int thorough) {
+    struct buffer expected = reference(j, files, nfiles);
+    size_t total = total_length(files, nfiles);
+    int nruns = j->cipher == SHIFT? nkernels
+              : j->cipher == XOR? nxor_kernels : 1;
+
+    for (int k = 0; k < nruns; k++) {
+        const char *kernel = NULL;
+        struct cuts c = { WHOLE, 0, 0 };
+
+        if ( j->cipher == SHIFT )
+            shift_set_kernel(kernel = kernels[k]);
+        else if ( j->cipher == XOR )
+            xor_set_kernel(kernel = xor_kernels[k]);
+
+        check_cuts(j, files, nfiles, &expected, &c, kernel);
+
+        c.how = RANDOM;
+        check_cuts(j, files, nfiles, &expected, &c, kernel);
+
+        if ( thorough && total <= BYTEWISE_MAX ) {
+            c.how = BYTEWISE;
+            check_cuts(j, files, nfiles, &expected, &c, kernel);
+        }
+
+        if ( thorough && total <= EXHAUSTIVE_MAX ) {
+            c.how = SPLIT;
+            for (c.file = 0; c.file < nfiles; c.file++)
+                for (c.at = 1; c.at < files[c.file].len; c.at++)
+                    check_cuts(j, files, nfiles, &expected, &c, kernel);
+        }
+
+        if ( j->cipher == SHIFT || j->cipher == XOR ) {
+            struct buffer got = library_pieces(j, files, nfiles);
+            char path[128];
+            snprintf(path, sizeof(path), "the library%s%s%s, in pieces each "
+                     "started from its offset", kernel? ", " : "",
+                     kernel? kernel : "", kernel? " kernel" : "");
+            compare(j, path, files, nfiles, &expected, &got);
+            free(got.data);
+        }
+    }
+
+    if ( j->cipher == SHIFT )
+        shift_set_kernel(kernels[0]);
+    else if ( j->cipher == XOR )
+        xor_set_kernel(xor_kernels[0]);
+    free(expected.data);
+}
+
+/*
+ * Every combination of options, rather than a random few, on the
+ * same adversarial input: each way of giving shift a key with each
+ * multiplier, progressing and decrypting or not, and so on.
+ */
+static void sweep(int cipher) {
+    static const char *shift_keys[] = { "lemon", "a", "Z",
+        "averyveryverylongkeywordthatisoverthirtytwolettersintotal", };
+    static const char *xor_keys[] = { "a", "lemon", "\xff", "\x80\x01\x7f",
+        "long key with spaces 1234567890abcdefghijklmnopqrstuvwxyz0123456789",
+        "key|with,separators:", };
+    static const char *playfair_keys[] = { "keyword", "playfair", "Z", "jjj",
+        "X", "QUIZ", "thequickbrownfoxjumpsoverthelazydog", };
+    static const unsigned char doubles[] =
+        "XXxxJjJJaabbzz@[`{ XQXXQ jJ ii aAaA x";
+    struct buffer files[MAX_FILES];
+    int nfiles = 3;
+    struct job j;
+
+    /* The same input whatever the seed. */
+    random_state = 0x9e3779b97f4a7c15ULL;
+    files[0].len = sizeof(doubles) - 1;
+    files[0].data = xmalloc(files[0].len);
+    memcpy(files[0].data, doubles, files[0].len);
+    for (int i = 1; i < nfiles; i++) {
+        files[i].len = i == 1? 517 : 3000;
+        files[i].data = xmalloc(files[i].len);
+        fill(files[i].data, files[i].len);
+    }
+    case_number = 0;
+
+    memset(&j, 0, sizeof(j));
+    j.cipher = cipher;
+    for (int options = 0; options < 4; options++) {
+        j.decrypt = options & 1;
+        j.progress = options >> 1 & 1;
+
+        switch ( cipher ) {
+            case SHIFT:
+                for (int m = -1; m < 11; m++) {
+                    j.multiplier = m < 0? 1 : multipliers[m];
+                    for (int k = 0; k < 8; k++) {
+                        j.kind = "\0scrbazk"[k];
+                        if ( j.kind == 'b' && j.multiplier != 25 )
+                            continue;
+                        int n = j.kind == 's'? 25 : j.kind == 'k'? 4 : 1;
+                        for (int i = 0; i < n; i++) {
+                            j.shift = i + 1;
+                            strcpy(j.key, shift_keys[i % 4]);
+                            check_library(&j, files, nfiles, 0);
+                        }
+                    }
+                }
+                break;
+            case XOR:
+                if ( options )
+                    break;
+                for (int k = 0; k < 6; k++) {
+                    strcpy(j.key, xor_keys[k]);
+                    check_library(&j, files, nfiles, 0);
+                }
+                break;
+            case PLAYFAIR:
+                for (int k = 0; k < 7; k++) {
+                    strcpy(j.key, playfair_keys[k]);
+                    check_library(&j, files, nfiles, 0);
+                }
+                break;
+            case BLOCK:
+                if ( options )
+                    break;
+                for (j.block_size = -1; j.block_size <= 12; j.block_size++)
+                    for (j.nblocks = -1; j.nblocks <= 6; j.nblocks++)
+                        check_library(&j, files, nfiles, 0);
+                break;
+        }
+    }
+
+    free_files(files, nfiles);
+    random_state = ( seed ^ (cipher + 1) * 0x9e3779b97f4a7c15ULL ) | 1;
+}
+
+static void cleanup_outputs(void) {
+    char path[32];
+    for (int i = 0; i < MAX_FILES; i++) {
+        snprintf(path, sizeof(path), "o/f%d", i);
+        unlink(path);
+    }
+    rmdir("o");
+}
+
+/*
+ * Runs the tool a names with files in the working directory, in the
+ * environment setting env if not NULL and with stdin from input,
+ * or nothing. Returns what it wrote to stdout; if it fails instead
+ * that is a divergence too.
+ */
+static struct buffer run_tool(const struct job *j, const struct args *a,
+                              const char *env, const char *input,
+                              const struct buffer *files, int nfiles) {
+    char path[PATH_MAX];
+    int status;
+    pid_t pid;
+
+    snprintf(path, sizeof(path), "%s/%s", tools_dir, a->v[0]);
+    fflush(stdout);
+
+    if ( ( pid = fork() ) == -1 ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    if ( pid == 0 ) {
+        int in = open(input? input : "/dev/null", O_RDONLY);
+        int out = open("out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int err = open("err", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if ( in == -1 || out == -1 || err == -1 ) {
+            perror(invoc_name);
+            _exit(127);
+        }
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+        if ( env != NULL ) {
+            char name[64];
+            const char *value = strchr(env, '=');
+            snprintf(name, sizeof(name), "%.*s", (int) (value - env), env);
+            setenv(name, value + 1, 1);
+        }
+        execv(path, a->v);
+        perror(path);
+        _exit(127);
+    }
+
+    if ( waitpid(pid, &status, 0) == -1 ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    if ( !WIFEXITED(status) || WEXITSTATUS(status) != 0 ) {
+        struct buffer err = read_file("err");
+        fprintf(stderr, "%s: Failed:%s%s", invoc_name, env? " " : "",
+                env? env : "");
+        print_args(stderr, a);
+        fprintf(stderr, "%s%s\n", input? " < " : "", input? input : "");
+        fwrite(err.data, 1, err.len, stderr);
+        save_files(files, nfiles);
+        fprintf(stderr, "  case %d, run again with %s -s %llu -n %d --tools %s\n",
+                case_number, invoc_name, seed, cases, tools_dir);
+        exit(EXIT_FAILURE);
+    }
+
+    return read_file("out");
+}
+
+/* Runs a and compares its output with expected. */
+static void check_run(const struct job *j, const struct args *a,
+                      const char *env, const char *input,
+                      const struct buffer *files, int nfiles,
+                      const struct buffer *expected) {
+    char path[2048];
+    FILE *fp = fmemopen(path, sizeof(path), "w");
+    struct buffer got = run_tool(j, a, env, input, files, nfiles);
+
+    fprintf(fp, "%s%s", env? env : "", env? " " : "");
+    for (int i = 0; i < a->n; i++) {
+        fputs(i? " " : "", fp);
+        print_escaped(fp, a->v[i]);
+    }
+    fprintf(fp, "%s%s", input? " < " : "", input? input : "");
+    fputc('\0', fp);
+    fclose(fp);
+
+    compare(j, path, files, nfiles, expected, &got);
+    free(got.data);
+}
+
+/* Starts a command line for j's tool, up to its files. */
+static void tool_args(struct args *a, const struct job *j, const char *extra, ...) {
+    va_list ap;
+    const char *arg;
+
+    a->n = 0;
+    a->used = 0;
+    push(a, "%s", cipher_names[j->cipher]);
+    va_start(ap, extra);
+    for (arg = extra; arg != NULL; arg = va_arg(ap, const char *))
+        push(a, "%s", arg);
+    va_end(ap);
+    job_args(a, j);
+}
+
+static void add_files(struct args *a, const char *prefix, int nfiles) {
+    for (int i = 0; i < nfiles; i++)
+        push(a, "%s%d", prefix, i);
+}
+
+static struct buffer slice(const struct buffer *b, size_t from, size_t len) {
+    struct buffer s;
+    if ( from > b->len )
+        from = b->len;
+    s.data = b->data + from;
+    s.len = len < b->len - from? len : b->len - from;
+    return s;
+}
+
+/* The files as pipeline --batch length takes them, as records. */
+static struct buffer frame(const struct buffer *records, int n) {
+    struct buffer b;
+    b.data = xmalloc(total_length(records, n) + 4 * n);
+    b.len = 0;
+    for (int i = 0; i < n; i++) {
+        size_t len = records[i].len;
+        b.data[b.len++] = len >> 24;
+        b.data[b.len++] = len >> 16;
+        b.data[b.len++] = len >> 8;
+        b.data[b.len++] = len;
+        memcpy(b.data + b.len, records[i].data, len);
+        b.len += len;
+    }
+    return b;
+}
+
+/* How many of the files playfair pads at the end, with a letter over. */
+static unsigned long final_padding(const struct buffer *files, int nfiles) {
+    unsigned long padded = 0;
+
+    for (int i = 0; i < nfiles; i++) {
+        int left = 0, first = 0;
+
+        for (size_t k = 0; k < files[i].len; k++) {
+            int c = files[i].data[k];
+            if ( !isalpha(c) )
+                continue;
+            c = toupper(c) == 'J'? 'I' : toupper(c);
+
+            /* A doubled letter starts the next pair after its X or Q. */
+            if ( !left || c == first ) {
+                first = c;
+                left = 1;
+            } else {
+                left = 0;
+            }
+        }
+        padded += left;
+    }
+    return padded;
+}
+
+/*
+ * playfair --stats counts a grid progression for each digraph when
+ * progressing, except the padded ones at the end of each file.
+ */
+static void check_progressions(const struct job *j, const struct args *a,
+                               const struct buffer *files, int nfiles,
+                               const struct buffer *expected) {
+    struct buffer err = read_file("err");
+    unsigned long want = j->progress? expected->len / 2
+                                      - final_padding(files, nfiles) : 0;
+    unsigned long got = 0;
+    char *line, *text = xmalloc(err.len + 1);
+
+    memcpy(text, err.data, err.len);
+    text[err.len] = '\0';
+    line = strstr(text, " grid progressions");
+    while ( line != NULL && line > text && isdigit((unsigned char) line[-1]) )
+        line--;
+
+    if ( line == NULL || sscanf(line, "%lu", &got) != 1 || got != want ) {
+        fprintf(stderr, "%s: Wrong grid progressions from", invoc_name);
+        print_args(stderr, a);
+        fprintf(stderr, "\n  expected %lu, got %s", want,
+                line? line : "none\n");
+        save_files(files, nfiles);
+        fprintf(stderr, "  case %d, run again with %s -s %llu -n %d --tools %s\n",
+                case_number, invoc_name, seed, cases, tools_dir);
+        exit(EXIT_FAILURE);
+    }
+    comparisons[j->cipher]++;
+
+    free(text);
+    free(err.data);
+}
+
+/*
+ * The tools themselves, over every path through them: files, stdin,
+ * threads, asynchronous I/O both ways, batch mode, in place, ranges
+ * and pipeline, each against the reference for what that path means.
+ */
+static void check_tools(const struct job *j, const struct buffer *files,
+                        int nfiles) {
+    static const char *async_env[] = { NULL, "CIPHERS_IO=threads" };
+    struct buffer expected = reference(j, files, nfiles);
+    struct buffer all, alone[MAX_FILES], got;
+    struct args a;
+    char path[32], stage[512];
+
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), "f%d", i);
+        write_file(path, files[i].data, files[i].len);
+        alone[i] = reference(j, &files[i], 1);
+    }
+
+    /* stdin is one file of them all. */
+    all.len = total_length(files, nfiles);
+    all.data = xmalloc(all.len);
+    for (int i = 0, n = 0; i < nfiles; n += files[i++].len)
+        memcpy(all.data + n, files[i].data, files[i].len);
+    write_file("all", all.data, all.len);
+    struct buffer expected_all = reference(j, &all, 1);
+
+    tool_args(&a, j, NULL);
+    add_files(&a, "f", nfiles);
+    check_run(j, &a, NULL, NULL, files, nfiles, &expected);
+
+    tool_args(&a, j, NULL);
+    check_run(j, &a, NULL, "all", files, nfiles, &expected_all);
+
+    for (int e = 0; e < 2; e++) {
+        tool_args(&a, j, "--async-io", NULL);
+        add_files(&a, "f", nfiles);
+        check_run(j, &a, async_env[e], NULL, files, nfiles, &expected);
+
+        tool_args(&a, j, "--async-io", NULL);
+        check_run(j, &a, async_env[e], "all", files, nfiles, &expected_all);
+    }
+
+    /* Batch mode encrypts each file on its own. */
+    for (int jobs = 1; jobs <= 3; jobs += 2) {
+        tool_args(&a, j, "-j", jobs == 1? "1" : "3", "-o", "o", NULL);
+        add_files(&a, "f", nfiles);
+        run_tool(j, &a, NULL, NULL, files, nfiles);
+        for (int i = 0; i < nfiles; i++) {
+            snprintf(path, sizeof(path), "o/f%d", i);
+            got = read_file(path);
+            snprintf(stage, sizeof(stage), "%s -j %d -o o, output o/f%d",
+                     cipher_names[j->cipher], jobs, i);
+            compare(j, stage, files, nfiles, &alone[i], &got);
+            free(got.data);
+        }
+        cleanup_outputs();
+    }
+
+    if ( j->cipher == SHIFT || j->cipher == XOR ) {
+        tool_args(&a, j, "-j", "3", NULL);
+        add_files(&a, "f", nfiles);
+        check_run(j, &a, NULL, NULL, files, nfiles, &expected);
+
+        tool_args(&a, j, "-j", "3", NULL);
+        check_run(j, &a, NULL, "all", files, nfiles, &expected_all);
+
+        /* In place, each file's part of the output replaces it. */
+        for (int i = 0; i < nfiles; i++) {
+            snprintf(path, sizeof(path), "i%d", i);
+            write_file(path, files[i].data, files[i].len);
+        }
+        tool_args(&a, j, "-i", NULL);
+        add_files(&a, "i", nfiles);
+        run_tool(j, &a, NULL, NULL, files, nfiles);
+        for (int i = 0, n = 0; i < nfiles; n += files[i++].len) {
+            struct buffer part = slice(&expected, n, files[i].len);
+            snprintf(path, sizeof(path), "i%d", i);
+            got = read_file(path);
+            unlink(path);
+            snprintf(stage, sizeof(stage), "%s -i, file i%d",
+                     cipher_names[j->cipher], i);
+            compare(j, stage, files, nfiles, &part, &got);
+            free(got.data);
+        }
+
+        /* A range of the first file is that part of its output. */
+        for (int r = 0; r < 3; r++) {
+            char offset[32], length[32];
+            size_t from = below(files[0].len + 2);
+            size_t len = below(2)? below(files[0].len + 2) : below(100);
+            struct buffer part = slice(&alone[0], from, len);
+
+            snprintf(offset, sizeof(offset), "%zu", from);
+            snprintf(length, sizeof(length), "%zu", len);
+            tool_args(&a, j, "--offset", offset, "--length", length, NULL);
+            push(&a, "f0");
+            check_run(j, &a, NULL, NULL, files, nfiles, &part);
+        }
+    }
+
+    if ( j->cipher == SHIFT ) {
+        for (int k = 0; k < nkernels; k++) {
+            tool_args(&a, j, "--kernel", kernels[k], NULL);
+            add_files(&a, "f", nfiles);
+            check_run(j, &a, NULL, NULL, files, nfiles, &expected);
+        }
+
+        /*
+         * An index written encrypting the first file lets a range of
+         * the result be undone from the nearest checkpoint.
+         */
+        struct job undo = *j;
+        undo.decrypt = !j->decrypt;
+        tool_args(&a, j, "--index", "idx", NULL);
+        push(&a, "f0");
+        check_run(j, &a, NULL, NULL, files, nfiles, &alone[0]);
+        rename("out", "enc");
+
+        struct buffer enc = read_file("enc");
+        struct buffer undone = reference(&undo, &enc, 1);
+        for (int r = 0; r < 3; r++) {
+            char offset[32], length[32];
+            size_t from = below(enc.len + 1);
+            size_t len = below(2)? enc.len : below(100);
+            struct buffer part = slice(&undone, from, len);
+
+            snprintf(offset, sizeof(offset), "%zu", from);
+            snprintf(length, sizeof(length), "%zu", len);
+            tool_args(&a, &undo, "--index", "idx", "--offset", offset,
+                      "--length", length, NULL);
+            push(&a, "enc");
+            check_run(&undo, &a, NULL, NULL, &enc, 1, &part);
+        }
+        free(enc.data);
+        free(undone.data);
+        unlink("enc");
+        unlink("idx");
+    }
+
+    if ( j->cipher == PLAYFAIR ) {
+        tool_args(&a, j, "--stats", NULL);
+        add_files(&a, "f", nfiles);
+        check_run(j, &a, NULL, NULL, files, nfiles, &expected);
+        check_progressions(j, &a, files, nfiles, &expected);
+
+        tool_args(&a, j, "--stats", "-o", "o", NULL);
+        add_files(&a, "f", nfiles);
+        run_tool(j, &a, NULL, NULL, files, nfiles);
+        check_progressions(j, &a, files, nfiles, &expected);
+        cleanup_outputs();
+    }
+
+    if ( pipeline_safe(j) ) {
+        struct buffer records = frame(files, nfiles);
+        struct buffer results = frame(alone, nfiles);
+
+        job_stage(stage, sizeof(stage), j);
+        a.n = a.used = 0;
+        push(&a, "pipeline");
+        push(&a, "%s", stage);
+        add_files(&a, "f", nfiles);
+        check_run(j, &a, NULL, NULL, files, nfiles, &expected);
+
+        write_file("records", records.data, records.len);
+        a.n = a.used = 0;
+        push(&a, "pipeline");
+        push(&a, "--batch");
+        push(&a, "length");
+        push(&a, "%s", stage);
+        check_run(j, &a, NULL, "records", files, nfiles, &results);
+        unlink("records");
+
+        free(records.data);
+        free(results.data);
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), "f%d", i);
+        unlink(path);
+        free(alone[i].data);
+    }
+    unlink("all");
+    free(all.data);
+    free(expected.data);
+    free(expected_all.data);
+}
+
+/*
+ * Several stages in pipeline: the first runs over the files as its
+ * tool would and the rest over all of its output as one stream.
+ */
+static void check_pipeline(const struct buffer *files, int nfiles) {
+    struct job stages[4];
+    int nstages = 2 + below(3);
+    struct args a = { .n = 0, .used = 0 };
+    char spec[2048], path[32];
+    size_t n = 0;
+
+    for (int i = 0; i < nstages; i++) {
+        do
+            random_job(&stages[i], below(NCIPHERS));
+        while ( !pipeline_safe(&stages[i]) );
+        n += snprintf(spec + n, sizeof(spec) - n, "%s", i? " | " : "");
+        job_stage(spec + n, sizeof(spec) - n, &stages[i]);
+        n += strlen(spec + n);
+    }
+
+    struct buffer expected = reference(&stages[0], files, nfiles);
+    for (int i = 1; i < nstages; i++) {
+        struct buffer next = reference(&stages[i], &expected, 1);
+        free(expected.data);
+        expected = next;
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), "f%d", i);
+        write_file(path, files[i].data, files[i].len);
+    }
+
+    push(&a, "pipeline");
+    push(&a, "%s", spec);
+    add_files(&a, "f", nfiles);
+
+    /* A divergence is reported against the first stage's options. */
+    check_run(&stages[0], &a, NULL, NULL, files, nfiles, &expected);
+
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), "f%d", i);
+        unlink(path);
+    }
+    free(expected.data);
+}
+
+static void remove_work_dir(void) {
+    unlink("out");
+    unlink("err");
+    if ( chdir("/") == 0 )
+        rmdir(work_dir);
+}
+
+static void print_version() {
+    printf("%s %s\n"
+           "\n"
+           "Written by %s\n",
+           prog_name, prog_version, author);
+}
+
+static void print_help() {
+    printf("Usage: %s [OPTION]...\n"
+           "\n"
+           "Checks the ciphers against the original character at a time\n"
+           "loops of shift, xor, playfair and block, kept as they were.\n"
+           "Random and awkward inputs, as one file or several, are\n"
+           "encrypted with random and then every combination of options\n"
+           "by the library, with each shift and xor kernel the processor\n"
+           "can run, fed whole, split at every byte of short inputs, a\n"
+           "byte at a time and in pieces started part way through. With\n"
+           "--tools the tools are run on them too, over files and stdin,\n"
+           "with threads, --async-io, -o, --in-place, ranges and through\n"
+           "pipeline. The first output that differs from the reference\n"
+           "is reported, with the seed to run the same cases again.\n"
+           "\n"
+           "    -s, --seed N    generate the cases from seed N rather than\n"
+           "                    the time.\n"
+           "    -n, --cases N   try N random cases of each cipher on the\n"
+           "                    library, and one in twenty as many on the\n"
+           "                    tools. Defaults to 300.\n"
+           "        --tools DIR  also check the tools built in DIR.\n"
+           "    -h, --help      display this help and exit.\n"
+           "    -v, --version   display version information and exit.\n",
+           invoc_name);
+}
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include "verify_ref.h"
+
+/*
+ * Copied from the original shift.c, xor.c, playfair.c and block.c.
+ * Only what was needed to run them more than once in a process has
+ * changed: the statics they kept moved out here for ref_reset(),
+ * playfair's options and grid are set up by ref_playfair_init() rather
+ * than main(), shift's options are REF_ ones and printf() became
+ * fprintf() to out. The two changes to playfair's encryption are
+ * noted above ref_playfair().
+ */
+
+static int shift_i = 0;
+static int block_char_pos = 0;
+static int block_block_num = 0;
+
+static int playfair_grid[5][5];
+static int progress_keyword = 0;
+static int decrypt = 0;
+
+void ref_reset(void) {
+    shift_i = 0;
+    block_char_pos = 0;
+    block_block_num = 0;
+}
+
+/* shift.c */
+
+void ref_shift(FILE *fp, FILE *out, int *keyword, int multiplier, int options) {
+    int i = shift_i;
+    int decrypt = options & REF_DECRYPT;
+    int progress_keyword = options & REF_PROGRESS;
+    int first_letter;
+    int c;
+
+    if ( decrypt && multiplier != 1) {
+        /* Can't divide with modular arithmetic,
+         * the inverse of multiplication is multiplication
+         * a a^{-1} = 1 (mod 26)
+         * When solved gives the inverse a^{-1} of multiplication
+         * by a.
+         */
+        int inverse_multipliers[26] = {
+             [3]  =  9, [5]  = 21, [7]  = 15, [9]  =  3,
+             [11] = 19, [15] =  7, [17] = 23, [19] = 11,
+             [21] =  5, [23] = 17, [25] = 25,
+        };
+        multiplier = inverse_multipliers[multiplier];
+    }
+
+    while ( ( c = fgetc(fp) ) != EOF ) {
+        if ( isalpha(c) ) {
+            /* retain this so can restore case after encryption */
+            first_letter = islower(c)? 'a' : 'A';
+            c -= first_letter;
+
+            if ( decrypt ) {
+                c += 26 - keyword[i];
+                c *= multiplier;
+            } else {
+                c *= multiplier;
+                c += keyword[i];
+            }
+
+            c %= 26;
+            c += first_letter; /* revert to character */
+
+            if ( progress_keyword ) {
+                keyword[i]++;
+                keyword[i] %= 26;
+            }
+
+            i++;
+            if ( keyword[i] == -1 )
+                i = 0;
+        }
+
+        fprintf(out, "%c", c);
+    }
+
+    shift_i = i;
+}
+
+/* xor.c */
+
+void ref_xor(FILE *fp, FILE *out, char *keyword) {
+    int c, i = 0;
+    while ( ( c = fgetc(fp) ) != EOF ) {
+        c ^= keyword[i];
+
+        if ( i < strlen(keyword) )
+            i++;
+        else
+            i = 0;
+
+        fprintf(out, "%c", c);
+    }
+}
+
+/* playfair.c */
+
+static void progress_grid() {
+    for (int i = 0; i < 5; i++) {
+        for (int j = 0; j < 5; j++) {
+            if ( playfair_grid[i][j] == 'Z' )
+                playfair_grid[i][j] = 'A';
+            else if ( playfair_grid[i][j] == 'I' )
+                playfair_grid[i][j] = 'K';
+            else
+                playfair_grid[i][j]++;
+        }
+    }
+}
+
+static void fill_in_playfair_grid(char *keyword) {
+    /* nth bit will be the nth letter of the alphabet */
+    int32_t used_letters = 0;
+    int n_spaces_filled = 0;
+
+    for (int i = 0; i < strlen(keyword); i++) {
+        int letter = toupper(keyword[i]);
+
+        /*
+         * There are only 25 spaces in the Playfair
+         * Grid but 26 letters of the alphabet so
+         * one of the spaces has to be used twice.
+         * Thus I doubles up as J.
+         */
+        if (letter == 'J')
+            letter = 'I';
+
+        /* if letter is already in grid skip */
+        if ( used_letters & ( 1 << (letter - 'A') ) )
+            continue;
+        else
+            used_letters |= ( 1 << (letter - 'A') );
+
+        playfair_grid[n_spaces_filled / 5][n_spaces_filled % 5] = letter;
+
+        n_spaces_filled++;
+    }
+
+    /* Fill in any remaining spaces of the grid. */
+    for (int i = 0; i < 26; i++) {
+        if ( n_spaces_filled == 25 )
+            break;
+        if ( i == 'J' - 'A' ) /* Skip J because I has its place */
+            continue;
+        if ( used_letters & (1 << i) )
+            continue;
+
+        playfair_grid[n_spaces_filled / 5][n_spaces_filled % 5] = i + 'A';
+        n_spaces_filled++;
+    }
+
+    return;
+}
+
+void ref_playfair_init(char *keyword, int progress, int decrypting) {
+    progress_keyword = progress;
+    decrypt = decrypting;
+    fill_in_playfair_grid(keyword);
+}
+
+static void encrypt_letters(char *letter_pair) {
+    int row_1, column_1,
+        row_2, column_2;
+    row_1 = row_2 = -1;
+    column_1 = column_2 = -1;
+
+    for (int x = 0; x < 5; x++) {
+        for (int y = 0; y < 5; y++) {
+            if ( playfair_grid[x][y] == letter_pair[0] ) {
+                row_1 = x;
+                column_1 = y;
+            }
+            if ( playfair_grid[x][y] == letter_pair[1] ) {
+                row_2 = x;
+                column_2 = y;
+            }
+
+            if (row_1 != -1 && row_2 != -1)
+                goto END_LOOP;
+        }
+    }
+    END_LOOP:; /* ; meant to be here. So I can break out of the inner loop */
+
+    if ( row_1 == row_2 ) {
+        /* Rule 3 --- shift to the right in the grid */
+        letter_pair[0] = playfair_grid[row_1][(column_1 + (decrypt? 4 : 1)) % 5];
+        letter_pair[1] = playfair_grid[row_2][(column_2 + (decrypt? 4 : 1)) % 5];
+    } else if ( column_1 == column_2 ) {
+        /* Rule 4 --- shift downwards in the grid */
+        letter_pair[0] = playfair_grid[(row_1 + (decrypt? 4 : 1)) % 5][column_1];
+        letter_pair[1] = playfair_grid[(row_2 + (decrypt? 4 : 1)) % 5][column_2];
+    } else {
+        /*
+         * Rule 5 --- swap to different corners of the rectangle
+         * that the letters are in
+         */
+        letter_pair[0] = playfair_grid[row_1][column_2];
+        letter_pair[1] = playfair_grid[row_2][column_1];
+    }
+
+    return;
+}
+
+/*
+ * The pair was printed with printf("%s"), which read on past its two
+ * letters to whatever NUL came next on the stack. The two letters are
+ * what it was meant to print and all the tools have printed since.
+ *
+ * encrypt_letters() also sets column_1 and column_2 to -1 with the
+ * rows. Every letter is in the grid so they were always set before
+ * being used, but gcc can't see that and warns they may not be.
+ */
+void ref_playfair(FILE *fp, FILE *out) {
+    char letter_pair[2] = {0, 0};
+    int i = 0;
+    int c;
+    while ( ( c = fgetc(fp) ) != EOF ) {
+        if ( !isalpha(c) )
+            continue;
+        if ( c == 'j' || c == 'J' )
+            c = 'I';
+
+        letter_pair[i++] = toupper(c);
+
+        if ( i < 2 )
+            continue;
+
+        /*
+         * Rule 2 for Playfair --- duplicate
+         * letters have a low frequency letter
+         * put between them.
+         */
+        int double_letter = 0;
+        if ( letter_pair[0] == letter_pair[1] ) {
+            if ( letter_pair[0] != 'X' )
+                letter_pair[1] = 'X';
+            else
+                letter_pair[1] = 'Q';
+            double_letter = letter_pair[0];
+        }
+
+        encrypt_letters(letter_pair);
+
+        if ( progress_keyword )
+            progress_grid();
+
+        fwrite(letter_pair, 1, 2, out);
+
+        /*
+         * Resetting the letter pair because the one
+         * just handled was two of the same letter
+         * see Rule 2.
+         */
+        if ( double_letter ) {
+            i = 1;
+            letter_pair[0] = double_letter;
+            double_letter = 0;
+        } else {
+            i = 0;
+        }
+    }
+
+    /*
+     * If there is an odd number of letters in the plain text
+     * add an extra one and encrypt
+     */
+    if ( i != 0 ) {
+        letter_pair[1] = (letter_pair[0] != 'X')? 'X' : 'Q';
+        encrypt_letters(letter_pair);
+        fwrite(letter_pair, 1, 2, out);
+    }
+}
+
+/* block.c */
+
+void ref_block(FILE *fp, FILE *out, int block_size, int nblocks) {
+    int c;
+    while ( ( c = fgetc(fp) ) != EOF ) {
+        if ( !isprint(c) || isspace(c) )
+            continue;
+        if ( block_char_pos && block_char_pos % block_size == 0 ) {
+            if ( nblocks )
+                block_block_num++;
+
+            if ( nblocks && block_block_num == nblocks ) {
+                fprintf(out, "\n");
+                block_block_num = 0;
+            } else
+                fprintf(out, " ");
+
+            block_char_pos = 0;
+        }
+        fprintf(out, "%c", c);
+        block_char_pos++;
+    }
+}
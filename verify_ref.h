@@ -0,0 +1,31 @@
+#ifndef VERIFY_REF_H
+#define VERIFY_REF_H
+
+#include <stdio.h>
+
+/*
+ * The tools' original character at a time loops, frozen as they were
+ * before any of them were sped up, for the verifier to check the
+ * library and the tools against. Their behaviour is the definition
+ * of right, quirks and all: the xor keyword's cycle includes its
+ * NUL, shift carries on through the keyword from one file to the
+ * next and playfair pads a doubled letter or an odd one out with X,
+ * or Q for an X. Don't fix or speed these up.
+ *
+ * Each reads fp to its end and writes to out, which can be memory
+ * streams. The state the tools kept in statics for the length of a
+ * run is still kept in statics, so ref_reset() puts it back as a new
+ * run would start. shift's keyword is changed as it progresses, as
+ * it was, and is terminated by -1 as before.
+ */
+enum { REF_NONE = 0, REF_DECRYPT = 1, REF_PROGRESS = 2, };
+
+void ref_reset(void);
+
+void ref_shift(FILE *fp, FILE *out, int *keyword, int multiplier, int options);
+void ref_xor(FILE *fp, FILE *out, char *keyword);
+void ref_playfair_init(char *keyword, int progress, int decrypting);
+void ref_playfair(FILE *fp, FILE *out);
+void ref_block(FILE *fp, FILE *out, int block_size, int nblocks);
+
+#endif
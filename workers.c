@@ -0,0 +1,122 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "workers.h"
+
+struct workers {
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+
+    int nthreads;
+    pthread_t *threads;
+
+    /* The current batch, replaced each time generation goes up. */
+    unsigned long generation;
+    workers_job job;
+    void *arg;
+    int njobs;
+    int next_job;
+    int jobs_done;
+    int stopping;
+};
+
+/* Runs jobs from the current batch until there are none left. */
+static void run_jobs(struct workers *w) {
+    for (;;) {
+        int job = w->next_job;
+        if ( job >= w->njobs )
+            return;
+        w->next_job++;
+
+        pthread_mutex_unlock(&w->lock);
+        w->job(w->arg, job);
+        pthread_mutex_lock(&w->lock);
+
+        if ( ++w->jobs_done == w->njobs )
+            pthread_cond_broadcast(&w->finished);
+    }
+}
+
+static void *worker(void *arg) {
+    struct workers *w = arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while ( !w->stopping && w->generation == seen )
+            pthread_cond_wait(&w->start, &w->lock);
+        if ( w->stopping )
+            break;
+
+        seen = w->generation;
+        run_jobs(w);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+struct workers *workers_start(int nthreads) {
+    struct workers *w = calloc(1, sizeof(*w));
+    if ( w == NULL )
+        return NULL;
+
+    /* The thread calling workers_run() makes up the numbers. */
+    w->threads = calloc(nthreads > 1? nthreads - 1 : 1, sizeof(pthread_t));
+    if ( w->threads == NULL ) {
+        free(w);
+        return NULL;
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->start, NULL);
+    pthread_cond_init(&w->finished, NULL);
+
+    for (int i = 0; i < nthreads - 1; i++) {
+        if ( pthread_create(&w->threads[i], NULL, worker, w) )
+            break;
+        w->nthreads++;
+    }
+
+    return w;
+}
+
+void workers_run(struct workers *w, int njobs, workers_job job, void *arg) {
+    pthread_mutex_lock(&w->lock);
+    w->job = job;
+    w->arg = arg;
+    w->njobs = njobs;
+    w->next_job = 0;
+    w->jobs_done = 0;
+    w->generation++;
+    pthread_cond_broadcast(&w->start);
+
+    run_jobs(w);
+    while ( w->jobs_done < w->njobs )
+        pthread_cond_wait(&w->finished, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void workers_stop(struct workers *w) {
+    pthread_mutex_lock(&w->lock);
+    w->stopping = 1;
+    pthread_cond_broadcast(&w->start);
+    pthread_mutex_unlock(&w->lock);
+
+    for (int i = 0; i < w->nthreads; i++)
+        pthread_join(w->threads[i], NULL);
+
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->start);
+    pthread_cond_destroy(&w->finished);
+    free(w->threads);
+    free(w);
+}
+
+/* The number of threads jobs are run on, counting the caller's. */
+int workers_count(const struct workers *w) {
+    return w->nthreads + 1;
+}
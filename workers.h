@@ -0,0 +1,19 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+/*
+ * A fixed pool of threads for running a batch of independent jobs.
+ * workers_run() hands out job numbers 0 to njobs - 1 to the pool,
+ * with the calling thread joining in, and returns when all of them
+ * have finished.
+ */
+struct workers;
+
+typedef void (*workers_job)(void *arg, int job);
+
+struct workers *workers_start(int nthreads);
+void workers_run(struct workers *w, int njobs, workers_job job, void *arg);
+void workers_stop(struct workers *w);
+int workers_count(const struct workers *w);
+
+#endif
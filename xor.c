@@ -1,14 +1,51 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
 #include <getopt.h>
 
+#include "cipher_io.h"
+#include "ciphers.h"
+#include "workers.h"
+#include "batch.h"
+#include "xor_recover.h"
+
 static char *prog_name = "xor cipher";
 static char *prog_version = "1.0";
 static char *invoc_name = NULL;
 static char *author = "a-chap";
 
+static struct io_writer out;
+static struct io_ahead ahead;
+static int async_io = 0;
+static struct workers *workers = NULL;
+static unsigned char *buf = NULL;
+static size_t buf_size = IO_BUFSIZE;
+static const char *out_dir = NULL;
+static int recursive = 0;
+static const struct xor_ctx *batch_key = NULL;
+
+/* The part of each input to encrypt, by default all of it. */
+static unsigned long long range_offset = 0;
+static unsigned long long range_length = ULLONG_MAX;
+
+/* Size of the pieces of input shared out between the workers. */
+#define JOB_SIZE (1 << 20)
+#define JOBS_PER_WORKER 4
+
 static struct option options[] = {
+    { "jobs", required_argument, NULL, 'j'},
+    { "in-place", no_argument, NULL, 'i'},
+    { "offset", required_argument, NULL, 'O'},
+    { "length", required_argument, NULL, 'L'},
+    { "stats", no_argument, NULL, 'X'},
+    { "async-io", no_argument, NULL, 'A'},
+    { "output", required_argument, NULL, 'o'},
+    { "recursive", no_argument, NULL, 'W'},
+    { "recover", no_argument, NULL, 'R'},
+    { "plaintext", required_argument, NULL, 'P'},
+    { "crib", required_argument, NULL, 'C'},
     { "help", no_argument, NULL, 'h'},
     { "version", no_argument, NULL, 'v'},
     { NULL, 0, NULL, 0 }
@@ -17,15 +54,71 @@ static struct option options[] = {
 static void print_version();
 static void print_help();
 
-static void encrypt(FILE *fp, char *keyword);
+static void encrypt(int fd, struct xor_ctx *ctx);
+static void encrypt_in_place(const char *path, struct xor_ctx *ctx);
+static void encrypt_buffer(struct xor_ctx *ctx, unsigned char *dest,
+                           const unsigned char *src, size_t len);
+static void encrypt_batch(char **files, int nfiles, struct xor_ctx *ctx,
+                          int stats);
+static void recover(const char *path, const char *plaintext, const char *crib);
+static int parse_size(const char *s, unsigned long long *size);
 
 int main(int argc, char **argv) {
-    char *keyword = NULL;
+    struct xor_ctx ctx;
+    int jobs = 0;
+    int in_place = 0;
+    int stats = 0;
+    int recovering = 0;
+    const char *plaintext = NULL, *crib = NULL;
     invoc_name = argv[0];
 
     int c;
-    while ((c = getopt_long(argc, argv, "hv", options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "j:io:hv", options, NULL)) != -1) {
         switch(c) {
+            case 'j':
+                jobs = atoi(optarg);
+                if ( jobs < 1 ) {
+                    fprintf(stderr, "%s: The number of jobs needs to be at least 1.\n"
+                                    "Try '%s --help' for more information.\n"
+                                    , invoc_name, invoc_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'i':
+                in_place = 1;
+                break;
+            case 'R':
+                recovering = 1;
+                break;
+            case 'P':
+                plaintext = optarg;
+                recovering = 1;
+                break;
+            case 'C':
+                crib = optarg;
+                recovering = 1;
+                break;
+            case 'O': case 'L':
+                if ( parse_size(optarg, c == 'O'? &range_offset
+                                                      : &range_length) ) {
+                    fprintf(stderr, "%s: '%s' isn't a number of bytes.\n"
+                                    "Try '%s --help' for more information.\n"
+                                    , invoc_name, optarg, invoc_name);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'X':
+                stats = 1;
+                break;
+            case 'A':
+                async_io = 1;
+                break;
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'W':
+                recursive = 1;
+                break;
             case 'h':
                 print_help();
                 exit(EXIT_SUCCESS);
@@ -41,6 +134,39 @@ int main(int argc, char **argv) {
         }
     }
 
+    if ( recursive && out_dir == NULL ) {
+        fprintf(stderr, "%s: --recursive needs -o.\n"
+                        "Try '%s --help' for more information.\n"
+                        , invoc_name, invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Each file of a batch is a job of its own, so use every processor. */
+    if ( jobs == 0 )
+        jobs = out_dir != NULL && !recovering?
+               sysconf(_SC_NPROCESSORS_ONLN) : 1;
+
+    if ( recovering ) {
+        if ( plaintext != NULL && crib != NULL ) {
+            fprintf(stderr, "%s: Only one of --plaintext and --crib needed.\n"
+                            "Try '%s --help' for more information.\n"
+                            , invoc_name, invoc_name);
+            exit(EXIT_FAILURE);
+        } else if ( argc - optind > 1 ) {
+            fprintf(stderr, "%s: Only one FILE can be recovered from.\n"
+                            "Try '%s --help' for more information.\n"
+                            , invoc_name, invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        if ( ( workers = workers_start(jobs) ) == NULL ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        recover(optind < argc? argv[optind] : NULL, plaintext, crib);
+        workers_stop(workers);
+        return 0;
+    }
+
     if ( optind == argc ) {
         fprintf(stderr, "%s: Keyword missing.\n"
                         "Try '%s --help' for more information.\n"
@@ -53,40 +179,379 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    keyword = argv[optind];
+    if ( xor_init(&ctx, argv[optind]) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( in_place && ( range_offset != 0 || range_length != ULLONG_MAX ) ) {
+        fprintf(stderr, "%s: Only whole files can be encrypted in place.\n"
+                        "Try '%s --help' for more information.\n"
+                        , invoc_name, invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( in_place && optind + 1 == argc ) {
+        fprintf(stderr, "%s: Encrypting in place needs FILEs.\n"
+                        "Try '%s --help' for more information.\n"
+                        , invoc_name, invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( out_dir != NULL ) {
+        if ( in_place || range_offset != 0 || range_length != ULLONG_MAX
+          || optind + 1 == argc ) {
+            fprintf(stderr, "%s: -o needs FILEs and can't be used with "
+                            "--in-place, --offset or --length.\n"
+                            "Try '%s --help' for more information.\n"
+                            , invoc_name, invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        if ( ( workers = workers_start(jobs) ) == NULL ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        encrypt_batch(argv + optind + 1, argc - optind - 1, &ctx, stats);
+    }
+
+    if ( jobs > 1 ) {
+        if ( ( workers = workers_start(jobs) ) == NULL ) {
+            perror(invoc_name);
+            exit(EXIT_FAILURE);
+        }
+        buf_size = (size_t) JOBS_PER_WORKER * workers_count(workers) * JOB_SIZE;
+    }
+
+    if ( ( buf = malloc(buf_size) ) == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( stats )
+        io_stats_start(IO_STATS_BYTES);
+    io_writer_init(&out, STDOUT_FILENO, invoc_name);
+    io_read_flush(&out);
+    if ( async_io && ( io_writer_async(&out) || io_ahead_init(&ahead, buf_size) ) ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
 
-    if ( optind + 1 == argc ) {
-        encrypt(stdin, keyword);
+    if ( in_place ) {
+        for (int i = optind + 1; i < argc; i++)
+            encrypt_in_place(argv[i], &ctx);
+    } else if ( optind + 1 == argc ) {
+        encrypt(STDIN_FILENO, &ctx);
     } else {
         for (int i = optind + 1; i < argc; i++) {
-            FILE *fp = fopen(argv[i], "r");
-            if ( fp == NULL ) {
+            int fd = io_open(argv[i], 0);
+            if ( fd == -1 ) {
                 fprintf(stderr, "%s: ", argv[i]);
                 perror(argv[i]);
                 continue;
             }
 
-            encrypt(fp, keyword);
+            encrypt(fd, &ctx);
+
+            close(fd);
+        }
+    }
+
+    io_flush(&out);
+    if ( stats )
+        io_stats_report(invoc_name);
+    xor_free(&ctx);
+
+    if ( workers != NULL )
+        workers_stop(workers);
+
+    return 0;
+}
+
+/*
+ * With -o, each file is started from the beginning of the key, or
+ * from where it would be that far in for a piece of a large one. The
+ * key stream itself is shared, only the position is copied.
+ */
+static int batch_start(void *state) {
+    *(struct xor_ctx *) state = *batch_key;
+    xor_reset(state);
+    return 0;
+}
+
+static size_t batch_update(void *state, unsigned char *out,
+                           const unsigned char *in, size_t len) {
+    return xor_update(state, out, in, len);
+}
+
+static void batch_skip(void *state, unsigned long long offset) {
+    xor_seek(state, offset);
+}
+
+static void encrypt_batch(char **files, int nfiles, struct xor_ctx *ctx,
+                          int stats) {
+    static const struct batch_cipher cipher = {
+        sizeof(struct xor_ctx), batch_start, batch_update, NULL, NULL,
+        1, 0, NULL, batch_skip,
+    };
+
+    batch_key = ctx;
+    if ( stats )
+        io_stats_start(IO_STATS_BYTES);
+    int failures = batch_run(&cipher, files, nfiles, out_dir, recursive,
+                             workers, invoc_name);
+    if ( stats )
+        io_stats_report(invoc_name);
+    exit(failures > 0? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Regular files are mapped and encrypted straight from the mapping
+ * into the output buffer, anything else is read a buffer at a time.
+ * With --async-io everything is read ahead instead, and encrypted
+ * where it was read into. With an offset the key starts from where
+ * it would be that far in, so any part of a file can be decrypted
+ * without the rest of it.
+ */
+static void encrypt(int fd, struct xor_ctx *ctx) {
+    unsigned long long left = range_length;
+    unsigned char *data;
+    struct io_map map;
+    ssize_t n = 0;
+
+    xor_seek(ctx, range_offset);
+    if ( range_offset != 0 && io_skip(fd, range_offset) == -1 ) {
+        perror(invoc_name);
+        return;
+    }
+
+    if ( async_io ) {
+        io_ahead_start(&ahead, fd, left);
+        while ( ( n = io_ahead_next(&ahead, &data) ) > 0 ) {
+            encrypt_buffer(ctx, data, data, n);
+            io_write(&out, data, n);
+        }
+        io_ahead_stop(&ahead);
+    } else if ( io_map(fd, 0, &map) == 0 ) {
+        if ( map.len > left )
+            map.len = left;
+        for (size_t done = 0; done < map.len; done += n) {
+            n = map.len - done < buf_size? map.len - done : buf_size;
+            encrypt_buffer(ctx, buf, map.data + done, n);
+            io_write(&out, buf, n);
+        }
+        io_unmap(&map);
+        return;
+    } else {
+        while ( left > 0
+             && ( n = io_read(fd, buf, left < buf_size? left : buf_size) ) > 0 ) {
+            encrypt_buffer(ctx, buf, buf, n);
+            io_write(&out, buf, n);
+            left -= n;
+        }
+    }
+
+    if ( n == -1 )
+        perror(invoc_name);
+}
+
+static void encrypt_in_place(const char *path, struct xor_ctx *ctx) {
+    struct io_map map;
+    int fd = io_open(path, 1);
+
+    if ( fd == -1 || io_map(fd, 1, &map) == -1 ) {
+        fprintf(stderr, "%s: ", invoc_name);
+        perror(path);
+        if ( fd != -1 )
+            close(fd);
+        return;
+    }
+
+    xor_reset(ctx);
+    encrypt_buffer(ctx, map.data, map.data, map.len);
+
+    io_unmap(&map);
+    close(fd);
+}
+
+struct xor_job {
+    const struct xor_key *key;
+    unsigned char *dest;
+    const unsigned char *src;
+    size_t len;
+    size_t pos;
+};
+
+static void encrypt_job(void *arg, int n) {
+    struct xor_job *job = (struct xor_job *) arg + n;
+    xor_apply(job->key, job->pos, job->dest, job->src, job->len);
+}
+
+/*
+ * With workers the buffer is split into pieces that are encrypted
+ * all at once, each starting from the place in the key cycle its
+ * offset gives.
+ */
+static void encrypt_buffer(struct xor_ctx *ctx, unsigned char *dest,
+                           const unsigned char *src, size_t len) {
+    static struct xor_job *jobs = NULL;
+    const struct xor_key *key = &ctx->key;
+    int max_jobs;
+
+    if ( io_stats.enabled )
+        io_stats_count(src, len);
+
+    if ( workers == NULL ) {
+        xor_update(ctx, dest, src, len);
+        return;
+    }
+
+    max_jobs = JOBS_PER_WORKER * workers_count(workers);
+    if ( jobs == NULL && ( jobs = calloc(max_jobs, sizeof(*jobs)) ) == NULL ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+
+    while ( len > 0 ) {
+        int njobs = 0;
 
-            fclose(fp);
+        while ( len > 0 && njobs < max_jobs ) {
+            struct xor_job *job = &jobs[njobs++];
+            job->key = key;
+            job->dest = dest;
+            job->src = src;
+            job->len = len < JOB_SIZE? len : JOB_SIZE;
+            job->pos = ctx->pos;
+
+            ctx->pos = (ctx->pos + job->len) % key->period;
+            dest += job->len;
+            src += job->len;
+            len -= job->len;
         }
+
+        workers_run(workers, njobs, encrypt_job, jobs);
     }
+}
+
+/* A number of bytes, which has to be all digits. */
+static int parse_size(const char *s, unsigned long long *size) {
+    char *end;
 
+    errno = 0;
+    *size = strtoull(s, &end, 10);
+    if ( *s < '0' || *s > '9' || *end != '\0' || errno == ERANGE )
+        return -1;
     return 0;
 }
 
-static void encrypt(FILE *fp, char *keyword) {
-    int c, i = 0;
-    while ( ( c = fgetc(fp) ) != EOF ) {
-        c ^= keyword[i];
+/*
+ * The whole of path, or stdin if it is NULL, mapped if it can be or
+ * read into memory if not, in which case map's base is left NULL.
+ */
+static void read_input(const char *path, struct io_map *map) {
+    int fd = path == NULL? STDIN_FILENO : io_open(path, 0);
+    size_t size = 0;
+    ssize_t got;
+
+    if ( fd == -1 ) {
+        fprintf(stderr, "%s: ", invoc_name);
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    if ( io_map(fd, 0, map) == 0 ) {
+        if ( path != NULL )
+            close(fd);
+        return;
+    }
+
+    map->data = NULL;
+    map->len = 0;
+    for (;;) {
+        if ( map->len + IO_BUFSIZE > size ) {
+            size = 2 * size + IO_BUFSIZE;
+            if ( ( map->data = realloc(map->data, size) ) == NULL ) {
+                perror(invoc_name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if ( ( got = io_read(fd, map->data + map->len, IO_BUFSIZE) ) <= 0 )
+            break;
+        map->len += got;
+    }
+
+    if ( got == -1 ) {
+        perror(invoc_name);
+        exit(EXIT_FAILURE);
+    }
+    if ( path != NULL )
+        close(fd);
+}
+
+static void free_input(struct io_map *map) {
+    if ( map->base != NULL )
+        io_unmap(map);
+    else
+        free(map->data);
+}
 
-        if ( i < strlen(keyword) )
-            i++;
+/* Prints bytes as they are if they can be, escaped as \xNN if not. */
+static void print_bytes(const unsigned char *bytes, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if ( bytes[i] >= ' ' && bytes[i] < 127 && bytes[i] != '\\' )
+            putchar(bytes[i]);
         else
-            i = 0;
+            printf("\\x%02x", bytes[i]);
+    }
+}
+
+/*
+ * Finds the key the ciphertext in path was encrypted with, from
+ * plaintext lined up with it, a crib somewhere in it or from the
+ * ciphertext alone, and prints it.
+ */
+static void recover(const char *path, const char *plaintext, const char *crib) {
+    struct io_map ciphertext, known;
+    struct xor_recovered key;
+    int failed;
+
+    read_input(path, &ciphertext);
 
-        printf("%c", c);
+    if ( plaintext != NULL ) {
+        read_input(plaintext, &known);
+        failed = xor_known_plaintext(ciphertext.data, known.data,
+                                     known.len < ciphertext.len?
+                                         known.len : ciphertext.len, &key);
+        free_input(&known);
+    } else if ( crib != NULL ) {
+        failed = xor_find_crib(ciphertext.data, ciphertext.len,
+                               (const unsigned char *) crib, strlen(crib),
+                               workers, &key);
+    } else {
+        failed = xor_recover(ciphertext.data, ciphertext.len, &key);
+    }
+    free_input(&ciphertext);
+
+    if ( failed ) {
+        fprintf(stderr, "%s: Couldn't find a key.\n", invoc_name);
+        exit(EXIT_FAILURE);
     }
+
+    printf("period: %zu\n", key.period);
+    if ( crib != NULL )
+        printf("crib at: %zu\n", key.offset);
+
+    /* Only a keyword's cycle ends in its NUL and has no other. */
+    if ( key.key[key.period - 1] != 0
+      || memchr(key.key, 0, key.period - 1) != NULL ) {
+        printf("key: ");
+        print_bytes(key.key, key.period);
+        printf("\n");
+        return;
+    }
+
+    printf("keyword: ");
+    print_bytes(key.key, key.period - 1);
+    printf("\n");
 }
 
 static void print_version() {
@@ -97,14 +562,39 @@ static void print_version() {
 }
 
 static void print_help() {
-    printf("Usage: %s KEYWORD [FILE]...\n"
+    printf("Usage: %s [OPTION]... KEYWORD [FILE]...\n"
+           "   or: %s [OPTION]... --recover [FILE]\n"
            "   or: %s [OPTION]\n"
            "\n"
            "Encrypts stdin or FILEs using an xor cipher using\n"
            "the given KEYWORD. To decrypt, re-encrypt using\n"
            "the same keyword.\n"
            "\n"
+           "    -j, --jobs N    encrypt large inputs with N threads.\n"
+           "    -i, --in-place  encrypt the FILEs themselves rather than\n"
+           "                    writing to standard output.\n"
+           "    -o, --output DIR  encrypt each FILE into a file of the same\n"
+           "                      name in DIR, all at once using -j\n"
+           "                      threads, by default one per processor.\n"
+           "        --recursive  with -o, encrypt the files in any\n"
+           "                     directories given too, recreating them\n"
+           "                     under DIR.\n"
+           "        --offset N  start N bytes into each FILE, with the\n"
+           "                    keyword where it would be there.\n"
+           "        --length N  encrypt at most N bytes of each FILE.\n"
+           "        --recover   rather than encrypting, find the keyword a\n"
+           "                    FILE was encrypted with from the FILE alone.\n"
+           "        --plaintext PLAIN  find it from the FILE and its plaintext.\n"
+           "        --crib TEXT  find it from text somewhere in the FILE's\n"
+           "                     plaintext, at least nine characters longer\n"
+           "                     than the keyword. -j searches with more\n"
+           "                     threads.\n"
+           "        --stats     report what was read, written and transformed\n"
+           "                    and how long it took to standard error.\n"
+           "        --async-io  read ahead and write behind in the background,\n"
+           "                    using io_uring where the kernel has it, so\n"
+           "                    reading, encrypting and writing all overlap.\n"
            "    -h, --help      display this help and exit.\n"
            "    -v, --version   display version information and exit.\n",
-           invoc_name, invoc_name);
+           invoc_name, invoc_name, invoc_name);
 }
@@ -0,0 +1,203 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "cpu.h"
+#include "xor_kernel.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*xor_kernel)(const struct xor_key *key, size_t pos,
+                             unsigned char *out, const unsigned char *in,
+                             size_t len);
+
+int xor_key_init(struct xor_key *key, const char *keyword) {
+    size_t length = strlen(keyword);
+    void *stream;
+
+    key->period = length + 1;
+    if ( posix_memalign(&stream, XOR_STREAM_PAD, key->period + XOR_STREAM_PAD) )
+        return -1;
+    key->stream = stream;
+
+    for (size_t i = 0; i < key->period + XOR_STREAM_PAD; i++)
+        key->stream[i] = keyword[i % key->period];
+
+    return 0;
+}
+
+void xor_key_free(struct xor_key *key) {
+    free(key->stream);
+    key->stream = NULL;
+}
+
+size_t xor_apply_reference(const char *keyword, size_t pos,
+                           unsigned char *buf, size_t len) {
+    size_t i = pos;
+    for (size_t j = 0; j < len; j++) {
+        buf[j] ^= keyword[i];
+
+        if ( i < strlen(keyword) )
+            i++;
+        else
+            i = 0;
+    }
+    return i;
+}
+
+static size_t xor_tail(const struct xor_key *key, size_t pos,
+                       unsigned char *out, const unsigned char *in, size_t len) {
+    for (size_t j = 0; j < len; j++) {
+        out[j] = in[j] ^ key->stream[pos];
+        if ( ++pos == key->period )
+            pos = 0;
+    }
+    return pos;
+}
+
+/*
+ * Each kernel xors a whole vector of input with the key stream
+ * loaded from the current position, then moves the position on
+ * by the vector width modulo the period. The stream is padded by
+ * a vector's worth so the load never runs off its end.
+ */
+static size_t xor_words(const struct xor_key *key, size_t pos,
+                        unsigned char *out, const unsigned char *in,
+                        size_t len) {
+    size_t step = sizeof(uint64_t) % key->period;
+    for (; len >= sizeof(uint64_t);
+           in += sizeof(uint64_t), out += sizeof(uint64_t), len -= sizeof(uint64_t)) {
+        uint64_t v, k;
+        memcpy(&v, in, sizeof(v));
+        memcpy(&k, key->stream + pos, sizeof(k));
+        v ^= k;
+        memcpy(out, &v, sizeof(v));
+
+        pos += step;
+        if ( pos >= key->period )
+            pos -= key->period;
+    }
+    return xor_tail(key, pos, out, in, len);
+}
+
+#ifdef CPU_X86
+__attribute__((target("sse2")))
+static size_t xor_sse2(const struct xor_key *key, size_t pos,
+                       unsigned char *out, const unsigned char *in,
+                       size_t len) {
+    size_t step = 16 % key->period;
+    for (; len >= 16; in += 16, out += 16, len -= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) in);
+        __m128i k = _mm_loadu_si128((const __m128i *) (key->stream + pos));
+        _mm_storeu_si128((__m128i *) out, _mm_xor_si128(v, k));
+
+        pos += step;
+        if ( pos >= key->period )
+            pos -= key->period;
+    }
+    return xor_tail(key, pos, out, in, len);
+}
+
+__attribute__((target("avx2")))
+static size_t xor_avx2(const struct xor_key *key, size_t pos,
+                       unsigned char *out, const unsigned char *in,
+                       size_t len) {
+    size_t step = 32 % key->period;
+    for (; len >= 32; in += 32, out += 32, len -= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) in);
+        __m256i k = _mm256_loadu_si256((const __m256i *) (key->stream + pos));
+        _mm256_storeu_si256((__m256i *) out, _mm256_xor_si256(v, k));
+
+        pos += step;
+        if ( pos >= key->period )
+            pos -= key->period;
+    }
+    return xor_tail(key, pos, out, in, len);
+}
+
+__attribute__((target("avx512f")))
+static size_t xor_avx512(const struct xor_key *key, size_t pos,
+                         unsigned char *out, const unsigned char *in,
+                         size_t len) {
+    size_t step = 64 % key->period;
+    for (; len >= 64; in += 64, out += 64, len -= 64) {
+        __m512i v = _mm512_loadu_si512(in);
+        __m512i k = _mm512_loadu_si512(key->stream + pos);
+        _mm512_storeu_si512(out, _mm512_xor_si512(v, k));
+
+        pos += step;
+        if ( pos >= key->period )
+            pos -= key->period;
+    }
+    return xor_tail(key, pos, out, in, len);
+}
+#endif
+
+static const struct {
+    const char *name;
+    xor_kernel kernel;
+    int features;
+} kernels[] = {
+#ifdef CPU_X86
+    { "avx512", xor_avx512, CPU_AVX512F },
+    { "avx2", xor_avx2, CPU_AVX2 },
+    { "sse2", xor_sse2, CPU_SSE2 },
+#endif
+    { "scalar", xor_words, 0 },
+};
+
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+/* Picked once, whichever thread gets there first. */
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static xor_kernel kernel = NULL;
+static const char *kernel_name = NULL;
+
+static void use_kernel(size_t k) {
+    kernel = kernels[k].kernel;
+    kernel_name = kernels[k].name;
+}
+
+static void select_kernel(void) {
+    int features = cpu_features();
+
+    for (size_t k = 0; k < NKERNELS; k++) {
+        if ( (kernels[k].features & features) == kernels[k].features ) {
+            use_kernel(k);
+            return;
+        }
+    }
+}
+
+int xor_set_kernel(const char *name) {
+    int features = cpu_features();
+
+    pthread_once(&kernel_once, select_kernel);
+
+    for (size_t k = 0; k < NKERNELS; k++) {
+        if ( strcmp(kernels[k].name, name) != 0 )
+            continue;
+        if ( (kernels[k].features & features) != kernels[k].features )
+            return -1;
+        use_kernel(k);
+        return 0;
+    }
+
+    return -1;
+}
+
+size_t xor_apply(const struct xor_key *key, size_t pos,
+                 unsigned char *out, const unsigned char *in, size_t len) {
+    pthread_once(&kernel_once, select_kernel);
+    return kernel(key, pos, out, in, len);
+}
+
+const char *xor_kernel_name(void) {
+    pthread_once(&kernel_once, select_kernel);
+    return kernel_name;
+}
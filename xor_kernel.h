@@ -0,0 +1,44 @@
+#ifndef XOR_KERNEL_H
+#define XOR_KERNEL_H
+
+#include <stddef.h>
+
+/*
+ * The keyword expanded into a key stream. The cycle of the xor
+ * cipher is the keyword followed by its terminating NUL, so the
+ * period is one longer than the keyword. The stream holds the
+ * cycle repeated out to period + XOR_STREAM_PAD bytes so that a
+ * full vector of key can be loaded from any position in the cycle.
+ */
+#define XOR_STREAM_PAD 64
+
+struct xor_key {
+    size_t period;
+    unsigned char *stream;
+};
+
+int xor_key_init(struct xor_key *key, const char *keyword);
+void xor_key_free(struct xor_key *key);
+
+/*
+ * Xors len bytes of in into out, the first with the key at
+ * position pos in the cycle. out may be the same as in.
+ * Returns the position to carry on from for the next buffer.
+ */
+size_t xor_apply(const struct xor_key *key, size_t pos,
+                 unsigned char *out, const unsigned char *in, size_t len);
+
+/* The original byte at a time loop, kept to check the kernels against. */
+size_t xor_apply_reference(const char *keyword, size_t pos,
+                           unsigned char *buf, size_t len);
+
+/*
+ * Picks the kernel by name: avx512, avx2, sse2 or scalar, the word at
+ * a time loop. Returns -1 if there is no such kernel or the processor
+ * can't run it. Call it before any encrypting starts, it isn't safe
+ * to change the kernel while xor_apply() is running.
+ */
+int xor_set_kernel(const char *name);
+const char *xor_kernel_name(void);
+
+#endif
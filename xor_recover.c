@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "xor_recover.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * How much of the ciphertext the period and key are worked out from,
+ * which for anything like text is far more than enough.
+ */
+#define SAMPLE_SIZE (1 << 20)
+
+/* Pieces of ciphertext a crib is looked for in by each job. */
+#define CRIB_PIECE (1 << 22)
+
+/*
+ * How many bytes of the crib past the first period have to agree.
+ * With fewer, somewhere in a large enough file would by chance.
+ */
+#define CRIB_CHECKED 8
+
+/* Percentages of each letter in English text. */
+static const double english_frequencies[26] = {
+    8.167, 1.492, 2.782, 4.253, 12.702, 2.228, 2.015, 6.094, 6.966,
+    0.153, 0.772, 4.025, 2.406, 6.749, 7.507, 1.929, 0.095, 5.987,
+    6.327, 9.056, 2.758, 0.978, 2.360, 0.150, 1.974, 0.074,
+};
+
+/*
+ * Whether the cycle is a keyword's: the only NUL is the last byte.
+ * Anything else can't have come from xor.
+ */
+static int valid_cycle(const unsigned char *key, size_t period) {
+    if ( key[period - 1] != 0 )
+        return 0;
+    for (size_t i = 0; i + 1 < period; i++)
+        if ( key[i] == 0 )
+            return 0;
+    return 1;
+}
+
+int xor_known_plaintext(const unsigned char *ciphertext,
+                        const unsigned char *plaintext, size_t n,
+                        struct xor_recovered *key) {
+    unsigned char stream[2 * XOR_MAX_PERIOD];
+
+    if ( n > sizeof(stream) )
+        n = sizeof(stream);
+
+    for (size_t i = 0; i < n; i++)
+        stream[i] = ciphertext[i] ^ plaintext[i];
+
+    /*
+     * The shortest period the stream repeats with and that fits a
+     * keyword. Any longer one is a multiple of it.
+     */
+    for (size_t period = 1; period <= XOR_MAX_PERIOD && period <= n; period++) {
+        size_t i = period;
+        while ( i < n && stream[i] == stream[i - period] )
+            i++;
+        if ( i == n && valid_cycle(stream, period) ) {
+            key->period = period;
+            key->offset = 0;
+            memcpy(key->key, stream, period);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * The crib fits at offset with period if each of its bytes xored
+ * with the one period on agrees with the ciphertext's, as the same
+ * key byte cancels out of both. The key it gives, each byte put in
+ * its place in the cycle counting from the start of the file, has
+ * to be a keyword's too.
+ */
+static int crib_fits(const unsigned char *ciphertext, size_t offset,
+                     const unsigned char *crib, size_t len, size_t period,
+                     struct xor_recovered *key) {
+    const unsigned char *c = ciphertext + offset;
+
+    for (size_t j = 0; j + period < len; j++)
+        if ( (c[j] ^ c[j + period]) != (crib[j] ^ crib[j + period]) )
+            return 0;
+
+    for (size_t j = 0; j < period; j++)
+        key->key[(offset + j) % period] = c[j] ^ crib[j];
+    if ( !valid_cycle(key->key, period) )
+        return 0;
+
+    key->period = period;
+    key->offset = offset;
+    return 1;
+}
+
+struct crib_job {
+    const unsigned char *ciphertext;
+    size_t n;
+    const unsigned char *crib;
+    size_t len;
+    size_t max_period;
+    int avx2;
+    /* The first place each piece has the crib, or n if it hasn't. */
+    struct xor_recovered *found;
+};
+
+/*
+ * Checks offsets from start up to end, trying every period at each
+ * but only looking any further where the first difference matches.
+ */
+static size_t scan_crib(const struct crib_job *job, size_t start, size_t end,
+                        struct xor_recovered *key) {
+    for (size_t o = start; o < end; o++) {
+        for (size_t p = 1; p <= job->max_period; p++) {
+            if ( (job->ciphertext[o] ^ job->ciphertext[o + p])
+              != (job->crib[0] ^ job->crib[p]) )
+                continue;
+            if ( crib_fits(job->ciphertext, o, job->crib, job->len, p, key) )
+                return o;
+        }
+    }
+    return end;
+}
+
+#ifdef CPU_X86
+/*
+ * The same 32 offsets at a time: for each period the ciphertext is
+ * xored with itself a period on and compared with the crib's first
+ * two differences, so only the offsets that match both are looked at
+ * any closer.
+ */
+__attribute__((target("avx2")))
+static size_t scan_crib_avx2(const struct crib_job *job, size_t start,
+                             size_t end, struct xor_recovered *key) {
+    const unsigned char *c = job->ciphertext;
+    __m256i first[XOR_MAX_PERIOD + 1], second[XOR_MAX_PERIOD + 1];
+    size_t o = start;
+
+    for (size_t p = 1; p <= job->max_period; p++) {
+        first[p] = _mm256_set1_epi8(job->crib[0] ^ job->crib[p]);
+        second[p] = _mm256_set1_epi8(job->crib[1] ^ job->crib[p + 1]);
+    }
+
+    /* Loads reach 33 + max_period bytes on, which has to be there. */
+    for (; o + 32 <= end && o + 33 + job->max_period <= job->n; o += 32) {
+        __m256i here = _mm256_loadu_si256((const __m256i *) (c + o));
+        __m256i next = _mm256_loadu_si256((const __m256i *) (c + o + 1));
+        uint32_t any[XOR_MAX_PERIOD + 1];
+        uint32_t all = 0;
+
+        for (size_t p = 1; p <= job->max_period; p++) {
+            __m256i a = _mm256_xor_si256(here,
+                _mm256_loadu_si256((const __m256i *) (c + o + p)));
+            __m256i b = _mm256_xor_si256(next,
+                _mm256_loadu_si256((const __m256i *) (c + o + 1 + p)));
+            any[p] = _mm256_movemask_epi8(_mm256_and_si256(
+                _mm256_cmpeq_epi8(a, first[p]),
+                _mm256_cmpeq_epi8(b, second[p])));
+            all |= any[p];
+        }
+
+        /* Offsets in order, so the first one found is the first. */
+        while ( all ) {
+            int bit = __builtin_ctz(all);
+            all &= all - 1;
+            for (size_t p = 1; p <= job->max_period; p++)
+                if ( any[p] & (1u << bit)
+                  && crib_fits(c, o + bit, job->crib, job->len, p, key) )
+                    return o + bit;
+        }
+    }
+
+    return scan_crib(job, o, end, key);
+}
+#endif
+
+static void crib_job(void *arg, int job_number) {
+    struct crib_job *job = arg;
+    size_t last = job->n - job->len;
+    size_t start = (size_t) job_number * CRIB_PIECE;
+    size_t end = last - start < CRIB_PIECE? last + 1 : start + CRIB_PIECE;
+    struct xor_recovered *key = &job->found[job_number];
+
+#ifdef CPU_X86
+    if ( job->avx2 ) {
+        key->offset = scan_crib_avx2(job, start, end, key);
+        if ( key->offset == end )
+            key->offset = job->n;
+        return;
+    }
+#endif
+    key->offset = scan_crib(job, start, end, key);
+    if ( key->offset == end )
+        key->offset = job->n;
+}
+
+int xor_find_crib(const unsigned char *ciphertext, size_t n,
+                  const unsigned char *crib, size_t len, struct workers *w,
+                  struct xor_recovered *key) {
+    struct crib_job job;
+    int ret = -1;
+
+    if ( len < CRIB_CHECKED + 1 || len > n )
+        return -1;
+
+    job.ciphertext = ciphertext;
+    job.n = n;
+    job.crib = crib;
+    job.len = len;
+    job.max_period = len - CRIB_CHECKED < XOR_MAX_PERIOD?
+        len - CRIB_CHECKED : XOR_MAX_PERIOD;
+    job.avx2 = cpu_features() & CPU_AVX2;
+
+    int njobs = (n - len) / CRIB_PIECE + 1;
+    job.found = malloc(njobs * sizeof(struct xor_recovered));
+    if ( job.found == NULL )
+        return -1;
+
+    workers_run(w, njobs, crib_job, &job);
+
+    for (int i = 0; i < njobs; i++) {
+        if ( job.found[i].offset != n ) {
+            *key = job.found[i];
+            ret = 0;
+            break;
+        }
+    }
+
+    free(job.found);
+    return ret;
+}
+
+static int popcount64(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (x * 0x0101010101010101ull) >> 56;
+}
+
+/*
+ * The average number of bits each byte differs from the one period
+ * on. Text xored with text differs in about two and a half, anything
+ * xored with a different key byte in about four.
+ */
+static double hamming_distance(const unsigned char *c, size_t n, size_t period) {
+    uint64_t bits = 0;
+    size_t i = 0;
+
+    for (; i + period + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t a, b;
+        memcpy(&a, c + i, sizeof(a));
+        memcpy(&b, c + i + period, sizeof(b));
+        bits += popcount64(a ^ b);
+    }
+    for (; i + period < n; i++)
+        bits += popcount64(c[i] ^ c[i + period]);
+
+    return (double) bits / (n - period);
+}
+
+/*
+ * How much like English text each byte is, mostly by the frequency
+ * of the letters, with anything that wouldn't be in text at all
+ * counting against.
+ */
+static void english_weights(double weights[256]) {
+    for (int b = 0; b < 256; b++) {
+        if ( b >= 'a' && b <= 'z' )
+            weights[b] = english_frequencies[b - 'a'];
+        else if ( b >= 'A' && b <= 'Z' )
+            weights[b] = english_frequencies[b - 'A'] / 10;
+        else if ( b == ' ' )
+            weights[b] = 15;
+        else if ( b == '\n' || b == '.' || b == ',' || b == '\'' )
+            weights[b] = 1;
+        else if ( b >= ' ' && b < 127 )
+            weights[b] = 0.2;
+        else if ( b == '\t' || b == '\r' )
+            weights[b] = 0;
+        else
+            weights[b] = -10;
+    }
+}
+
+int xor_recover(const unsigned char *ciphertext, size_t n,
+                struct xor_recovered *key) {
+    size_t sample = n < SAMPLE_SIZE? n : SAMPLE_SIZE;
+    size_t max_period = sample / 8 < XOR_MAX_PERIOD? sample / 8 : XOR_MAX_PERIOD;
+    double distances[XOR_MAX_PERIOD + 1];
+    double best = 8, mean = 0;
+    double weights[256];
+
+    if ( max_period < 1 )
+        return -1;
+
+    for (size_t p = 1; p <= max_period; p++) {
+        distances[p] = hamming_distance(ciphertext, sample, p);
+        mean += distances[p] / max_period;
+        if ( distances[p] < best )
+            best = distances[p];
+    }
+
+    /*
+     * Multiples of the period differ as little, so it is the shortest
+     * that is close to the best.
+     */
+    key->period = max_period;
+    for (size_t p = 1; p <= max_period; p++) {
+        if ( distances[p] <= best + 0.2 * (mean - best) ) {
+            key->period = p;
+            break;
+        }
+    }
+    key->offset = 0;
+
+    english_weights(weights);
+
+    for (size_t column = 0; column < key->period; column++) {
+        long counts[256] = { 0 };
+        double best_score = -1e300;
+
+        for (size_t i = column; i < sample; i += key->period)
+            counts[ciphertext[i]]++;
+
+        for (int k = 0; k < 256; k++) {
+            double score = 0;
+            for (int b = 0; b < 256; b++)
+                score += counts[b] * weights[b ^ k];
+            if ( score > best_score ) {
+                best_score = score;
+                key->key[column] = k;
+            }
+        }
+    }
+
+    /* A multiple of the period gives the key more than once over. */
+    for (size_t p = 1; p < key->period; p++) {
+        size_t i = p;
+        if ( key->period % p != 0 )
+            continue;
+        while ( i < key->period && key->key[i] == key->key[i - p] )
+            i++;
+        if ( i == key->period ) {
+            key->period = p;
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef XOR_RECOVER_H
+#define XOR_RECOVER_H
+
+#include <stddef.h>
+
+#include "workers.h"
+
+/*
+ * Recovering xor's key from a file it encrypted. The key repeats
+ * every strlen(keyword) + 1 bytes, the keyword and its terminating
+ * NUL, from the start of each file, so a key is found as that cycle
+ * as it lines up with the start of the file: its period and the byte
+ * each position in the cycle is xored with. The keyword is then all
+ * but the last byte, which is the NUL.
+ */
+#define XOR_MAX_PERIOD 128
+
+struct xor_recovered {
+    size_t period;
+    unsigned char key[XOR_MAX_PERIOD];
+    /* Where in the ciphertext a crib was found. */
+    size_t offset;
+};
+
+/*
+ * With plaintext lined up with the start of the ciphertext the key
+ * is just the two xored together, repeating. Returns -1 if what they
+ * give doesn't repeat within XOR_MAX_PERIOD bytes.
+ */
+int xor_known_plaintext(const unsigned char *ciphertext,
+                        const unsigned char *plaintext, size_t n,
+                        struct xor_recovered *key);
+
+/*
+ * Slides the crib, plaintext known to be somewhere in the ciphertext,
+ * along it for a place where it decrypts with a key that repeats in
+ * the right way, splitting the ciphertext between w's threads. The
+ * crib has to be at least eight bytes longer than the period.
+ * Returns -1 if there is no such place.
+ */
+int xor_find_crib(const unsigned char *ciphertext, size_t n,
+                  const unsigned char *crib, size_t len, struct workers *w,
+                  struct xor_recovered *key);
+
+/*
+ * With only the ciphertext the period is the shift at which bytes
+ * differ in the fewest bits, as plaintext xored with plaintext
+ * differs less than with a different part of the key, and each byte
+ * of the key is the one which decrypts its column of bytes into the
+ * most English looking text. Returns -1 if there is too little
+ * ciphertext to go on.
+ */
+int xor_recover(const unsigned char *ciphertext, size_t n,
+                struct xor_recovered *key);
+
+#endif